@@ -2,9 +2,11 @@
 #define DREWNO_MARS_3AC_HPP
 
 #include <assert.h>
+#include <stdint.h>
 #include <list>
 #include <map>
 #include <set>
+#include <vector>
 #include <string.h>
 #include "symbol_table.hpp"
 #include "types.hpp"
@@ -16,11 +18,19 @@ class Procedure;
 class IRProgram;
 class ControlFlowGraph;
 class ASTNode;
+class OptStats;
+class AsmList;
+
+//Labels are referred to by index into the IRProgram's table
+typedef uint32_t LabelId;
+const LabelId NO_LABEL = UINT32_MAX;
 
 class Label{
 public:
-	Label(std::string nameIn){
-		this->name = nameIn;
+	Label(LabelId idIn, std::string nameIn)
+	: id(idIn), name(nameIn){ }
+	LabelId getId(){
+		return id;
 	}
 	std::string toString(){
 		return this->name;
@@ -29,11 +39,12 @@ public:
 		return name;
 	}
 private:
+	LabelId id;
 	std::string name;
 };
 
 enum Register{
-	A, B, C, D, DI, SI
+	A, B, C, D, DI, SI, R8, R9, R10, R11, R12, R13, R14, R15, BP, SP
 };
 
 class RegUtils{
@@ -46,7 +57,18 @@ public:
 			case D: return "d";
 			case DI: return "di";
 			case SI: return "si";
+			case R8: return "r8";
+			case R9: return "r9";
+			case R10: return "r10";
+			case R11: return "r11";
+			case R12: return "r12";
+			case R13: return "r13";
+			case R14: return "r14";
+			case R15: return "r15";
+			case BP: return "bp";
+			case SP: return "sp";
 		}
+		throw new InternalError("no such register");
 	}
 
 	static std::string reg64(Register reg){
@@ -57,6 +79,16 @@ public:
 			case D: return "%rdx";
 			case DI: return "%rdi";
 			case SI: return "%rsi";
+			case R8: return "%r8";
+			case R9: return "%r9";
+			case R10: return "%r10";
+			case R11: return "%r11";
+			case R12: return "%r12";
+			case R13: return "%r13";
+			case R14: return "%r14";
+			case R15: return "%r15";
+			case BP: return "%rbp";
+			case SP: return "%rsp";
 		}
 		throw new InternalError("no such register");
 	}
@@ -69,21 +101,64 @@ public:
 			case D: return "%dl";
 			case DI: return "%dil";
 			case SI: return "%sil";
+			case R8: return "%r8b";
+			case R9: return "%r9b";
+			case R10: return "%r10b";
+			case R11: return "%r11b";
+			case R12: return "%r12b";
+			case R13: return "%r13b";
+			case R14: return "%r14b";
+			case R15: return "%r15b";
+			case BP: return "%bpl";
+			case SP: return "%spl";
 		}
 		throw new InternalError("no such register");
 	}
+
+	//The register carrying argument idx (counting from 1, up to 6)
+	static Register argReg(size_t idx){
+		static const Register regs[] = {DI, SI, D, C, R8, R9};
+		return regs[idx - 1];
+	}
+
+	//Whether a called procedure has to leave reg as it found it
+	static bool calleeSaved(Register reg){
+		switch(reg){
+			case B: case R12: case R13: case R14: case R15: case BP:
+				return true;
+			default:
+				return false;
+		}
+	}
 };
 
+//An operand of a quad, packed into 32 bits. The top two bits
+// say what the low 30 index: a virtual register of the enclosing
+// Procedure (locals, formals and temps), a global of the
+// IRProgram, or an entry in the program's constant pool.
+// Nothing about an operand is a string: names and stack
+// locations are only rendered when text is printed.
 class Opd{
 public:
-	Opd(size_t widthIn) : myWidth(widthIn), myIsFunction(false){}
-	virtual std::string valString() = 0;
-	virtual std::string locString() = 0;
-	virtual size_t getWidth(){ return myWidth; }
-	virtual void genLoadAddr(std::ostream& out, Register reg) = 0;
-	virtual void genStoreAddr(std::ostream& out, Register reg) = 0;
-	virtual void genLoadVal(std::ostream& out, Register reg) = 0;
-	virtual void genStoreVal(std::ostream& out, Register reg) = 0;
+	enum Kind { VREG = 0, GLOBAL = 1, CONST = 2, NONE = 3 };
+
+	Opd() : bits(UINT32_MAX){ }
+	static Opd none(){ return Opd(); }
+	static Opd vreg(uint32_t idx){ return Opd(VREG, idx); }
+	static Opd global(uint32_t idx){ return Opd(GLOBAL, idx); }
+	static Opd constant(uint32_t idx){ return Opd(CONST, idx); }
+
+	Kind kind() const { return static_cast<Kind>(bits >> 30); }
+	uint32_t index() const { return bits & INDEX_MASK; }
+	bool isNone() const { return bits == UINT32_MAX; }
+	bool isVReg() const { return kind() == VREG; }
+	bool isGlobal() const { return kind() == GLOBAL; }
+	bool isConst() const { return kind() == CONST; }
+	uint32_t getBits() const { return bits; }
+	bool operator==(const Opd& other) const { return bits == other.bits; }
+	bool operator!=(const Opd& other) const { return bits != other.bits; }
+	bool operator<(const Opd& other) const { return bits < other.bits; }
+
 	static size_t width(const DataType * type){
 		if (const BasicType * basic = type->asBasic()){
 			return basic->getSize();
@@ -93,484 +168,346 @@ public:
 		}
 		return type->getSize();
 	}
-	virtual std::string getMovOp(){
-		switch(myWidth){
+	static std::string movOp(size_t width){
+		switch(width){
 			case 1: return "movb";
 			case 8: return "movq";
 		}
-
 		throw new InternalError("Bad mov width");
 	}
-	std::string getReg(Register reg){
-		switch(myWidth){
+	static std::string reg(Register reg, size_t width){
+		switch(width){
 			case 1: return RegUtils::reg8(reg);
 			case 8: return RegUtils::reg64(reg);
 		}
 		throw new InternalError("Bad getReg width");
 	}
-	bool isFunction(){ return myIsFunction; }
-	void setIsFunction(bool isFnIn){ myIsFunction = isFnIn; }
-	virtual std::string getMemoryLoc() = 0;
 private:
-	size_t myWidth;
-	bool myIsFunction;
-};
-
-class SymOpd : public Opd{
-public:
-	virtual std::string valString() override{
-		return "[" + mySym->getName() + "]";
-	}
-	virtual std::string locString() override{
-		return mySym->getName();
-	}
-	virtual std::string getName(){
-		return mySym->getName();
-	}
-	const SemSymbol * getSym(){ return mySym; }
-	virtual void genLoadVal(std::ostream& out, Register reg) override;
-	virtual void genStoreVal(std::ostream& out, Register reg) override;
-	virtual void genLoadAddr(std::ostream& out, Register reg) override;
-	virtual void genStoreAddr(std::ostream& out, Register reg) override{
-		throw new InternalError("Cannot change the addr of a symOpd");
-	}
-	virtual void setMemoryLoc(std::string loc){
-		myLoc = loc;
-	}
-	virtual std::string getMemoryLoc() override{
-		return myLoc;
-	}
-private:
-	//Private Constructor
-	SymOpd(SemSymbol * sym, size_t width)
-	: Opd(width), mySym(sym) {}
-	SemSymbol * mySym;
-	friend class Procedure;
-	friend class IRProgram;
-	std::string myLoc;
-};
-
-class LitOpd : public Opd{
-public:
-	LitOpd(std::string valIn, size_t width)
-	: Opd(width), val(valIn){ }
-	static LitOpd * buildInt(int val){
-		/*
-		if (val < 256){
-			return new LitOpd(std::to_string(val), 1);
-		} else {
-		*/
-			return new LitOpd(std::to_string(val), 8);
-		/*
+	static const uint32_t INDEX_MASK = (1u << 30) - 1;
+	Opd(Kind kindIn, uint32_t idx)
+	: bits((static_cast<uint32_t>(kindIn) << 30) | idx){
+		if (idx > INDEX_MASK){
+			throw new InternalError("Operand index overflow");
 		}
-		*/
-	}
-	static LitOpd * buildBool(bool val){
-		if (val){ return new LitOpd("1", 1); }
-		else { return new LitOpd("0", 1); }
-	}
-
-	virtual std::string valString() override{
-		return val;
-	}
-	virtual std::string locString() override{
-		throw InternalError("Tried to get location of a constant");
 	}
-	virtual void genLoadVal(std::ostream& out, Register reg) override;
-	virtual void genStoreVal(std::ostream& out, Register reg) override{
-		throw new InternalError("Cannot change value of a literal");
-	}
-	virtual void genLoadAddr(std::ostream& out, Register reg) override{
-		throw new InternalError("Cannot get addr of a literal");
-	}
-	virtual void genStoreAddr(std::ostream& out, Register reg) override{
-		throw new InternalError("Cannot set the addr of a literal");
-	}
-
-	virtual std::string getMemoryLoc() override{
-		throw InternalError("Tried to get location of a constant");
-	}
-private:
-	std::string val;
-};
-
-class AuxOpd : public Opd{
-public:
-	AuxOpd(std::string nameIn, size_t width)
-	: Opd(width), name(nameIn) { }
-	virtual std::string valString() override{
-		return "[" + getName() + "]";
-	}
-	virtual std::string locString() override{
-		return getName();
-	}
-	std::string getName(){
-		return name;
-	}
-	virtual void genLoadVal(std::ostream& out, Register reg) override;
-	virtual void genStoreVal(std::ostream& out, Register reg) override;
-	virtual void genLoadAddr(std::ostream& out, Register reg) override;
-	virtual void genStoreAddr(std::ostream& out, Register reg) override{
-		throw new InternalError("Cannot change the addr of a auxOpd");
-	}
-
-	virtual void setMemoryLoc(std::string loc){
-		myLoc = loc;
-	}
-	virtual std::string getMemoryLoc() override{
-		return myLoc;
-	}
-
-private:
-	std::string name;
-	std::string myLoc = "UNINIT";
-};
-
-class AddrOpd : public Opd{
-public:
-	AddrOpd(std::string nameIn, size_t width)
-	: Opd(width), name(nameIn) { }
-	virtual std::string valString() override{
-		return "[[" + getName() + "]]";
-	}
-	virtual std::string locString() override{
-		return "[" + getName() + "]";
-	}
-	virtual void genLoadAddr(std::ostream& out, Register reg) override;
-	virtual void genStoreAddr(std::ostream& out, Register reg) override;
-	virtual void genLoadVal(std::ostream& out, Register reg) override;
-	virtual void genStoreVal(std::ostream& out, Register reg) override;
-
-	virtual void setMemoryLoc(std::string loc){
-		myLoc = loc;
-	}
-	virtual std::string getMemoryLoc() override{
-		return myLoc;
-	}
-	virtual std::string getName(){
-		return name;
-	}
-private:
-	std::string val;
-	std::string name;
-	std::string myLoc;
-};
-
-enum BinOp {
-	ADD64, SUB64, DIV64, MULT64, EQ64, NEQ64, LT64, GT64, LTE64, GTE64,
-	OR64,   AND64,
-	ADD8,  SUB8,  DIV8,  MULT8,  EQ8,  NEQ8,  LT8,  GT8,  LTE8,  GTE8,
-	OR8,   AND8
-};
-enum UnaryOp{
-	NEG64, NEG8, NOT64, NOT8
-};
-
-class Quad{
-public:
-	Quad();
-	void addLabel(Label * label);
-	Label * getLabel(){ return labels.front(); }
-	void clearLabels(){ labels.clear(); }
-	virtual std::string repr() = 0;
-	std::string commentStr();
-	virtual std::string toString(bool verbose=false);
-	void setComment(std::string commentIn);
-	virtual void codegenX64(std::ostream& out) = 0;
-	void codegenLabels(std::ostream& out);
-private:
-	std::string myComment;
-	std::list<Label *> labels;
-};
-
-class BinOpQuad : public Quad{
-public:
-	BinOpQuad(Opd * dstIn, BinOp oprIn, Opd * src1In, Opd * src2In);
-	std::string repr() override;
-	static std::string oprString(BinOp opr);
-	void codegenX64(std::ostream& out) override;
-	Opd * getDst(){ return dst; }
-	Opd * getSrc1(){ return src1; }
-	Opd * getSrc2(){ return src2; }
-	BinOp getOp(){ return opr; }
-private:
-	Opd * dst;
-	BinOp opr;
-	Opd * src1;
-	Opd * src2;
+	uint32_t bits;
 };
 
-class UnaryOpQuad : public Quad {
-public:
-	UnaryOpQuad(Opd * dstIn, UnaryOp opIn, Opd * srcIn);
-	std::string repr() override ;
-	void codegenX64(std::ostream& out) override;
-	Opd * getDst(){ return dst; }
-	Opd * getSrc(){ return src; }
-	UnaryOp getOp(){ return op; }
-private:
-	Opd * dst;
-	UnaryOp op;
-	Opd * src;
+enum VRegKind{
+	LOCAL_VREG, FORMAL_VREG, TEMP_VREG
 };
 
-class AssignQuad : public Quad{
-public:
-	AssignQuad(Opd * dstIn, Opd * srcIn, bool isArray);
-	std::string repr() override;
-	void codegenX64(std::ostream& out) override;
-	Opd * getDst(){ return dst; }
-	Opd * getSrc(){ return src; }
-private:
-	Opd * dst;
-	Opd * src;
-};
-
-
-
-class LocQuad : public Quad {
-public:
-	LocQuad(Opd * srcIn, Opd * tgtIn, bool srcLocIn, bool tgtLocIn)
-	: src(srcIn), tgt(tgtIn), srcIsLoc(srcLocIn), tgtIsLoc(tgtLocIn){ }
-	std::string repr() override;
-	void codegenX64(std::ostream& out) override;
-private:
-	Opd * src;
-	Opd * tgt;
-	bool srcIsLoc;
-	bool tgtIsLoc;
-};
-
-class GotoQuad : public Quad {
-public:
-	GotoQuad(Label * tgtIn);
-	std::string repr() override;
-	void codegenX64(std::ostream& out) override;
-	Label * getTarget(){ return tgt; }
-private:
-	Label * tgt;
-};
-
-class IfzQuad : public Quad {
-public:
-	IfzQuad(Opd * cndIn, Label * tgtIn);
-	std::string repr() override;
-	Label * getTarget(){ return tgt; }
-	Opd * getCnd(){ return cnd; }
-	void codegenX64(std::ostream& out) override;
-private:
-	Opd * cnd;
-	Label * tgt;
-};
-
-class NopQuad : public Quad {
-public:
-	NopQuad();
-	std::string repr() override;
-	void codegenX64(std::ostream& out) override;
-};
-
-class WriteQuad : public Quad {
-public:
-	WriteQuad(Opd * src, const DataType * type);
-	std::string repr() override;
-	Opd * getSrc(){ return mySrc; }
-	const DataType * getType(){ return mySrcType; }
-	void codegenX64(std::ostream& out) override;
-private:
-	Opd * mySrc;
-	const DataType * mySrcType;
+//Per-procedure information about a virtual register. Locals and
+// formals remember their symbol (for printing); the frame offset
+// is filled in by allocLocals and is relative to %rbp. A vreg
+// split off another (such as an SSA version) records the vreg it
+// came from as its origin; others are their own origin. A vreg
+// the register allocator placed in a machine register has
+// inReg set and lives in reg instead of its frame slot.
+struct VRegInfo{
+	VRegKind kind;
+	unsigned char width;
+	int frameOffset;
+	SemSymbol * sym;
+	uint32_t origin;
+	bool inReg;
+	Register reg;
 };
 
-class ReadQuad : public Quad {
-public:
-	ReadQuad(Opd* dst, const DataType * dstType);
-	std::string repr() override;
-	Opd * getDst(){ return myDst; }
-	const DataType * getType(){ return myDstType; }
-	void codegenX64(std::ostream& out) override;
-private:
-	Opd * myDst;
-	const DataType * myDstType;
+enum RegAllocKind{
+	NO_REG_ALLOC, LINEAR_SCAN_ALLOC, GRAPH_COLOR_ALLOC
 };
 
-class ExitQuad : public Quad {
-public:
-	ExitQuad();
-	std::string repr() override;
-	void codegenX64(std::ostream& out) override;
+//Settings for the x64 backend
+struct X64Options{
+	RegAllocKind regAlloc;
+	//Let vregs that are never live together share frame slots
+	bool shareSlots;
+	//Address the frame from %rsp and hand %rbp to the allocator
+	bool omitFramePointer;
+	//Give procedures that call nothing and keep everything in
+	// registers no frame at all
+	bool elideLeafFrames;
+	//Clean up the generated code with peephole rewrites
+	bool peephole;
+	//Counters for the backend to bump, if any
+	OptStats * stats;
 };
 
-class MagicQuad : public Quad{
-public:
-	MagicQuad(Opd * dstIn);
-	std::string repr() override;
-	void codegenX64(std::ostream& out) override;
-private:
-	Opd * myDst;
+//How a procedure's frame is set up: below a saved %rbp that
+// points into it, addressed from %rsp, or not at all
+enum FrameKind{
+	RBP_FRAME, RSP_FRAME, NO_FRAME
 };
 
-
-class CallQuad : public Quad{
-public:
-	CallQuad(SemSymbol * calleeIn);
-	std::string repr() override;
-	void codegenX64(std::ostream& out) override;
-private:
-	Opd * calleeOpd;
+//A program-wide global: a variable or a function
+struct GlobalInfo{
 	SemSymbol * sym;
+	size_t width;
 };
 
-class EnterQuad : public Quad{
-public:
-	EnterQuad(Procedure * proc);
-	virtual std::string repr() override;
-	void codegenX64(std::ostream& out) override;
-private:
-	Procedure * myProc;
+enum ConstKind{
+	INT_CONST, STR_CONST
 };
 
-class LeaveQuad : public Quad{
-public:
-	LeaveQuad(Procedure * proc);
-	virtual std::string repr() override;
-	void codegenX64(std::ostream& out) override;
-private:
-	Procedure * myProc;
+//An entry in the constant pool. Integer (and boolean) constants
+// carry their value; string constants carry the index of their
+// contents, which are emitted as a str_<index> label.
+struct ConstInfo{
+	ConstKind kind;
+	size_t width;
+	int64_t value;
 };
 
-class SetArgQuad : public Quad{
-public:
-	SetArgQuad(size_t indexIn, Opd * opdIn, const DataType * typeIn);
-	std::string repr() override;
-	void codegenX64(std::ostream& out) override;
-	Opd * getSrc(){ return opd; }
-	size_t getIndex(){ return index; }
-	const DataType * getType(){ return type; }
-private:
-	size_t index;
-	Opd * opd;
-	const DataType * type;
+enum BinOp {
+	ADD64, SUB64, DIV64, MULT64, EQ64, NEQ64, LT64, GT64, LTE64, GTE64,
+	OR64,   AND64,
+	ADD8,  SUB8,  DIV8,  MULT8,  EQ8,  NEQ8,  LT8,  GT8,  LTE8,  GTE8,
+	OR8,   AND8
 };
-
-class GetArgQuad : public Quad{
-public:
-	GetArgQuad(size_t indexIn, Opd * opdIn, bool isRecord);
-	std::string repr() override;
-	void codegenX64(std::ostream& out) override;
-	Opd * getDst(){ return opd; }
-	bool isRecord(){ return myIsRecord; } 
-private:
-	size_t index;
-	Opd * opd;
-	bool myIsRecord;
-	Procedure * myProc;
+enum UnaryOp{
+	NEG64, NEG8, NOT64, NOT8
 };
 
-class SetRetQuad : public Quad{
-public:
-	SetRetQuad(Opd * opdIn, bool isRecordIn);
-	std::string repr() override;
-	Opd * getSrc(){ return opd; }
-	bool isRecord(){ return myIsRecord; } 
-	void codegenX64(std::ostream& out) override;
-private:
-	Opd * opd;
-	const bool myIsRecord;
+//The kind of a quad. Each quad is a plain value tagged with
+// one of these; codegen and printing switch on it rather than
+// dispatching through a vtable.
+enum QuadOp : unsigned char {
+	BINOP_QUAD, UNARYOP_QUAD, ASSIGN_QUAD, GOTO_QUAD, IFZ_QUAD,
+	NOP_QUAD, WRITE_QUAD, READ_QUAD, EXIT_QUAD, MAGIC_QUAD,
+	CALL_QUAD, ENTER_QUAD, LEAVE_QUAD, SETARG_QUAD, GETARG_QUAD,
+	SETRET_QUAD, GETRET_QUAD, PHI_QUAD, TAILCALL_QUAD
 };
 
-class GetRetQuad : public Quad{
+//A single three-address instruction. Quads are small PODs
+// stored by value in their Procedure: the fields that a
+// given opcode does not use are left as none/0. Comments
+// are rare, so they live in an interned side table on the
+// IRProgram and the quad only keeps a (nonzero) index into it.
+class Quad{
 public:
-	GetRetQuad(Opd * opdIn, bool isRecordIn);
-	std::string repr() override;
-	Opd * getDst(){ return opd; }
-	void codegenX64(std::ostream& out) override;
-	bool isRecord(){ return myIsRecord; } 
+	static Quad binOp(Opd dst, BinOp opr, Opd src1, Opd src2);
+	static Quad unaryOp(Opd dst, UnaryOp opr, Opd src);
+	static Quad assign(Opd dst, Opd src);
+	static Quad jump(Label * tgt);
+	static Quad ifz(Opd cnd, Label * tgt);
+	static Quad nop();
+	static Quad write(Opd src, const DataType * type);
+	static Quad read(Opd dst, const DataType * type);
+	static Quad exit();
+	static Quad magic(Opd dst);
+	static Quad call(Opd callee);
+	static Quad enter();
+	static Quad leave();
+	static Quad setArg(size_t index, Opd src);
+	static Quad getArg(size_t index, Opd dst);
+	static Quad setRet(Opd src);
+	static Quad getRet(Opd dst);
+	//A phi node, only present while the procedure is in SSA
+	// form. Its arguments live in the procedure's phi table.
+	static Quad phi(Opd dst, size_t argsIdx);
+	//A call in tail position: the frame is torn down and the
+	// callee returns straight to our caller
+	static Quad tailCall(Opd callee);
+
+	QuadOp getOp() const { return static_cast<QuadOp>(myOp); }
+	BinOp getBinOp() const { return static_cast<BinOp>(mySubOp); }
+	UnaryOp getUnaryOp() const { return static_cast<UnaryOp>(mySubOp); }
+	BaseType getIOType() const { return static_cast<BaseType>(mySubOp); }
+
+	//dst is the operand written, src1/src2 those read. Quads
+	// with a single source use src1 (ifz's condition, the
+	// callee of a call, etc).
+	Opd getDst() const { return myDst; }
+	Opd getSrc1() const { return mySrc1; }
+	Opd getSrc2() const { return mySrc2; }
+	LabelId getTarget() const { return myAux; }
+	size_t getIndex() const { return myAux; }
+	void setDst(Opd opd){ myDst = opd; }
+	void setSrc1(Opd opd){ mySrc1 = opd; }
+	void setSrc2(Opd opd){ mySrc2 = opd; }
+
+	bool hasLabel() const { return myLabel != NO_LABEL; }
+	LabelId getLabel() const { return myLabel; }
+	void setLabel(Label * label);
+	void clearLabel(){ myLabel = NO_LABEL; }
+	void setTarget(Label * tgt){ myAux = tgt->getId(); }
+	unsigned short getCommentIdx() const { return myComment; }
+	void setCommentIdx(unsigned short idx){ myComment = idx; }
+
+	std::string repr(const Procedure * proc) const;
+	std::string toString(const Procedure * proc, bool verbose=false) const;
+	void codegenX64(AsmList& out, Procedure * proc) const;
+	void codegenLabels(AsmList& out, const Procedure * proc) const;
 private:
-	Opd * opd;
-	const bool myIsRecord;
+	explicit Quad(QuadOp opIn);
+
+	unsigned char myOp;
+	unsigned char mySubOp;
+	unsigned short myComment;
+	LabelId myLabel;
+	Opd myDst;
+	Opd mySrc1;
+	Opd mySrc2;
+	uint32_t myAux;
 };
 
 class Procedure{
 public:
 	Procedure(IRProgram * prog, std::string name);
-	void addQuad(Quad * quad);
-	Quad * popQuad();
-	IRProgram * getProg();
-	std::list<SymOpd *> getFormals() { return formals; }
-	SymOpd * getFormal(size_t idx){
-		auto itr = formals.begin();
-		for (size_t i = 0; i < idx; i++, itr++);
-		return *itr;
-	}
+	void addQuad(Quad quad, std::string comment="");
+	Quad popQuad();
+	IRProgram * getProg() const;
+	//One entry per formal, in order; formals dropped by
+	// compactVRegs are left as none
+	const std::vector<Opd>& getFormals() const { return formals; }
+	Opd getFormal(size_t idx) const { return formals[idx]; }
 	drewno_mars::Label * makeLabel();
 
 	void gatherLocal(SemSymbol * sym);
 	void gatherFormal(SemSymbol * sym);
-	SymOpd * getSymOpd(SemSymbol * sym);
-	AuxOpd * makeTmp(size_t width);
-	AddrOpd * makeAddrOpd(size_t width);
+	Opd getSymOpd(SemSymbol * sym);
+	Opd makeTmp(size_t width);
+	size_t numVRegs() const { return vregs.size(); }
+	const VRegInfo& getVReg(Opd opd) const { return vregs[opd.index()]; }
+	VRegInfo& getVReg(Opd opd){ return vregs[opd.index()]; }
+	size_t widthOf(Opd opd) const;
+	std::string valString(Opd opd) const;
+	std::string locString(Opd opd) const;
+	std::string labelName(LabelId id) const;
+
+	//x64 accessors for operands, defined with the codegen
+	std::string memLoc(Opd opd) const;
+	//The frame location at offset from where %rbp points in a
+	// frame with a frame pointer, however the frame is addressed
+	std::string frameLoc(int offset) const;
+	//Codegen reports each push and pop between the prologue and
+	// epilogue, so %rsp-relative locations can account for them
+	void adjustStackDepth(int bytes){ stackDepth += bytes; }
+	FrameKind getFrameKind() const { return frameKind; }
+	void genLoadVal(AsmList& out, Opd opd, Register reg) const;
+	void genStoreVal(AsmList& out, Opd opd, Register reg) const;
 
 	std::string toString(bool verbose=false);
-	std::string getName();
+	std::string getName() const;
 
 	drewno_mars::Label * getLeaveLabel();
 
-	void toX64(std::ostream& out);
+	//A fresh vreg of the same width and symbol as opd, with opd's
+	// origin as its own
+	Opd cloneVReg(Opd opd);
+	//A fresh vreg like one of another procedure's, for copying
+	// its body in; formals come in as locals
+	Opd adoptVReg(const VRegInfo& info);
+	//The phi table: each phi quad indexes a list of arguments,
+	// one per predecessor of its block, in CFG order
+	size_t makePhiArgs(size_t numArgs, Opd init);
+	std::vector<Opd>& getPhiArgs(const Quad& phi){
+		return phiArgs[phi.getIndex()];
+	}
+	const std::vector<Opd>& getPhiArgs(const Quad& phi) const {
+		return phiArgs[phi.getIndex()];
+	}
+	void clearPhis(){ phiArgs.clear(); }
+	//Drop vregs that no longer appear in the body, renumbering
+	// the rest; returns how many were dropped
+	size_t compactVRegs();
+
+	void toX64(std::ostream& out, const X64Options& opts);
 	size_t arSize() const;
 	size_t numTemps() const;
-
-	std::list<Quad *> * getQuads(){ return bodyQuads; }
-	EnterQuad * getEnter(){ return enter; }
-	LeaveQuad * getLeave(){ return leave; }
-	void replaceQuad(Quad * oldQuad, Quad * newQuad);
+	//The callee-saved registers the body uses, saved in the
+	// frame by the prologue; set by allocLocals
+	const std::vector<Register>& getSavedRegs() const { return savedRegs; }
+
+	const std::vector<Quad>& getQuads() const { return bodyQuads; }
+	//Mutable access to the body; drops the cached CFG
+	std::vector<Quad>& editQuads(){ invalidateCFG(); return bodyQuads; }
+	const Quad& getEnter() const { return enter; }
+	const Quad& getLeave() const { return leave; }
+
+	//The CFG of the body, built on first use and kept until the
+	// quads change. A graph fetched before an edit stays readable
+	// (describing the old body) until the next call to getCFG.
+	const ControlFlowGraph * getCFG();
+	void invalidateCFG();
 private:
-	void allocLocals();
+	void allocLocals(const X64Options& opts);
+	Opd makeVReg(VRegKind kind, size_t width, SemSymbol * sym);
 
-	EnterQuad * enter;
-	LeaveQuad * leave;
+	Quad enter;
+	Quad leave;
 	Label * leaveLabel;
 
 	IRProgram * myProg;
-	std::map<SemSymbol *, SymOpd *> locals;
-	std::list<AuxOpd *> temps;
-	std::list<SymOpd *> formals;
-	std::list<AddrOpd *> addrOpds;
-	std::list<Quad *> * bodyQuads;
+	std::vector<VRegInfo> vregs;
+	HashMap<SemSymbol *, Opd> symVRegs;
+	std::vector<Opd> formals;
+	std::vector<Quad> bodyQuads;
+	std::vector<std::vector<Opd>> phiArgs;
+	ControlFlowGraph * myCFG;
+	bool cfgStale;
+	std::vector<Register> savedRegs;
+	size_t frameSize;
+	FrameKind frameKind;
+	int stackDepth;
 	std::string myName;
-	size_t maxTmp;
 };
 
 class IRProgram{
 public:
 	IRProgram(TypeAnalysis * taIn) : ta(taIn){
 		procs = new std::list<Procedure *>();
+		comments.push_back("");
 		init = new Procedure(this, "<init>");
 	}
 	Procedure * makeProc(std::string name);
 	std::list<Procedure *> * getProcs();
 	Label * makeLabel();
-	Opd * makeString(std::string val);
+	Label * makeLabel(std::string name);
+	Label * getLabel(LabelId id) const { return labels[id]; }
+	Opd makeString(std::string val);
+	Opd makeInt(int64_t val, size_t width=8);
+	Opd makeBool(bool val);
 	void gatherGlobal(SemSymbol * sym);
-	SymOpd * getGlobal(SemSymbol * sym);
+	Opd getGlobal(SemSymbol * sym);
+	const GlobalInfo& getGlobalInfo(Opd opd) const {
+		return globals[opd.index()];
+	}
+	const ConstInfo& getConst(Opd opd) const {
+		return consts[opd.index()];
+	}
+	std::string constString(Opd opd) const;
+	std::string globalLoc(Opd opd) const;
 	size_t opWidth(ASTNode * node);
 	const DataType * nodeType(ASTNode * node);
-	std::set<Opd *> globalSyms();
 	std::string toString(bool verbose=false);
 
-	void toX64(std::ostream& out);
+	unsigned short internComment(std::string comment);
+	const std::string& getComment(unsigned short idx) const {
+		return comments[idx];
+	}
+
+	void toX64(std::ostream& out, const X64Options& opts);
 	Procedure * getInitProc(){ return init; }
 private:
 	TypeAnalysis * ta;
 	size_t max_label = 0;
-	size_t str_idx = 0;
 	std::list<Procedure *> * procs;
 	Procedure * init;
-	HashMap<LitOpd *, std::string> strings;
-	std::map<SemSymbol *, SymOpd *> globals;
+	std::vector<GlobalInfo> globals;
+	HashMap<SemSymbol *, Opd> globalIdxs;
+	//The constant pool. Integers are interned by (value, width)
+	// and strings by their contents.
+	std::vector<ConstInfo> consts;
+	std::map<std::pair<int64_t, size_t>, Opd> intConsts;
+	std::vector<std::string> strings;
+	HashMap<std::string, Opd> strConsts;
+	std::vector<Label *> labels;
+	std::vector<std::string> comments;
+	HashMap<std::string, unsigned short> commentIdxs;
 
 	void datagenX64(std::ostream& out);
-	void allocGlobals();
 };
 
 }
@@ -18,10 +18,9 @@ static void formalsTo3AC(Procedure * proc,
 	unsigned int argIdx = 1;
 	for (auto formal : *myFormals){
 		SemSymbol * sym = formal->ID()->getSymbol();
-		SymOpd * opd = proc->getSymOpd(sym);
+		Opd opd = proc->getSymOpd(sym);
 
-		Quad * inQuad = new GetArgQuad(argIdx, opd, false);
-		proc->addQuad(inQuad);
+		proc->addQuad(Quad::getArg(argIdx, opd));
 		argIdx += 1;
 	}
 }
@@ -48,10 +47,10 @@ void FnDeclNode::to3AC(Procedure * proc){
 
 //We only get to this node if we are in a stmt
 // context (DeclNodes protect descent)
-Opd * IDNode::flatten(Procedure * proc){
+Opd IDNode::flatten(Procedure * proc){
 	SemSymbol * sym = this->getSymbol();
-	Opd * res = proc->getSymOpd(sym);
-	if (!res){
+	Opd res = proc->getSymOpd(sym);
+	if (res.isNone()){
 		throw new InternalError("null id sym");;
 	}
 	return res;
@@ -66,305 +65,314 @@ void FormalDeclNode::to3AC(Procedure * proc){
 	proc->gatherFormal(sym);
 }
 
-Opd * IntLitNode::flatten(Procedure * proc){
-	return LitOpd::buildInt(myNum);
+Opd IntLitNode::flatten(Procedure * proc){
+	return proc->getProg()->makeInt(myNum);
 }
 
-Opd * StrLitNode::flatten(Procedure * proc){
-	Opd * res = proc->getProg()->makeString(myStr);
+Opd StrLitNode::flatten(Procedure * proc){
+	Opd res = proc->getProg()->makeString(myStr);
 	return res;
 }
 
-Opd * TrueNode::flatten(Procedure * proc){
-	Opd * res = new LitOpd("1", 8);
-	return res;
+Opd TrueNode::flatten(Procedure * proc){
+	return proc->getProg()->makeBool(true);
 }
 
 
-Opd * FalseNode::flatten(Procedure * proc){
-	Opd * res = new LitOpd("0", 8);
-	return res;
+Opd FalseNode::flatten(Procedure * proc){
+	return proc->getProg()->makeBool(false);
 }
 
 static void argsTo3AC(Procedure * proc, std::list<ExpNode *> * args){
-	std::list<std::pair<Opd *, const DataType *>> argOpds;
+	std::list<Opd> argOpds;
 	for (auto argNode : *args){
-		Opd * argOpd = argNode->flatten(proc);
-		const DataType * argType = proc->getProg()->nodeType(argNode);
-		argOpds.push_back(std::make_pair(argOpd, argType));
+		argOpds.push_back(argNode->flatten(proc));
 	}
 	size_t argIdx = 1;
 	for (auto argOpd : argOpds){
-		Quad * argQuad = new SetArgQuad(argIdx, argOpd.first, argOpd.second);
-		proc->addQuad(argQuad);
+		proc->addQuad(Quad::setArg(argIdx, argOpd));
 		argIdx++;
 	}
 }
 
-Opd * CallExpNode::flatten(Procedure * proc){
+Opd CallExpNode::flatten(Procedure * proc){
 	argsTo3AC(proc, myArgs);
 
 	SemSymbol * idSym = myCallee->getSymbol();
-	Quad * callQuad = new CallQuad(idSym);
-	proc->addQuad(callQuad);
+	proc->addQuad(Quad::call(proc->getSymOpd(idSym)));
 
 	const FnType * calleeType = idSym->getDataType()->asFn();
 	const DataType * retType = calleeType->getReturnType();
 	if (retType->isVoid()){
-		return nullptr;
+		return Opd::none();
 	} else {
-		Opd * retVal = proc->makeTmp(Opd::width(retType));
-		Quad * getRet = new GetRetQuad(retVal, false);
-		proc->addQuad(getRet);
+		Opd retVal = proc->makeTmp(Opd::width(retType));
+		proc->addQuad(Quad::getRet(retVal));
 		return retVal;
 	}
 }
 
-Opd * NegNode::flatten(Procedure * proc){
-	Opd * child = myExp->flatten(proc);
+Opd NegNode::flatten(Procedure * proc){
+	Opd child = myExp->flatten(proc);
 	size_t width = proc->getProg()->opWidth(this);
-	Opd * dst = proc->makeTmp(width);
+	Opd dst = proc->makeTmp(width);
 	UnaryOp opr = UnaryOp::NEG64;
-	Quad * quad = new UnaryOpQuad(dst, opr, child);
-	proc->addQuad(quad);
+	proc->addQuad(Quad::unaryOp(dst, opr, child));
 	return dst;
 }
 
-Opd * NotNode::flatten(Procedure * proc){
-	Opd * child = myExp->flatten(proc);
+Opd NotNode::flatten(Procedure * proc){
+	Opd child = myExp->flatten(proc);
 	size_t width = proc->getProg()->opWidth(myExp);
-	Opd * dst = proc->makeTmp(width);
+	Opd dst = proc->makeTmp(width);
 	UnaryOp opr = UnaryOp::NOT64;
 	if (width == 1){
 		opr = UnaryOp::NOT8;
 	}
-	Quad * quad = new UnaryOpQuad(dst, opr, child);
-	proc->addQuad(quad);
+	proc->addQuad(Quad::unaryOp(dst, opr, child));
 	return dst;
 }
 
-Opd * PlusNode::flatten(Procedure * proc){
-	Opd * childL = myExp1->flatten(proc);
-	Opd * childR = myExp2->flatten(proc);
+Opd PlusNode::flatten(Procedure * proc){
+	Opd childL = myExp1->flatten(proc);
+	Opd childR = myExp2->flatten(proc);
 	size_t width = proc->getProg()->opWidth(this);
-	Opd * dst = proc->makeTmp(width);
+	Opd dst = proc->makeTmp(width);
 	BinOp opr = BinOp::ADD64;
 	if (width == 1){ opr = BinOp::ADD8; }
-	Quad * quad = new BinOpQuad(dst, opr, childL, childR);
-	proc->addQuad(quad);
+	proc->addQuad(Quad::binOp(dst, opr, childL, childR));
 	return dst;
 }
 
-Opd * MinusNode::flatten(Procedure * proc){
-	Opd * childL = myExp1->flatten(proc);
-	Opd * childR = myExp2->flatten(proc);
+Opd MinusNode::flatten(Procedure * proc){
+	Opd childL = myExp1->flatten(proc);
+	Opd childR = myExp2->flatten(proc);
 	size_t width = proc->getProg()->opWidth(this);
-	Opd * dst = proc->makeTmp(width);
+	Opd dst = proc->makeTmp(width);
 	BinOp opr = BinOp::SUB64;
 	if (width == 1){ opr = BinOp::SUB8; }
-	Quad * quad = new BinOpQuad(dst, opr, childL, childR);
-	proc->addQuad(quad);
+	proc->addQuad(Quad::binOp(dst, opr, childL, childR));
 	return dst;
 }
 
-Opd * TimesNode::flatten(Procedure * proc){
-	Opd * childL = myExp1->flatten(proc);
-	Opd * childR = myExp2->flatten(proc);
+Opd TimesNode::flatten(Procedure * proc){
+	Opd childL = myExp1->flatten(proc);
+	Opd childR = myExp2->flatten(proc);
 	size_t width = proc->getProg()->opWidth(this);
-	Opd * dst = proc->makeTmp(width);
+	Opd dst = proc->makeTmp(width);
 	BinOp opr = BinOp::MULT64;
 	if (width == 1){ opr = BinOp::MULT8; }
-	Quad * quad = new BinOpQuad(dst, opr, childL, childR);
-	proc->addQuad(quad);
+	proc->addQuad(Quad::binOp(dst, opr, childL, childR));
 	return dst;
 }
 
-Opd * DivideNode::flatten(Procedure * proc){
-	Opd * op1 = this->myExp1->flatten(proc);
-	Opd * op2 = this->myExp2->flatten(proc);
+Opd DivideNode::flatten(Procedure * proc){
+	Opd op1 = this->myExp1->flatten(proc);
+	Opd op2 = this->myExp2->flatten(proc);
 	size_t width = proc->getProg()->opWidth(this);
-	Opd * dst = proc->makeTmp(width);
+	Opd dst = proc->makeTmp(width);
 	BinOp opr = BinOp::DIV64;
 	if (width == 1){ opr = BinOp::DIV8; }
-	BinOpQuad * quad = new BinOpQuad(dst, opr, op1, op2);
-	proc->addQuad(quad);
+	proc->addQuad(Quad::binOp(dst, opr, op1, op2));
 	return dst;
 }
 
-Opd * AndNode::flatten(Procedure * proc){
-	Opd * op1 = this->myExp1->flatten(proc);
-	Opd * op2 = this->myExp2->flatten(proc);
+void ExpNode::flattenBranch(Procedure * proc, Label * falseLbl){
+	Opd cond = this->flatten(proc);
+	proc->addQuad(Quad::ifz(cond, falseLbl));
+}
+
+//The right operand is only evaluated when the left one does not
+// already decide the result
+Opd AndNode::flatten(Procedure * proc){
 	size_t width = proc->getProg()->opWidth(this);
-	Opd * opRes = proc->makeTmp(width);
-	BinOp opr = BinOp::AND64;
-	if (width == 1){ opr = BinOp::AND8; }
-	BinOpQuad * quad = new BinOpQuad(opRes, opr, op1, op2);
-	proc->addQuad(quad);
+	Opd opRes = proc->makeTmp(width);
+	Label * afterLabel = proc->makeLabel();
+	Quad afterNop = Quad::nop();
+	afterNop.setLabel(afterLabel);
+
+	Opd op1 = this->myExp1->flatten(proc);
+	proc->addQuad(Quad::assign(opRes, op1));
+	proc->addQuad(Quad::ifz(opRes, afterLabel));
+	Opd op2 = this->myExp2->flatten(proc);
+	proc->addQuad(Quad::assign(opRes, op2));
+	proc->addQuad(afterNop);
 	return opRes;
 }
 
-Opd * OrNode::flatten(Procedure * proc){
-	Opd * op1 = this->myExp1->flatten(proc);
-	Opd * op2 = this->myExp2->flatten(proc);
+void AndNode::flattenBranch(Procedure * proc, Label * falseLbl){
+	this->myExp1->flattenBranch(proc, falseLbl);
+	this->myExp2->flattenBranch(proc, falseLbl);
+}
+
+Opd OrNode::flatten(Procedure * proc){
 	size_t width = proc->getProg()->opWidth(this);
-	Opd * opRes = proc->makeTmp(width);
-	BinOp opr = BinOp::OR64;
-	if (width == 1){ opr = BinOp::OR8; }
-	BinOpQuad * quad = new BinOpQuad(opRes, opr, op1, op2);
-	proc->addQuad(quad);
+	Opd opRes = proc->makeTmp(width);
+	Label * rhsLabel = proc->makeLabel();
+	Quad rhsNop = Quad::nop();
+	rhsNop.setLabel(rhsLabel);
+	Label * afterLabel = proc->makeLabel();
+	Quad afterNop = Quad::nop();
+	afterNop.setLabel(afterLabel);
+
+	Opd op1 = this->myExp1->flatten(proc);
+	proc->addQuad(Quad::assign(opRes, op1));
+	proc->addQuad(Quad::ifz(opRes, rhsLabel));
+	proc->addQuad(Quad::jump(afterLabel));
+	proc->addQuad(rhsNop);
+	Opd op2 = this->myExp2->flatten(proc);
+	proc->addQuad(Quad::assign(opRes, op2));
+	proc->addQuad(afterNop);
 	return opRes;
 }
 
-Opd * EqualsNode::flatten(Procedure * proc){
-	Opd * op1 = this->myExp1->flatten(proc);
-	Opd * op2 = this->myExp2->flatten(proc);
+void OrNode::flattenBranch(Procedure * proc, Label * falseLbl){
+	Label * rhsLabel = proc->makeLabel();
+	Quad rhsNop = Quad::nop();
+	rhsNop.setLabel(rhsLabel);
+	Label * afterLabel = proc->makeLabel();
+	Quad afterNop = Quad::nop();
+	afterNop.setLabel(afterLabel);
+
+	this->myExp1->flattenBranch(proc, rhsLabel);
+	proc->addQuad(Quad::jump(afterLabel));
+	proc->addQuad(rhsNop);
+	this->myExp2->flattenBranch(proc, falseLbl);
+	proc->addQuad(afterNop);
+}
+
+Opd EqualsNode::flatten(Procedure * proc){
+	Opd op1 = this->myExp1->flatten(proc);
+	Opd op2 = this->myExp2->flatten(proc);
 	size_t width = proc->getProg()->opWidth(this->myExp1);
 	size_t resWidth = Opd::width(BasicType::BOOL());
-	Opd * dst = proc->makeTmp(resWidth);
+	Opd dst = proc->makeTmp(resWidth);
 	BinOp opr = BinOp::EQ64;
 	if (width == 1){ opr = BinOp::EQ8; }
-	BinOpQuad * quad = new BinOpQuad(dst, opr, op1, op2);
-	proc->addQuad(quad);
+	proc->addQuad(Quad::binOp(dst, opr, op1, op2));
 	return dst;
 }
 
-Opd * NotEqualsNode::flatten(Procedure * proc){
-	Opd * op1 = this->myExp1->flatten(proc);
-	Opd * op2 = this->myExp2->flatten(proc);
+Opd NotEqualsNode::flatten(Procedure * proc){
+	Opd op1 = this->myExp1->flatten(proc);
+	Opd op2 = this->myExp2->flatten(proc);
 	size_t width = proc->getProg()->opWidth(this->myExp1);
 	size_t resWidth = Opd::width(BasicType::BOOL());
-	Opd * dst = proc->makeTmp(resWidth);
+	Opd dst = proc->makeTmp(resWidth);
 	BinOp opr = BinOp::NEQ64;
 	if (width == 1){ opr = BinOp::NEQ8; }
-	BinOpQuad * quad = new BinOpQuad(dst, opr, op1, op2);
-	proc->addQuad(quad);
+	proc->addQuad(Quad::binOp(dst, opr, op1, op2));
 	return dst;
 }
 
-Opd * GreaterNode::flatten(Procedure * proc){
-	Opd * op1 = this->myExp1->flatten(proc);
-	Opd * op2 = this->myExp2->flatten(proc);
+Opd GreaterNode::flatten(Procedure * proc){
+	Opd op1 = this->myExp1->flatten(proc);
+	Opd op2 = this->myExp2->flatten(proc);
 	size_t width = proc->getProg()->opWidth(this->myExp1);
 	size_t resWidth = Opd::width(BasicType::BOOL());
-	Opd * dst = proc->makeTmp(resWidth);
+	Opd dst = proc->makeTmp(resWidth);
 	BinOp opr = BinOp::GT64;
 	if (width == 1){ opr = BinOp::GT8; }
-	BinOpQuad * quad = new BinOpQuad(dst, opr, op1, op2);
-	proc->addQuad(quad);
+	proc->addQuad(Quad::binOp(dst, opr, op1, op2));
 	return dst;
 }
 
-Opd * GreaterEqNode::flatten(Procedure * proc){
-	Opd * op1 = this->myExp1->flatten(proc);
-	Opd * op2 = this->myExp2->flatten(proc);
+Opd GreaterEqNode::flatten(Procedure * proc){
+	Opd op1 = this->myExp1->flatten(proc);
+	Opd op2 = this->myExp2->flatten(proc);
 	size_t width = proc->getProg()->opWidth(this->myExp1);
 	size_t resWidth = Opd::width(BasicType::BOOL());
-	Opd * dst = proc->makeTmp(resWidth);
+	Opd dst = proc->makeTmp(resWidth);
 	BinOp opr = BinOp::GTE64;
 	if (width == 1){ opr = BinOp::GTE8; }
-	BinOpQuad * quad = new BinOpQuad(dst, opr, op1, op2);
-	proc->addQuad(quad);
+	proc->addQuad(Quad::binOp(dst, opr, op1, op2));
 	return dst;
 }
 
-Opd * LessNode::flatten(Procedure * proc){
-	Opd * op1 = this->myExp1->flatten(proc);
-	Opd * op2 = this->myExp2->flatten(proc);
+Opd LessNode::flatten(Procedure * proc){
+	Opd op1 = this->myExp1->flatten(proc);
+	Opd op2 = this->myExp2->flatten(proc);
 	size_t width = proc->getProg()->opWidth(this->myExp1);
 	size_t resWidth = Opd::width(BasicType::BOOL());
-	Opd * dst = proc->makeTmp(resWidth);
+	Opd dst = proc->makeTmp(resWidth);
 	BinOp opr = BinOp::LT64;
 	if (width == 1){ opr = BinOp::LT8; }
-	BinOpQuad * quad = new BinOpQuad(dst, opr, op1, op2);
-	proc->addQuad(quad);
+	proc->addQuad(Quad::binOp(dst, opr, op1, op2));
 	return dst;
 }
 
-Opd * LessEqNode::flatten(Procedure * proc){
-	Opd * op1 = this->myExp1->flatten(proc);
-	Opd * op2 = this->myExp2->flatten(proc);
+Opd LessEqNode::flatten(Procedure * proc){
+	Opd op1 = this->myExp1->flatten(proc);
+	Opd op2 = this->myExp2->flatten(proc);
 	size_t width = proc->getProg()->opWidth(this->myExp1);
 	size_t resWidth = Opd::width(BasicType::BOOL());
-	Opd * dst = proc->makeTmp(resWidth);
+	Opd dst = proc->makeTmp(resWidth);
 	BinOp opr = BinOp::LTE64;
 	if (width == 1){ opr = BinOp::LTE8; }
-	BinOpQuad * quad = new BinOpQuad(dst, opr, op1, op2);
-	proc->addQuad(quad);
+	proc->addQuad(Quad::binOp(dst, opr, op1, op2));
 	return dst;
 }
 
 void AssignStmtNode::to3AC(Procedure * proc){
-	Opd * rhs = mySrc->flatten(proc);
-	Opd * lhs = myDst->flatten(proc);
-	if (!lhs){
+	Opd rhs = mySrc->flatten(proc);
+	Opd lhs = myDst->flatten(proc);
+	if (lhs.isNone()){
 		throw InternalError("null tgt");
 	}
 	
-/*
-	bool isArray = proc->getProg()->nodeType(this)->isArray();
-	AssignQuad * quad = new AssignQuad(lhs, rhs, isArray);
-*/
-
-	AssignQuad * quad;
-	quad = new AssignQuad(lhs, rhs, false);
-
-	quad->setComment("Assign");
-	proc->addQuad(quad);
+	proc->addQuad(Quad::assign(lhs, rhs), "Assign");
 }
 
 void PostIncStmtNode::to3AC(Procedure * proc){
-	Opd * child = this->myLoc->flatten(proc);
+	Opd child = this->myLoc->flatten(proc);
 	size_t width = proc->getProg()->opWidth(this->myLoc);
 	BinOp opr = BinOp::ADD64;
 	if (width == 1){ opr = BinOp::ADD8; }
-	LitOpd * litOpd = new LitOpd("1", width);
-	BinOpQuad * quad = new BinOpQuad(child, opr, child, litOpd);
-	proc->addQuad(quad);
+	Opd litOpd = proc->getProg()->makeInt(1, width);
+	proc->addQuad(Quad::binOp(child, opr, child, litOpd));
 }
 
 void ExitStmtNode::to3AC(Procedure * proc){
-	proc->addQuad(new ExitQuad());
+	proc->addQuad(Quad::exit());
 }
 
-Opd * MagicNode::flatten(Procedure * proc){
-	Opd * resVal = proc->makeTmp(8);
-	proc->addQuad(new MagicQuad(resVal));
+Opd MagicNode::flatten(Procedure * proc){
+	Opd resVal = proc->makeTmp(8);
+	proc->addQuad(Quad::magic(resVal));
 	return resVal;
 }
 
 void PostDecStmtNode::to3AC(Procedure * proc){
-	Opd * child = this->myLoc->flatten(proc);
+	Opd child = this->myLoc->flatten(proc);
 	size_t width = proc->getProg()->opWidth(this->myLoc);
 	BinOp opr = BinOp::SUB64;
 	if (width == 1){ opr = BinOp::SUB8; }
-	LitOpd * litOpd = new LitOpd("1", width);
-	BinOpQuad * quad = new BinOpQuad(child, opr, child, litOpd);
-	proc->addQuad(quad);
+	Opd litOpd = proc->getProg()->makeInt(1, width);
+	proc->addQuad(Quad::binOp(child, opr, child, litOpd));
 }
 
 void TakeStmtNode::to3AC(Procedure * proc){
-	Opd * childOpd = myDst->flatten(proc);
-	proc->addQuad(new ReadQuad(
+	Opd childOpd = myDst->flatten(proc);
+	proc->addQuad(Quad::read(
 		childOpd,
 		proc->getProg()->nodeType(myDst)
 	));
 }
 
 void GiveStmtNode::to3AC(Procedure * proc){
-	Opd * childOpd = mySrc->flatten(proc);
-	proc->addQuad(new WriteQuad(
-		childOpd, 
+	Opd childOpd = mySrc->flatten(proc);
+	proc->addQuad(Quad::write(
+		childOpd,
 		proc->getProg()->nodeType(mySrc)
 	));
 }
 
 void IfStmtNode::to3AC(Procedure * proc){
-	Opd * cond = myCond->flatten(proc);
 	Label * afterLabel = proc->makeLabel();
-	Quad * afterNop = new NopQuad();
-	afterNop->addLabel(afterLabel);
+	Quad afterNop = Quad::nop();
+	afterNop.setLabel(afterLabel);
 
-	proc->addQuad(new IfzQuad(cond, afterLabel));
+	myCond->flattenBranch(proc, afterLabel);
 	for (auto stmt : *myBody){
 		stmt->to3AC(proc);
 	}
@@ -373,22 +381,18 @@ void IfStmtNode::to3AC(Procedure * proc){
 
 void IfElseStmtNode::to3AC(Procedure * proc){
 	Label * elseLabel = proc->makeLabel();
-	Quad * elseNop = new NopQuad();
-	elseNop->addLabel(elseLabel);
+	Quad elseNop = Quad::nop();
+	elseNop.setLabel(elseLabel);
 	Label * afterLabel = proc->makeLabel();
-	Quad * afterNop = new NopQuad();
-	afterNop->addLabel(afterLabel);
-
-	Opd * cond = myCond->flatten(proc);
+	Quad afterNop = Quad::nop();
+	afterNop.setLabel(afterLabel);
 
-	Quad * jmpFalse = new IfzQuad(cond, elseLabel);
-	proc->addQuad(jmpFalse);
+	myCond->flattenBranch(proc, elseLabel);
 	for (auto stmt : *myBodyTrue){
 		stmt->to3AC(proc);
 	}
 
-	Quad * skipFall = new GotoQuad(afterLabel);
-	proc->addQuad(skipFall);
+	proc->addQuad(Quad::jump(afterLabel));
 
 	proc->addQuad(elseNop);
 
@@ -400,54 +404,45 @@ void IfElseStmtNode::to3AC(Procedure * proc){
 }
 
 void WhileStmtNode::to3AC(Procedure * proc){
-	Quad * headNop = new NopQuad();
+	Quad headNop = Quad::nop();
 	Label * headLabel = proc->makeLabel();
-	headNop->addLabel(headLabel);
+	headNop.setLabel(headLabel);
 
 	Label * afterLabel = proc->makeLabel();
-	Quad * afterQuad = new NopQuad();
-	afterQuad->addLabel(afterLabel);
+	Quad afterQuad = Quad::nop();
+	afterQuad.setLabel(afterLabel);
 
 	proc->addQuad(headNop);
-	Opd * cond = myCond->flatten(proc);
-	Quad * jmpFalse = new IfzQuad(cond, afterLabel);
-	proc->addQuad(jmpFalse);
+	myCond->flattenBranch(proc, afterLabel);
 
 	for (auto stmt : *myBody){
 		stmt->to3AC(proc);
 	}
 
-	Quad * loopBack = new GotoQuad(headLabel);
-	proc->addQuad(loopBack);
+	proc->addQuad(Quad::jump(headLabel));
 	proc->addQuad(afterQuad);
 }
 
 void CallStmtNode::to3AC(Procedure * proc){
-	Opd * res = myCallExp->flatten(proc);
+	Opd res = myCallExp->flatten(proc);
 	//Since we're in a callStmt, the GetRet quad
 	// generated as the last action of the subtree
 	// was unnecessary. Remove it from the procedure.
-	if (res != nullptr){
+	if (!res.isNone()){
 		//A void call will not generate a getout
-		Quad * last = proc->popQuad();
+		proc->popQuad();
 	}
-	//Should probably delete the last quad, but
-	// we've leaked so much memory why start worrying now?
 }
 
 void ReturnStmtNode::to3AC(Procedure * proc){
 	if (myExp != nullptr){
-		Opd * res = myExp->flatten(proc);
-
-		const DataType * type = proc->getProg()->nodeType(myExp);
-		Quad * setOut = new SetRetQuad(res, false);
+		Opd res = myExp->flatten(proc);
 
-		proc->addQuad(setOut);
+		proc->addQuad(Quad::setRet(res));
 	}
 
 	Label * leaveLbl = proc->getLeaveLabel();
-	Quad * jmpLeave = new GotoQuad(leaveLbl);
-	proc->addQuad(jmpLeave);
+	proc->addQuad(Quad::jump(leaveLbl));
 }
 
 void VarDeclNode::to3AC(Procedure * proc){
@@ -457,13 +452,9 @@ void VarDeclNode::to3AC(Procedure * proc){
 	}
 	proc->gatherLocal(sym);
 	if (myInit != nullptr){
-		Opd * lhs = proc->getSymOpd(sym);
-		Opd * rhs = myInit->flatten(proc);
-		AssignQuad * quad;
-		quad = new AssignQuad(lhs, rhs, false);
-
-		quad->setComment("Initializer");
-		proc->addQuad(quad);
+		Opd lhs = proc->getSymOpd(sym);
+		Opd rhs = myInit->flatten(proc);
+		proc->addQuad(Quad::assign(lhs, rhs), "Initializer");
 	}
 }
 
@@ -476,12 +467,9 @@ void VarDeclNode::to3AC(IRProgram * prog){
 	prog->gatherGlobal(sym);
 	if (myInit != nullptr){
 		Procedure * init = prog->getInitProc();
-		Opd * lhs = prog->getGlobal(sym);
-		Opd * rhs = myInit->flatten(init);
-		AssignQuad * quad;
-		quad = new AssignQuad(lhs, rhs, false);
-
-		init->addQuad(quad);
+		Opd lhs = prog->getGlobal(sym);
+		Opd rhs = myInit->flatten(init);
+		init->addQuad(Quad::assign(lhs, rhs));
 	}
 }
 
@@ -1,24 +1,21 @@
 #include "3ac.hpp"
-#include <algorithm>
+#include "cfg.hpp"
 
 namespace drewno_mars{
 
 Procedure::Procedure(IRProgram * prog, std::string name)
-: myProg(prog), myName(name){
-	maxTmp = 0;
-	enter = new EnterQuad(this);
-	leave = new LeaveQuad(this);
-	bodyQuads = new std::list<Quad *>();
+: enter(Quad::enter()), leave(Quad::leave()), myProg(prog),
+  myCFG(nullptr), cfgStale(false), frameSize(0), frameKind(RBP_FRAME), stackDepth(0), myName(name){
 	if (myName.compare("main") == 0){
-		enter->addLabel(new Label("main"));
+		enter.setLabel(myProg->makeLabel("main"));
 	} else {
-		enter->addLabel(new Label("fun_" + myName));
+		enter.setLabel(myProg->makeLabel("fun_" + myName));
 	}
 	leaveLabel = myProg->makeLabel();
-	leave->addLabel(leaveLabel);
+	leave.setLabel(leaveLabel);
 }
 
-std::string Procedure::getName(){
+std::string Procedure::getName() const{
 	return myName;
 }
 
@@ -26,41 +23,80 @@ Label * Procedure::getLeaveLabel(){
 	return leaveLabel;
 }
 
-IRProgram * Procedure::getProg(){ return myProg; }
+IRProgram * Procedure::getProg() const{ return myProg; }
 
-std::string Procedure::toString(bool verbose){
-	std::string res = "";
+size_t Procedure::widthOf(Opd opd) const{
+	switch (opd.kind()){
+	case Opd::VREG: return getVReg(opd).width;
+	case Opd::GLOBAL: return myProg->getGlobalInfo(opd).width;
+	case Opd::CONST: return myProg->getConst(opd).width;
+	case Opd::NONE: break;
+	}
+	throw new InternalError("Width of a missing operand");
+}
 
-	res += "[BEGIN " + this->getName() + " LOCALS]\n";
-	for (const auto formal : this->formals){
-		res += formal->getName() + " (formal arg of "
-			+ std::to_string(formal->getWidth())
-			+ " bytes)\n";
+std::string Procedure::locString(Opd opd) const{
+	switch (opd.kind()){
+	case Opd::VREG: {
+		const VRegInfo& info = getVReg(opd);
+		if (info.sym != nullptr && info.origin != opd.index()){
+			return info.sym->getName() + "." + std::to_string(opd.index());
+		}
+		if (info.sym != nullptr){
+			return info.sym->getName();
+		}
+		return "tmp" + std::to_string(opd.index());
+	}
+	case Opd::GLOBAL:
+		return myProg->getGlobalInfo(opd).sym->getName();
+	case Opd::CONST:
+		throw new InternalError("Tried to get location of a constant");
+	case Opd::NONE: break;
 	}
+	throw new InternalError("Location of a missing operand");
+}
 
-	for (auto local : this->locals){
-		res += local.second->getName() + " (local var of "
-			+ std::to_string(local.second->getWidth())
-			+ " bytes)\n";
+std::string Procedure::valString(Opd opd) const{
+	if (opd.isConst()){
+		return myProg->constString(opd);
 	}
+	return "[" + locString(opd) + "]";
+}
+
+std::string Procedure::labelName(LabelId id) const{
+	return myProg->getLabel(id)->getName();
+}
 
-	for (auto tmp : temps){
-		res += tmp->locString() + " (tmp var of "
-			+ std::to_string(tmp->getWidth())
+std::string Procedure::toString(bool verbose){
+	std::string res = "";
+
+	res += "[BEGIN " + this->getName() + " LOCALS]\n";
+	for (Opd formal : formals){
+		if (formal.isNone()){ continue; }
+		res += locString(formal) + " (formal arg of "
+			+ std::to_string(widthOf(formal))
 			+ " bytes)\n";
 	}
-	for (auto loc : this->addrOpds){
-		res += loc->locString() + " (tmp loc of "
-			+ std::to_string(loc->getWidth())
-			+ " bytes)\n";
+
+	for (size_t i = 0; i < vregs.size(); i++){
+		const VRegInfo& info = vregs[i];
+		if (info.kind == FORMAL_VREG){ continue; }
+		Opd opd = Opd::vreg(static_cast<uint32_t>(i));
+		res += locString(opd);
+		if (info.kind == LOCAL_VREG){
+			res += " (local var of ";
+		} else {
+			res += " (tmp var of ";
+		}
+		res += std::to_string(static_cast<size_t>(info.width)) + " bytes)\n";
 	}
 	res += "[END " + this->getName() + " LOCALS]\n";
 
-	res += enter->toString(verbose) + "\n";
-	for (auto quad : *bodyQuads){
-		res += quad->toString(verbose) + "\n";
+	res += enter.toString(this, verbose) + "\n";
+	for (const Quad& quad : bodyQuads){
+		res += quad.toString(this, verbose) + "\n";
 	}
-	res += leave->toString(verbose) + "\n";
+	res += leave.toString(this, verbose) + "\n";
 	return res;
 }
 
@@ -68,87 +104,162 @@ Label * Procedure::makeLabel(){
 	return myProg->makeLabel();
 }
 
-void Procedure::addQuad(Quad * quad){
-	bodyQuads->push_back(quad);
+void Procedure::addQuad(Quad quad, std::string comment){
+	if (comment.length() > 0){
+		quad.setCommentIdx(myProg->internComment(comment));
+	}
+	bodyQuads.push_back(quad);
+	invalidateCFG();
 }
 
-Quad * Procedure::popQuad(){
-	Quad * last = bodyQuads->back();
-	bodyQuads->pop_back();
+Quad Procedure::popQuad(){
+	Quad last = bodyQuads.back();
+	bodyQuads.pop_back();
+	invalidateCFG();
 	return last;
 }
 
-void Procedure::replaceQuad(Quad * oldQuad, Quad * newQuad){
-	auto itr = std::find(bodyQuads->begin(), bodyQuads->end(), oldQuad);
-	itr = bodyQuads->erase(itr);
-	bodyQuads->insert(itr, newQuad);
+const ControlFlowGraph * Procedure::getCFG(){
+	if (cfgStale){
+		delete myCFG;
+		myCFG = nullptr;
+		cfgStale = false;
+	}
+	if (myCFG == nullptr){
+		myCFG = ControlFlowGraph::build(this);
+	}
+	return myCFG;
+}
+
+void Procedure::invalidateCFG(){
+	cfgStale = true;
+}
+
+Opd Procedure::makeVReg(VRegKind kind, size_t width, SemSymbol * sym){
+	VRegInfo info;
+	info.kind = kind;
+	info.width = static_cast<unsigned char>(width);
+	info.frameOffset = 0;
+	info.sym = sym;
+	info.origin = static_cast<uint32_t>(vregs.size());
+	info.inReg = false;
+	info.reg = A;
+	vregs.push_back(info);
+	return Opd::vreg(info.origin);
+}
+
+Opd Procedure::cloneVReg(Opd opd){
+	VRegInfo info = getVReg(opd);
+	//Only the original is passed in by the caller
+	if (info.kind == FORMAL_VREG){ info.kind = LOCAL_VREG; }
+	info.frameOffset = 0;
+	info.inReg = false;
+	vregs.push_back(info);
+	return Opd::vreg(static_cast<uint32_t>(vregs.size() - 1));
+}
+
+Opd Procedure::adoptVReg(const VRegInfo& info){
+	VRegKind kind = info.kind == FORMAL_VREG ? LOCAL_VREG : info.kind;
+	return makeVReg(kind, info.width, info.sym);
+}
+
+size_t Procedure::makePhiArgs(size_t numArgs, Opd init){
+	phiArgs.push_back(std::vector<Opd>(numArgs, init));
+	return phiArgs.size() - 1;
 }
 
 void Procedure::gatherLocal(SemSymbol * sym){
 	size_t width = Opd::width(sym->getDataType());
-	locals[sym] = new SymOpd(sym, width);
+	symVRegs[sym] = makeVReg(LOCAL_VREG, width, sym);
 }
 
 void Procedure::gatherFormal(SemSymbol * sym){
 	size_t width = Opd::width(sym->getDataType());
-	formals.push_back(new SymOpd(sym, width));
+	Opd opd = makeVReg(FORMAL_VREG, width, sym);
+	symVRegs[sym] = opd;
+	formals.push_back(opd);
 }
 
-SymOpd * Procedure::getSymOpd(SemSymbol * sym){
-	for(auto formalSeek : formals){
-		if (formalSeek->getSym() == sym){
-			return formalSeek;
-		}
-	}
-
-	auto localFound = locals.find(sym);
-	if (localFound != locals.end()){
-		return localFound->second;
+Opd Procedure::getSymOpd(SemSymbol * sym){
+	auto found = symVRegs.find(sym);
+	if (found != symVRegs.end()){
+		return found->second;
 	}
-
 	return this->getProg()->getGlobal(sym);
 }
 
-AuxOpd * Procedure::makeTmp(size_t width){
-	std::string name = "tmp";
-	name += std::to_string(maxTmp++);
-	AuxOpd * res = new AuxOpd(name, width);
-	temps.push_back(res);
-
-	return res;
+Opd Procedure::makeTmp(size_t width){
+	return makeVReg(TEMP_VREG, width, nullptr);
 }
 
-AddrOpd * Procedure::makeAddrOpd(size_t width){
-	std::string name = "addrTmp";
-	name += std::to_string(maxTmp++);
-	AddrOpd * res = new AddrOpd(name, width);
-	addrOpds.push_back(res);
+size_t Procedure::compactVRegs(){
+	std::vector<bool> used(vregs.size(), false);
+	auto mark = [&](Opd opd){
+		if (opd.isVReg()){ used[opd.index()] = true; }
+	};
+	for (const Quad& quad : bodyQuads){
+		mark(quad.getDst());
+		mark(quad.getSrc1());
+		mark(quad.getSrc2());
+		if (quad.getOp() == PHI_QUAD){
+			for (Opd arg : getPhiArgs(quad)){ mark(arg); }
+		}
+	}
 
-	return res;
+	std::vector<Opd> renumbered(vregs.size(), Opd::none());
+	std::vector<VRegInfo> kept;
+	for (size_t i = 0; i < vregs.size(); i++){
+		if (!used[i]){ continue; }
+		renumbered[i] = Opd::vreg(static_cast<uint32_t>(kept.size()));
+		kept.push_back(vregs[i]);
+	}
+	//A vreg whose origin was dropped becomes its own origin
+	for (size_t i = 0; i < kept.size(); i++){
+		Opd origin = renumbered[kept[i].origin];
+		kept[i].origin = origin.isNone()
+			? static_cast<uint32_t>(i) : origin.index();
+	}
+	size_t dropped = vregs.size() - kept.size();
+	if (dropped == 0){ return 0; }
+	vregs.swap(kept);
+
+	auto remap = [&](Opd opd){
+		return opd.isVReg() ? renumbered[opd.index()] : opd;
+	};
+	for (Quad& quad : bodyQuads){
+		quad.setDst(remap(quad.getDst()));
+		quad.setSrc1(remap(quad.getSrc1()));
+		quad.setSrc2(remap(quad.getSrc2()));
+		if (quad.getOp() == PHI_QUAD){
+			for (Opd& arg : getPhiArgs(quad)){ arg = remap(arg); }
+		}
+	}
+	for (Opd& formal : formals){
+		formal = remap(formal);
+	}
+	for (auto& entry : symVRegs){
+		entry.second = remap(entry.second);
+	}
+	return dropped;
 }
 
 size_t Procedure::numTemps() const{
-	return this->temps.size();
+	size_t count = 0;
+	for (const VRegInfo& info : vregs){
+		if (info.kind == TEMP_VREG){ count++; }
+	}
+	return count;
 }
 
+//What the prologue takes off %rsp. Pushing %rbp keeps the frame
+// 16-byte aligned; without that push, one more word has to go.
 size_t Procedure::arSize() const{
-	size_t size = 0;
-	for (auto local : locals){
-		size += local.second->getWidth();
-	}
-	for (auto tmp : temps){
-		size += tmp->getWidth();
+	switch (frameKind){
+	case RBP_FRAME: return frameSize;
+	case RSP_FRAME: return frameSize + 8;
+	case NO_FRAME: return 0;
 	}
-	for (auto formal : formals){
-		size += formal->getWidth();
-	}
-	for (auto loc : addrOpds){
-		size += 8;
-	}
-	size_t slack = (16 - (size % 16)) % 16;
-	size += slack;
-
-	return size;
+	return frameSize;
 }
 
 }
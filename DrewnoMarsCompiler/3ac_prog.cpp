@@ -23,39 +23,102 @@ size_t IRProgram::opWidth(ASTNode * node){
 }
 
 Label * IRProgram::makeLabel(){
-	Label * label = new Label("lbl_" + std::to_string(max_label++));
+	return makeLabel("lbl_" + std::to_string(max_label++));
+}
+
+Label * IRProgram::makeLabel(std::string name){
+	Label * label = new Label(static_cast<LabelId>(labels.size()), name);
+	labels.push_back(label);
 	return label;
 }
 
-SymOpd * IRProgram::getGlobal(SemSymbol * sym){
-	if (globals.find(sym) != globals.end()){
-		return globals[sym];
+unsigned short IRProgram::internComment(std::string comment){
+	auto found = commentIdxs.find(comment);
+	if (found != commentIdxs.end()){
+		return found->second;
+	}
+	if (comments.size() > UINT16_MAX){
+		throw new InternalError("Too many distinct quad comments");
+	}
+	unsigned short idx = static_cast<unsigned short>(comments.size());
+	comments.push_back(comment);
+	commentIdxs[comment] = idx;
+	return idx;
+}
+
+Opd IRProgram::getGlobal(SemSymbol * sym){
+	auto found = globalIdxs.find(sym);
+	if (found != globalIdxs.end()){
+		return found->second;
 	}
-	return nullptr;
+	return Opd::none();
 }
 
 void IRProgram::gatherGlobal(SemSymbol * sym){
-	size_t width = Opd::width(sym->getDataType());
-	SymOpd * res = new SymOpd(sym, width);
-	globals[sym] = res;
+	GlobalInfo info;
+	info.sym = sym;
+	info.width = Opd::width(sym->getDataType());
+	globals.push_back(info);
+	globalIdxs[sym] = Opd::global(static_cast<uint32_t>(globals.size() - 1));
+}
+
+Opd IRProgram::makeString(std::string val){
+	auto found = strConsts.find(val);
+	if (found != strConsts.end()){
+		return found->second;
+	}
+	ConstInfo info;
+	info.kind = STR_CONST;
+	info.width = 8;
+	info.value = static_cast<int64_t>(strings.size());
+	strings.push_back(val);
+	consts.push_back(info);
+	Opd res = Opd::constant(static_cast<uint32_t>(consts.size() - 1));
+	strConsts[val] = res;
+	return res;
+}
+
+Opd IRProgram::makeInt(int64_t val, size_t width){
+	auto key = std::make_pair(val, width);
+	auto found = intConsts.find(key);
+	if (found != intConsts.end()){
+		return found->second;
+	}
+	ConstInfo info;
+	info.kind = INT_CONST;
+	info.width = width;
+	info.value = val;
+	consts.push_back(info);
+	Opd res = Opd::constant(static_cast<uint32_t>(consts.size() - 1));
+	intConsts[key] = res;
+	return res;
 }
 
-Opd * IRProgram::makeString(std::string val){
-	std::string name = "str_" + std::to_string(str_idx++);
-	LitOpd * opd = new LitOpd(name, 8);
-	strings[opd] = val;
-	return opd;
+Opd IRProgram::makeBool(bool val){
+	return makeInt(val ? 1 : 0, Opd::width(BasicType::BOOL()));
+}
+
+std::string IRProgram::constString(Opd opd) const{
+	const ConstInfo& info = getConst(opd);
+	if (info.kind == STR_CONST){
+		return "str_" + std::to_string(info.value);
+	}
+	return std::to_string(info.value);
+}
+
+std::string IRProgram::globalLoc(Opd opd) const{
+	return "gbl_" + getGlobalInfo(opd).sym->getName();
 }
 
 std::string IRProgram::toString(bool verbose){
 	std::string res = "";
 	res += "[BEGIN GLOBALS]\n";
-	for (auto entry : globals){
-		res += entry.second->getName() + "\n";
+	for (const GlobalInfo& global : globals){
+		res += global.sym->getName() + "\n";
 	}
-	for (auto entry : strings){
-		res += entry.first->valString();
-		res += " " + entry.second;
+	for (size_t i = 0; i < strings.size(); i++){
+		res += "str_" + std::to_string(i);
+		res += " " + strings[i];
 		res += "\n";
 	}
 
@@ -68,12 +131,4 @@ std::string IRProgram::toString(bool verbose){
 	return res;
 }
 
-std::set<Opd *> IRProgram::globalSyms(){
-	std::set<Opd *> result;
-	for (auto gItr : globals){
-		result.insert(gItr.second);
-	}
-	return result;
-}
-
 }
@@ -2,266 +2,276 @@
 
 namespace drewno_mars{
 
+static_assert(sizeof(Quad) == 24, "Quads are meant to stay compact");
 
-Quad::Quad() : myComment(""){
+Quad::Quad(QuadOp opIn)
+: myOp(opIn), mySubOp(0), myComment(0), myLabel(NO_LABEL),
+  myAux(0){
 }
 
-void Quad::addLabel(Label * label){
-	if (label != nullptr){
-		labels.push_back(label);
+static BaseType ioType(const DataType * type){
+	const BasicType * basic = type->asBasic();
+	if (basic == nullptr){
+		throw new InternalError("IO on a non-basic type");
 	}
+	return basic->getBaseType();
 }
 
-void Quad::setComment(std::string commentIn){
-	this->myComment = commentIn;
+Quad Quad::binOp(Opd dst, BinOp opr, Opd src1, Opd src2){
+	assert(!dst.isNone());
+	assert(!src1.isNone());
+	assert(!src2.isNone());
+	Quad res(BINOP_QUAD);
+	res.mySubOp = static_cast<unsigned char>(opr);
+	res.myDst = dst;
+	res.mySrc1 = src1;
+	res.mySrc2 = src2;
+	return res;
 }
 
-std::string Quad::commentStr(){
-	if (myComment.length() > 0){
-		return "  #" + myComment;
-	}
-	return "";
+Quad Quad::unaryOp(Opd dst, UnaryOp opr, Opd src){
+	assert(!dst.isNone());
+	assert(!src.isNone());
+	Quad res(UNARYOP_QUAD);
+	res.mySubOp = static_cast<unsigned char>(opr);
+	res.myDst = dst;
+	res.mySrc1 = src;
+	return res;
 }
 
-std::string Quad::toString(bool verbose){
-	auto res = std::string("");
-
-	auto first = true;
-
-	size_t labelSpace = 12;
-	for (auto label : labels){
-		if (first){ first = false; }
-		else { res += ","; }
-
-		res += label->toString();
-	}
-	if (!first){ res += ": "; }
-	else { res += "  "; }
-	size_t spaces;
-	if (res.length() > labelSpace){ spaces = 0; }
-	else { spaces = labelSpace - res.length(); }
-	for (size_t i = 0; i < spaces; i++){
-		res += " ";
-	}
-
-	res += this->repr();
-	if (verbose){
-		res += commentStr();
-	}
-
+Quad Quad::assign(Opd dst, Opd src){
+	assert(!dst.isNone());
+	assert(!src.isNone());
+	Quad res(ASSIGN_QUAD);
+	res.myDst = dst;
+	res.mySrc1 = src;
 	return res;
 }
 
-CallQuad::CallQuad(SemSymbol * calleeIn)
-: sym(calleeIn){ }
-
-std::string CallQuad::repr(){
-	return "call " + sym->getName();
+Quad Quad::jump(Label * tgt){
+	Quad res(GOTO_QUAD);
+	res.myAux = tgt->getId();
+	return res;
 }
 
-MagicQuad::MagicQuad(Opd * inDst)
-: Quad(), myDst(inDst) { }
-
-std::string MagicQuad::repr(){
-	return "magic " + myDst->valString();
+Quad Quad::ifz(Opd cnd, Label * tgt){
+	Quad res(IFZ_QUAD);
+	res.mySrc1 = cnd;
+	res.myAux = tgt->getId();
+	return res;
 }
 
-ExitQuad::ExitQuad() : Quad(){}
-
-std::string ExitQuad::repr(){
-	return "exit";
+Quad Quad::nop(){
+	return Quad(NOP_QUAD);
 }
 
-EnterQuad::EnterQuad(Procedure * procIn)
-: Quad(), myProc(procIn) { }
-
-std::string EnterQuad::repr(){
-	return "enter " + myProc->getName();
+Quad Quad::write(Opd src, const DataType * type){
+	Quad res(WRITE_QUAD);
+	res.mySrc1 = src;
+	res.mySubOp = static_cast<unsigned char>(ioType(type));
+	return res;
 }
 
-LeaveQuad::LeaveQuad(Procedure * procIn)
-: Quad(), myProc(procIn) { }
-
-std::string LeaveQuad::repr(){
-	return "leave " + myProc->getName();
+Quad Quad::read(Opd dst, const DataType * type){
+	Quad res(READ_QUAD);
+	res.myDst = dst;
+	res.mySubOp = static_cast<unsigned char>(ioType(type));
+	return res;
 }
 
-std::string AssignQuad::repr(){
-	return dst->valString() + " := " + src->valString();
+Quad Quad::exit(){
+	return Quad(EXIT_QUAD);
 }
 
-AssignQuad::AssignQuad(Opd * dstIn, Opd * srcIn, bool isArrayIn)
-: dst(dstIn), src(srcIn) {
-	assert(dstIn != nullptr);
-	assert(srcIn != nullptr);
+Quad Quad::magic(Opd dst){
+	Quad res(MAGIC_QUAD);
+	res.myDst = dst;
+	return res;
 }
 
-BinOpQuad::BinOpQuad(Opd * dstIn, BinOp oprIn, Opd * src1In, Opd * src2In)
-: dst(dstIn), opr(oprIn), src1(src1In), src2(src2In){
-	assert(dstIn != nullptr);
-	assert(src1In != nullptr);
-	assert(src2In != nullptr);
+Quad Quad::call(Opd callee){
+	Quad res(CALL_QUAD);
+	res.mySrc1 = callee;
+	return res;
 }
 
-std::string BinOpQuad::oprString(BinOp opr){
-	switch(opr){
-	case ADD64: return "ADD64";
-	case SUB64: return "SUB64";
-	case DIV64: return "DIV64";
-	case MULT64: return "MULT64";
-	case OR64: return "OR64";
-	case AND64: return "AND64";
-	case EQ64: return "EQ64";
-	case NEQ64: return "NEQ64";
-	case LT64: return "LT64";
-	case GT64: return "GT64";
-	case LTE64: return "LTE64";
-	case GTE64: return "GTE64";
-
-	case ADD8: return "ADD8";  
-	case SUB8: return "SUB8";  
-	case DIV8: return "DIV8";  
-	case MULT8: return "MULT8";  
-	case OR8: return "OR8";  
-	case AND8: return "AND8";  
-	case EQ8: return "EQ8";  
-	case NEQ8: return "NEQ8";  
-	case LT8: return "LT8";  
-	case GT8: return "GT8";  
-	case LTE8: return "LTE8";  
-	case GTE8: return "GTE8";  
-	} 
-	throw InternalError("No such opd");
-
+Quad Quad::enter(){
+	return Quad(ENTER_QUAD);
 }
 
-std::string BinOpQuad::repr(){
-	if (src2 == nullptr){
-		throw new InternalError("bino2 2 is null");
-	}
-	return dst->valString()
-		+ " := "
-		+ src1->valString()
-		+ " " + BinOpQuad::oprString(opr) + " "
-		+ src2->valString();
+Quad Quad::leave(){
+	return Quad(LEAVE_QUAD);
 }
 
-UnaryOpQuad::UnaryOpQuad(Opd * dstIn, UnaryOp opIn, Opd * srcIn)
-: dst(dstIn), op(opIn), src(srcIn) {
-	assert(dstIn != nullptr);
-	assert(srcIn != nullptr);
+Quad Quad::setArg(size_t index, Opd src){
+	Quad res(SETARG_QUAD);
+	res.mySrc1 = src;
+	res.myAux = static_cast<uint32_t>(index);
+	return res;
 }
 
-std::string UnaryOpQuad::repr(){
-	std::string opString;
-	switch (op){
-	case NEG64:
-		opString = "NEG64 ";
-		break;
-	case NEG8:
-		opString = "NEG8 ";
-		break;
-	case NOT64:
-		opString = "NOT64 ";
-		break;
-	case NOT8:
-		opString = "NOT8 ";
-		break;
-	}
-	return dst->valString() + " := "
-		+ opString
-		+ src->valString();
+Quad Quad::getArg(size_t index, Opd dst){
+	Quad res(GETARG_QUAD);
+	res.myDst = dst;
+	res.myAux = static_cast<uint32_t>(index);
+	return res;
 }
 
-WriteQuad::WriteQuad(Opd * src, const DataType * type)
-: mySrc(src), mySrcType(type){ }
-
-std::string WriteQuad::repr(){
-	return "WRITE " + mySrc->valString();
+Quad Quad::setRet(Opd src){
+	Quad res(SETRET_QUAD);
+	res.mySrc1 = src;
+	return res;
 }
 
-ReadQuad::ReadQuad(Opd * dst, const DataType * type)
-: myDst(dst), myDstType(type){ }
-
-std::string drewno_mars::ReadQuad::repr(){
-	return "READ " + myDst->valString();
+Quad Quad::getRet(Opd dst){
+	Quad res(GETRET_QUAD);
+	res.myDst = dst;
+	return res;
 }
 
-GotoQuad::GotoQuad(Label * tgtIn)
-: Quad(), tgt(tgtIn){ }
-
-std::string GotoQuad::repr(){
-	std::string res = "";
-	return "goto " + tgt->toString();
+Quad Quad::phi(Opd dst, size_t argsIdx){
+	Quad res(PHI_QUAD);
+	res.myDst = dst;
+	res.myAux = static_cast<uint32_t>(argsIdx);
+	return res;
 }
 
-IfzQuad::IfzQuad(Opd * cndIn, Label * tgtIn)
-: Quad(), cnd(cndIn), tgt(tgtIn){ }
-
-std::string IfzQuad::repr(){
-	std::string res = "IFZ ";
-	res += cnd->valString();
-	res += " GOTO ";
-	res += tgt->toString();
+Quad Quad::tailCall(Opd callee){
+	Quad res(TAILCALL_QUAD);
+	res.mySrc1 = callee;
 	return res;
 }
 
-NopQuad::NopQuad()
-: Quad() { }
-
-std::string NopQuad::repr(){
-	return "nop";
+void Quad::setLabel(Label * label){
+	if (label != nullptr){
+		myLabel = label->getId();
+	}
 }
 
-GetRetQuad::GetRetQuad(Opd * opdIn, bool isRecordIn)
-: Quad(), opd(opdIn), myIsRecord(isRecordIn) { }
+std::string Quad::toString(const Procedure * proc, bool verbose) const{
+	auto res = std::string("");
 
-std::string GetRetQuad::repr(){
-	std::string res = "";
-	res += "getret " + opd->valString();
-	return res;
-}
+	size_t labelSpace = 12;
+	if (hasLabel()){
+		res += proc->labelName(myLabel) + ": ";
+	} else {
+		res += "  ";
+	}
+	size_t spaces;
+	if (res.length() > labelSpace){ spaces = 0; }
+	else { spaces = labelSpace - res.length(); }
+	for (size_t i = 0; i < spaces; i++){
+		res += " ";
+	}
 
-SetArgQuad::SetArgQuad(size_t indexIn, Opd * opdIn, const DataType * typeIn)
-: index(indexIn), opd(opdIn), type(typeIn){
-}
+	res += this->repr(proc);
+	if (verbose && myComment != 0){
+		res += "  #" + proc->getProg()->getComment(myComment);
+	}
 
-std::string SetArgQuad::repr(){
-	std::string res = "";
-	res += "setarg " + std::to_string(index) + " " + opd->valString();
 	return res;
 }
 
-GetArgQuad::GetArgQuad(size_t indexIn, Opd * opdIn, bool isRecordIn) 
-: index(indexIn), opd(opdIn), myIsRecord(isRecordIn){
-}
-
-std::string GetArgQuad::repr(){
-	std::string res = "";
-	res += "getarg " + std::to_string(index) + " " + opd->valString();
-	return res;
-}
+static std::string binOprString(BinOp opr){
+	switch(opr){
+	case ADD64: return "ADD64";
+	case SUB64: return "SUB64";
+	case DIV64: return "DIV64";
+	case MULT64: return "MULT64";
+	case OR64: return "OR64";
+	case AND64: return "AND64";
+	case EQ64: return "EQ64";
+	case NEQ64: return "NEQ64";
+	case LT64: return "LT64";
+	case GT64: return "GT64";
+	case LTE64: return "LTE64";
+	case GTE64: return "GTE64";
 
-SetRetQuad::SetRetQuad(Opd * opdIn, bool isRecordIn)
-: opd(opdIn), myIsRecord(isRecordIn){
+	case ADD8: return "ADD8";
+	case SUB8: return "SUB8";
+	case DIV8: return "DIV8";
+	case MULT8: return "MULT8";
+	case OR8: return "OR8";
+	case AND8: return "AND8";
+	case EQ8: return "EQ8";
+	case NEQ8: return "NEQ8";
+	case LT8: return "LT8";
+	case GT8: return "GT8";
+	case LTE8: return "LTE8";
+	case GTE8: return "GTE8";
+	}
+	throw new InternalError("No such opd");
 }
 
-std::string SetRetQuad::repr(){
-	std::string res = "";
-	res += "setret " + opd->valString();
-	return res;
+static std::string unaryOprString(UnaryOp opr){
+	switch (opr){
+	case NEG64: return "NEG64";
+	case NEG8: return "NEG8";
+	case NOT64: return "NOT64";
+	case NOT8: return "NOT8";
+	}
+	throw new InternalError("No such opd");
 }
 
-std::string LocQuad::repr(){
-	std::string res = "";
-	if (tgtIsLoc){ res += tgt->locString(); }
-	else { res += tgt->valString(); }
-
-	res += " := ";
-	if (srcIsLoc){ res += src->locString(); }
-	else { res += src->valString(); }
-
-	return res;
+std::string Quad::repr(const Procedure * proc) const{
+	switch (getOp()){
+	case BINOP_QUAD:
+		return proc->valString(myDst)
+			+ " := "
+			+ proc->valString(mySrc1)
+			+ " " + binOprString(getBinOp()) + " "
+			+ proc->valString(mySrc2);
+	case UNARYOP_QUAD:
+		return proc->valString(myDst) + " := "
+			+ unaryOprString(getUnaryOp()) + " "
+			+ proc->valString(mySrc1);
+	case ASSIGN_QUAD:
+		return proc->valString(myDst) + " := "
+			+ proc->valString(mySrc1);
+	case GOTO_QUAD:
+		return "goto " + proc->labelName(getTarget());
+	case IFZ_QUAD:
+		return "IFZ " + proc->valString(mySrc1)
+			+ " GOTO " + proc->labelName(getTarget());
+	case NOP_QUAD:
+		return "nop";
+	case WRITE_QUAD:
+		return "WRITE " + proc->valString(mySrc1);
+	case READ_QUAD:
+		return "READ " + proc->valString(myDst);
+	case EXIT_QUAD:
+		return "exit";
+	case MAGIC_QUAD:
+		return "magic " + proc->valString(myDst);
+	case CALL_QUAD:
+		return "call " + proc->locString(mySrc1);
+	case TAILCALL_QUAD:
+		return "tailcall " + proc->locString(mySrc1);
+	case ENTER_QUAD:
+		return "enter " + proc->getName();
+	case LEAVE_QUAD:
+		return "leave " + proc->getName();
+	case SETARG_QUAD:
+		return "setarg " + std::to_string(getIndex()) + " "
+			+ proc->valString(mySrc1);
+	case GETARG_QUAD:
+		return "getarg " + std::to_string(getIndex()) + " "
+			+ proc->valString(myDst);
+	case SETRET_QUAD:
+		return "setret " + proc->valString(mySrc1);
+	case GETRET_QUAD:
+		return "getret " + proc->valString(myDst);
+	case PHI_QUAD: {
+		std::string res = proc->valString(myDst) + " := PHI(";
+		const std::vector<Opd>& args = proc->getPhiArgs(*this);
+		for (size_t i = 0; i < args.size(); i++){
+			if (i > 0){ res += ", "; }
+			res += proc->valString(args[i]);
+		}
+		return res + ")";
+	}
+	}
+	throw new InternalError("No such quad");
 }
 
 }
@@ -61,7 +61,10 @@ public:
 	//virtual void unparse(std::ostream& out, int indent) override = 0;
 	virtual bool nameAnalysis(SymbolTable * symTab) override = 0;
 	virtual void typeAnalysis(TypeAnalysis *) = 0;
-	virtual Opd * flatten(Procedure * proc) = 0;
+	virtual Opd flatten(Procedure * proc) = 0;
+	//Evaluate as a condition: fall through when it holds and
+	// jump to falseLbl when it does not
+	virtual void flattenBranch(Procedure * proc, Label * falseLbl);
 };
 
 class LocNode : public ExpNode{
@@ -72,7 +75,7 @@ public:
 	SemSymbol * getSymbol() { return mySymbol; }
 	virtual bool nameAnalysis(SymbolTable * symTab) override = 0;
 	virtual void typeAnalysis(TypeAnalysis *) override = 0;
-	virtual Opd * flatten(Procedure * proc) override = 0;
+	virtual Opd flatten(Procedure * proc) override = 0;
 private:
 	SemSymbol * mySymbol;
 };
@@ -86,7 +89,7 @@ public:
 	void unparseNested(std::ostream& out) override;
 	bool nameAnalysis(SymbolTable * symTab) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * proc) override;
+	virtual Opd flatten(Procedure * proc) override;
 private:
 	std::string name;
 };
@@ -317,7 +320,7 @@ public:
 	void typeAnalysis(TypeAnalysis *) override;
 	DataType * getRetType();
 
-	virtual Opd * flatten(Procedure * proc) override;
+	virtual Opd flatten(Procedure * proc) override;
 private:
 	LocNode * myCallee;
 	std::list<ExpNode *> * myArgs;
@@ -329,7 +332,7 @@ public:
 	: ExpNode(p), myExp1(lhs), myExp2(rhs) { }
 	bool nameAnalysis(SymbolTable * symTab) override;
 	virtual void typeAnalysis(TypeAnalysis *) override = 0;
-	virtual Opd * flatten(Procedure * prog) override = 0;
+	virtual Opd flatten(Procedure * prog) override = 0;
 protected:
 	ExpNode * myExp1;
 	ExpNode * myExp2;
@@ -345,7 +348,7 @@ public:
 	: BinaryExpNode(p, e1, e2){ }
 	void unparse(std::ostream& out, int indent) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * prog) override;
+	virtual Opd flatten(Procedure * prog) override;
 };
 
 class MinusNode : public BinaryExpNode{
@@ -354,7 +357,7 @@ public:
 	: BinaryExpNode(p, e1, e2){ }
 	void unparse(std::ostream& out, int indent) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * prog) override;
+	virtual Opd flatten(Procedure * prog) override;
 };
 
 class TimesNode : public BinaryExpNode{
@@ -363,7 +366,7 @@ public:
 	: BinaryExpNode(p, e1In, e2In){ }
 	void unparse(std::ostream& out, int indent) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * prog) override;
+	virtual Opd flatten(Procedure * prog) override;
 };
 
 class DivideNode : public BinaryExpNode{
@@ -372,7 +375,7 @@ public:
 	: BinaryExpNode(p, e1, e2){ }
 	void unparse(std::ostream& out, int indent) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * prog) override;
+	virtual Opd flatten(Procedure * prog) override;
 };
 
 class AndNode : public BinaryExpNode{
@@ -381,7 +384,8 @@ public:
 	: BinaryExpNode(p, e1, e2){ }
 	void unparse(std::ostream& out, int indent) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * prog) override;
+	virtual Opd flatten(Procedure * prog) override;
+	virtual void flattenBranch(Procedure * proc, Label * falseLbl) override;
 };
 
 class OrNode : public BinaryExpNode{
@@ -390,7 +394,8 @@ public:
 	: BinaryExpNode(p, e1, e2){ }
 	void unparse(std::ostream& out, int indent) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * prog) override;
+	virtual Opd flatten(Procedure * prog) override;
+	virtual void flattenBranch(Procedure * proc, Label * falseLbl) override;
 };
 
 class EqualsNode : public BinaryExpNode{
@@ -399,7 +404,7 @@ public:
 	: BinaryExpNode(p, e1, e2){ }
 	void unparse(std::ostream& out, int indent) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * prog) override;
+	virtual Opd flatten(Procedure * prog) override;
 };
 
 class NotEqualsNode : public BinaryExpNode{
@@ -408,7 +413,7 @@ public:
 	: BinaryExpNode(p, e1, e2){ }
 	void unparse(std::ostream& out, int indent) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * prog) override;
+	virtual Opd flatten(Procedure * prog) override;
 };
 
 class LessNode : public BinaryExpNode{
@@ -417,7 +422,7 @@ public:
 	: BinaryExpNode(p, e1, e2){ }
 	void unparse(std::ostream& out, int indent) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * proc) override;
+	virtual Opd flatten(Procedure * proc) override;
 };
 
 class LessEqNode : public BinaryExpNode{
@@ -426,7 +431,7 @@ public:
 	: BinaryExpNode(pos, e1, e2){ }
 	void unparse(std::ostream& out, int indent) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * prog) override;
+	virtual Opd flatten(Procedure * prog) override;
 };
 
 class GreaterNode : public BinaryExpNode{
@@ -435,7 +440,7 @@ public:
 	: BinaryExpNode(p, e1, e2){ }
 	void unparse(std::ostream& out, int indent) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * proc) override;
+	virtual Opd flatten(Procedure * proc) override;
 };
 
 class GreaterEqNode : public BinaryExpNode{
@@ -444,7 +449,7 @@ public:
 	: BinaryExpNode(p, e1, e2){ }
 	void unparse(std::ostream& out, int indent) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * prog) override;
+	virtual Opd flatten(Procedure * prog) override;
 };
 
 class UnaryExpNode : public ExpNode {
@@ -456,7 +461,7 @@ public:
 	virtual void unparse(std::ostream& out, int indent) override = 0;
 	virtual bool nameAnalysis(SymbolTable * symTab) override = 0;
 	virtual void typeAnalysis(TypeAnalysis *) override = 0;
-	virtual Opd * flatten(Procedure * prog) override = 0;
+	virtual Opd flatten(Procedure * prog) override = 0;
 protected:
 	ExpNode * myExp;
 };
@@ -468,7 +473,7 @@ public:
 	void unparse(std::ostream& out, int indent) override;
 	bool nameAnalysis(SymbolTable * symTab) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * prog) override;
+	virtual Opd flatten(Procedure * prog) override;
 };
 
 class NotNode : public UnaryExpNode{
@@ -478,7 +483,7 @@ public:
 	void unparse(std::ostream& out, int indent) override;
 	bool nameAnalysis(SymbolTable * symTab) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * prog) override;
+	virtual Opd flatten(Procedure * prog) override;
 };
 
 class VoidTypeNode : public TypeNode{
@@ -527,7 +532,7 @@ public:
 	void unparse(std::ostream& out, int indent) override;
 	bool nameAnalysis(SymbolTable * symTab) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * prog) override;
+	virtual Opd flatten(Procedure * prog) override;
 private:
 	const int myNum;
 };
@@ -542,7 +547,7 @@ public:
 	void unparse(std::ostream& out, int indent) override;
 	bool nameAnalysis(SymbolTable *) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * proc) override;
+	virtual Opd flatten(Procedure * proc) override;
 private:
 	 const std::string myStr;
 };
@@ -556,7 +561,7 @@ public:
 	void unparse(std::ostream& out, int indent) override;
 	bool nameAnalysis(SymbolTable * symTab) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * prog) override;
+	virtual Opd flatten(Procedure * prog) override;
 };
 
 class FalseNode : public ExpNode{
@@ -568,7 +573,7 @@ public:
 	void unparse(std::ostream& out, int indent) override;
 	bool nameAnalysis(SymbolTable * symTab) override;
 	virtual void typeAnalysis(TypeAnalysis *) override;
-	virtual Opd * flatten(Procedure * prog) override;
+	virtual Opd flatten(Procedure * prog) override;
 };
 
 class MagicNode : public ExpNode{
@@ -584,7 +589,7 @@ public:
 	virtual void typeAnalysis(TypeAnalysis *) override {
 		throw true;
 	}
-	virtual Opd * flatten(Procedure * prog);
+	virtual Opd flatten(Procedure * prog);
 };
 
 class CallStmtNode : public StmtNode{
@@ -0,0 +1,134 @@
+#include "cfg.hpp"
+
+namespace drewno_mars{
+
+static bool endsBlock(const Quad& quad){
+	switch (quad.getOp()){
+	case GOTO_QUAD:
+	case IFZ_QUAD:
+	case EXIT_QUAD:
+	case TAILCALL_QUAD:
+		return true;
+	default:
+		return false;
+	}
+}
+
+ControlFlowGraph * ControlFlowGraph::build(const Procedure * proc){
+	ControlFlowGraph * cfg = new ControlFlowGraph(proc);
+	const std::vector<Quad>& quads = proc->getQuads();
+	size_t numQuads = quads.size();
+
+	//Find the leaders and cut the body into blocks
+	cfg->quadBlocks.resize(numQuads);
+	size_t start = 0;
+	for (size_t i = 0; i < numQuads; i++){
+		bool leader = i > 0
+			&& (quads[i].hasLabel() || endsBlock(quads[i-1]));
+		if (leader){
+			BlockId id = cfg->blocks.size();
+			cfg->blocks.push_back(BasicBlock(id, start, i));
+			start = i;
+		}
+		cfg->quadBlocks[i] = cfg->blocks.size();
+		if (quads[i].hasLabel()){
+			cfg->labelBlocks[quads[i].getLabel()] = cfg->blocks.size();
+		}
+	}
+	if (numQuads > 0){
+		BlockId id = cfg->blocks.size();
+		cfg->blocks.push_back(BasicBlock(id, start, numQuads));
+	}
+	BlockId exitId = cfg->blocks.size();
+	cfg->blocks.push_back(BasicBlock(exitId, numQuads, numQuads));
+	cfg->labelBlocks[proc->getLeave().getLabel()] = exitId;
+
+	//Connect each block to its successors
+	for (BlockId id = 0; id < exitId; id++){
+		const Quad& last = quads[cfg->blocks[id].end() - 1];
+		BlockId next = id + 1;
+		switch (last.getOp()){
+		case GOTO_QUAD:
+			cfg->addEdge(id, cfg->blockOfLabel(last.getTarget()));
+			break;
+		case IFZ_QUAD:
+			cfg->addEdge(id, next);
+			cfg->addEdge(id, cfg->blockOfLabel(last.getTarget()));
+			break;
+		case EXIT_QUAD:
+			break;
+		case TAILCALL_QUAD:
+			cfg->addEdge(id, exitId);
+			break;
+		default:
+			cfg->addEdge(id, next);
+		}
+	}
+
+	cfg->computeRPO();
+	return cfg;
+}
+
+BlockId ControlFlowGraph::blockOfLabel(LabelId label) const{
+	auto found = labelBlocks.find(label);
+	if (found == labelBlocks.end()){
+		throw new InternalError("Jump to a label outside the procedure");
+	}
+	return found->second;
+}
+
+void ControlFlowGraph::addEdge(BlockId from, BlockId to){
+	//An ifz to the very next block is a single edge
+	for (BlockId succ : blocks[from].succs){
+		if (succ == to){ return; }
+	}
+	blocks[from].succs.push_back(to);
+	blocks[to].preds.push_back(from);
+}
+
+void ControlFlowGraph::computeRPO(){
+	//Iterative depth-first search, recording postorder
+	std::vector<BlockId> post;
+	std::vector<bool> visited(blocks.size(), false);
+	std::vector<std::pair<BlockId, size_t>> stack;
+	stack.push_back(std::make_pair(entry(), 0));
+	visited[entry()] = true;
+	while (!stack.empty()){
+		BlockId id = stack.back().first;
+		size_t& nextSucc = stack.back().second;
+		const std::vector<BlockId>& succs = blocks[id].succs;
+		if (nextSucc < succs.size()){
+			BlockId succ = succs[nextSucc++];
+			if (!visited[succ]){
+				visited[succ] = true;
+				stack.push_back(std::make_pair(succ, 0));
+			}
+		} else {
+			post.push_back(id);
+			stack.pop_back();
+		}
+	}
+
+	myRPO.assign(post.rbegin(), post.rend());
+	rpoIdxs.assign(blocks.size(), SIZE_MAX);
+	for (size_t i = 0; i < myRPO.size(); i++){
+		rpoIdxs[myRPO[i]] = i;
+	}
+}
+
+std::string ControlFlowGraph::toString() const{
+	std::string res = "";
+	for (const BasicBlock& block : blocks){
+		res += "B" + std::to_string(block.getId());
+		if (block.getId() == exit()){ res += " (exit)"; }
+		res += " [" + std::to_string(block.first())
+			+ "," + std::to_string(block.end()) + ") ->";
+		for (BlockId succ : block.getSuccs()){
+			res += " B" + std::to_string(succ);
+		}
+		res += "\n";
+	}
+	return res;
+}
+
+}
@@ -0,0 +1,78 @@
+#ifndef DREWNO_MARS_CFG_HPP
+#define DREWNO_MARS_CFG_HPP
+
+#include <vector>
+#include "3ac.hpp"
+
+namespace drewno_mars{
+
+typedef size_t BlockId;
+
+//A maximal straight-line run of quads in a Procedure body. The
+// block covers the quads at indices [first, end) of the body;
+// the synthetic exit block (standing for the leave quad) covers
+// no quads at all.
+class BasicBlock{
+public:
+	BasicBlock(BlockId idIn, size_t firstIn, size_t endIn)
+	: id(idIn), myFirst(firstIn), myEnd(endIn){ }
+	BlockId getId() const { return id; }
+	size_t first() const { return myFirst; }
+	size_t end() const { return myEnd; }
+	size_t size() const { return myEnd - myFirst; }
+	bool empty() const { return myFirst == myEnd; }
+	const std::vector<BlockId>& getSuccs() const { return succs; }
+	const std::vector<BlockId>& getPreds() const { return preds; }
+private:
+	BlockId id;
+	size_t myFirst;
+	size_t myEnd;
+	std::vector<BlockId> succs;
+	std::vector<BlockId> preds;
+	friend class ControlFlowGraph;
+};
+
+//The control-flow graph of a single Procedure. Blocks are split
+// at labels and after ifz, goto, exit and tail call quads. Block 0
+// is the entry (the quads right after the enter quad) and the last
+// block is the exit, reached by falling off the body, jumping to
+// the procedure's leave label or making a tail call.
+//
+// Graphs are built on demand by Procedure::getCFG and thrown away
+// whenever the body is modified, so they should not be held
+// across a transformation.
+class ControlFlowGraph{
+public:
+	static ControlFlowGraph * build(const Procedure * proc);
+	const Procedure * getProc() const { return myProc; }
+	size_t numBlocks() const { return blocks.size(); }
+	const BasicBlock& getBlock(BlockId id) const { return blocks[id]; }
+	const std::vector<BasicBlock>& getBlocks() const { return blocks; }
+	BlockId entry() const { return 0; }
+	BlockId exit() const { return blocks.size() - 1; }
+	BlockId blockOf(size_t quadIdx) const { return quadBlocks[quadIdx]; }
+	BlockId blockOfLabel(LabelId label) const;
+
+	//Blocks reachable from the entry, in reverse postorder
+	const std::vector<BlockId>& rpo() const { return myRPO; }
+	//The position of a block in rpo(), or SIZE_MAX if unreachable
+	size_t rpoIndex(BlockId id) const { return rpoIdxs[id]; }
+	bool reachable(BlockId id) const { return rpoIdxs[id] != SIZE_MAX; }
+
+	std::string toString() const;
+private:
+	ControlFlowGraph(const Procedure * proc) : myProc(proc){ }
+	void addEdge(BlockId from, BlockId to);
+	void computeRPO();
+
+	const Procedure * myProc;
+	std::vector<BasicBlock> blocks;
+	std::vector<BlockId> quadBlocks;
+	HashMap<LabelId, BlockId> labelBlocks;
+	std::vector<BlockId> myRPO;
+	std::vector<size_t> rpoIdxs;
+};
+
+}
+
+#endif
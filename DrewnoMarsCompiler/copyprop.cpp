@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <set>
+#include "opt.hpp"
+#include "cfg.hpp"
+#include "dataflow.hpp"
+#include "dominators.hpp"
+#include "loops.hpp"
+
+namespace drewno_mars{
+
+size_t propagateCopies(Procedure * proc){
+	std::vector<Quad>& quads = proc->editQuads();
+	std::vector<Opd> copyOf(proc->numVRegs(), Opd::none());
+	size_t removed = 0;
+	for (const Quad& quad : quads){
+		if (quad.getOp() == ASSIGN_QUAD && quad.getDst().isVReg()
+			&& quad.getSrc1().isVReg()){
+			copyOf[quad.getDst().index()] = quad.getSrc1();
+		}
+	}
+	//Follow chains of copies back to the first vreg; in SSA the
+	// chain cannot loop back on itself
+	auto source = [&](Opd opd){
+		while (opd.isVReg() && !copyOf[opd.index()].isNone()){
+			opd = copyOf[opd.index()];
+		}
+		return opd;
+	};
+	IRProgram * prog = proc->getProg();
+	for (Quad& quad : quads){
+		if (quad.getOp() == ASSIGN_QUAD && quad.getDst().isVReg()
+			&& quad.getSrc1().isVReg()){
+			Quad nop = Quad::nop();
+			if (quad.hasLabel()){
+				nop.setLabel(prog->getLabel(quad.getLabel()));
+			}
+			quad = nop;
+			removed++;
+			continue;
+		}
+		if (quad.getOp() == PHI_QUAD){
+			for (Opd& arg : proc->getPhiArgs(quad)){ arg = source(arg); }
+			continue;
+		}
+		quad.setSrc1(source(quad.getSrc1()));
+		quad.setSrc2(source(quad.getSrc2()));
+	}
+	return removed;
+}
+
+//Prefer to keep a vreg that names a source variable, so that
+// the coalesced code still reads like the program
+static int nameRank(const VRegInfo& info, uint32_t idx){
+	if (info.sym == nullptr){ return 0; }
+	return info.origin == idx ? 2 : 1;
+}
+
+size_t coalesceCopies(Procedure * proc){
+	const ControlFlowGraph * cfg = proc->getCFG();
+	const std::vector<Quad>& quads = proc->getQuads();
+	size_t numVRegs = proc->numVRegs();
+	std::vector<std::set<uint32_t>> adj(numVRegs);
+
+	//Two vregs interfere when one is written while the other
+	// is live, unless it is written with a copy of the other
+	{
+		Liveness live(proc);
+		for (const BasicBlock& block : cfg->getBlocks()){
+			BitSet liveNow = live.liveOut(block.getId());
+			for (size_t i = block.end(); i-- > block.first(); ){
+				const Quad& quad = quads[i];
+				Opd dst = quad.getDst();
+				if (dst.isVReg()){
+					Opd copied = quad.getOp() == ASSIGN_QUAD
+						? quad.getSrc1() : Opd::none();
+					uint32_t d = dst.index();
+					liveNow.forEach([&](size_t v){
+						uint32_t other = static_cast<uint32_t>(v);
+						if (other == d){ return; }
+						if (copied.isVReg() && copied.index() == other){ return; }
+						adj[d].insert(other);
+						adj[other].insert(d);
+					});
+				}
+				Liveness::step(quad, liveNow);
+			}
+		}
+	}
+
+	//Look at the copies in the deepest loops first
+	DominatorTree dom(cfg);
+	LoopNest loops(cfg, &dom);
+	std::vector<std::pair<size_t, size_t>> copies;
+	for (size_t i = 0; i < quads.size(); i++){
+		const Quad& quad = quads[i];
+		if (quad.getOp() == ASSIGN_QUAD && quad.getDst().isVReg()
+			&& quad.getSrc1().isVReg()){
+			copies.push_back(std::make_pair(
+				loops.loopDepth(cfg->blockOf(i)), i));
+		}
+	}
+	std::stable_sort(copies.begin(), copies.end(),
+		[](const std::pair<size_t, size_t>& a,
+		const std::pair<size_t, size_t>& b){
+			return a.first > b.first;
+		});
+
+	std::vector<uint32_t> rep(numVRegs);
+	for (uint32_t v = 0; v < numVRegs; v++){ rep[v] = v; }
+	auto find = [&](uint32_t v){
+		while (rep[v] != v){
+			rep[v] = rep[rep[v]];
+			v = rep[v];
+		}
+		return v;
+	};
+
+	for (auto copy : copies){
+		const Quad& quad = quads[copy.second];
+		uint32_t a = find(quad.getDst().index());
+		uint32_t b = find(quad.getSrc1().index());
+		if (a == b || adj[a].count(b) > 0){ continue; }
+		const VRegInfo& infoA = proc->getVReg(Opd::vreg(a));
+		const VRegInfo& infoB = proc->getVReg(Opd::vreg(b));
+		if (infoA.width != infoB.width){ continue; }
+		if (nameRank(infoB, b) > nameRank(infoA, a)){ std::swap(a, b); }
+		//Fold b into a
+		rep[b] = a;
+		for (uint32_t n : adj[b]){
+			adj[n].erase(b);
+			adj[n].insert(a);
+			adj[a].insert(n);
+		}
+		adj[b].clear();
+	}
+
+	auto rename = [&](Opd opd){
+		return opd.isVReg() ? Opd::vreg(find(opd.index())) : opd;
+	};
+	std::vector<Quad>& body = proc->editQuads();
+	std::vector<bool> dead(body.size(), false);
+	size_t removed = 0;
+	for (size_t i = 0; i < body.size(); i++){
+		Quad& quad = body[i];
+		quad.setDst(rename(quad.getDst()));
+		quad.setSrc1(rename(quad.getSrc1()));
+		quad.setSrc2(rename(quad.getSrc2()));
+		if (quad.getOp() == ASSIGN_QUAD && quad.getDst() == quad.getSrc1()){
+			dead[i] = true;
+			removed++;
+		}
+	}
+	if (removed > 0){ eraseQuads(proc, dead); }
+	return removed;
+}
+
+}
@@ -0,0 +1,319 @@
+#include <map>
+#include <tuple>
+#include "dataflow.hpp"
+
+namespace drewno_mars{
+
+BitSet::BitSet(size_t size, bool full)
+: mySize(size), words((size + 63) / 64, full ? ~uint64_t(0) : 0){
+	trim();
+}
+
+//Keep the bits past the end of the set clear so that whole-word
+// comparisons and counts stay exact
+void BitSet::trim(){
+	if (mySize % 64 != 0){
+		words.back() &= (uint64_t(1) << (mySize % 64)) - 1;
+	}
+}
+
+void BitSet::setAll(){
+	for (uint64_t& word : words){ word = ~uint64_t(0); }
+	trim();
+}
+
+void BitSet::clear(){
+	for (uint64_t& word : words){ word = 0; }
+}
+
+bool BitSet::none() const{
+	for (uint64_t word : words){
+		if (word != 0){ return false; }
+	}
+	return true;
+}
+
+size_t BitSet::count() const{
+	size_t res = 0;
+	for (uint64_t word : words){
+		res += static_cast<size_t>(__builtin_popcountll(word));
+	}
+	return res;
+}
+
+bool BitSet::unionWith(const BitSet& other){
+	uint64_t changed = 0;
+	for (size_t i = 0; i < words.size(); i++){
+		uint64_t old = words[i];
+		words[i] |= other.words[i];
+		changed |= old ^ words[i];
+	}
+	return changed != 0;
+}
+
+bool BitSet::intersectWith(const BitSet& other){
+	uint64_t changed = 0;
+	for (size_t i = 0; i < words.size(); i++){
+		uint64_t old = words[i];
+		words[i] &= other.words[i];
+		changed |= old ^ words[i];
+	}
+	return changed != 0;
+}
+
+bool BitSet::subtract(const BitSet& other){
+	uint64_t changed = 0;
+	for (size_t i = 0; i < words.size(); i++){
+		uint64_t old = words[i];
+		words[i] &= ~other.words[i];
+		changed |= old ^ words[i];
+	}
+	return changed != 0;
+}
+
+BitVectorProblem::BitVectorProblem(const ControlFlowGraph * cfgIn,
+	size_t universe, FlowDirection dir, FlowMeet meet)
+: cfg(cfgIn), gen(cfgIn->numBlocks(), BitSet(universe)),
+  kill(cfgIn->numBlocks(), BitSet(universe)),
+  myUniverse(universe), myDir(dir), myMeet(meet){
+}
+
+void BitVectorProblem::solve(const BitSet& boundary){
+	size_t numBlocks = cfg->numBlocks();
+	bool full = myMeet == INTERSECT_MEET;
+	ins.assign(numBlocks, BitSet(myUniverse, full));
+	outs.assign(numBlocks, BitSet(myUniverse, full));
+
+	//Orient the problem so that "before" is the side values
+	// flow in from and "after" the side the transfer produces
+	bool forward = myDir == FORWARD_FLOW;
+	std::vector<BitSet>& before = forward ? ins : outs;
+	std::vector<BitSet>& after = forward ? outs : ins;
+	BlockId start = forward ? cfg->entry() : cfg->exit();
+	std::vector<BlockId> order = cfg->rpo();
+	if (!forward){
+		order.assign(cfg->rpo().rbegin(), cfg->rpo().rend());
+	}
+	std::vector<size_t> position(numBlocks, SIZE_MAX);
+	for (size_t i = 0; i < order.size(); i++){
+		position[order[i]] = i;
+	}
+
+	//Sweep the order, visiting only blocks whose inputs may
+	// have changed since they were last visited
+	std::vector<bool> pending(order.size(), true);
+	size_t numPending = order.size();
+	size_t idx = 0;
+	while (numPending > 0){
+		if (!pending[idx]){
+			idx = (idx + 1) % order.size();
+			continue;
+		}
+		pending[idx] = false;
+		numPending--;
+
+		BlockId block = order[idx];
+		const BasicBlock& bb = cfg->getBlock(block);
+		const std::vector<BlockId>& inEdges =
+			forward ? bb.getPreds() : bb.getSuccs();
+		const std::vector<BlockId>& outEdges =
+			forward ? bb.getSuccs() : bb.getPreds();
+
+		BitSet& value = before[block];
+		if (block == start){
+			value = boundary;
+		} else if (!inEdges.empty()){
+			value = after[inEdges[0]];
+		}
+		for (BlockId other : inEdges){
+			if (full){ value.intersectWith(after[other]); }
+			else { value.unionWith(after[other]); }
+		}
+
+		BitSet result = value;
+		result.subtract(kill[block]);
+		result.unionWith(gen[block]);
+		if (result != after[block]){
+			after[block] = result;
+			for (BlockId other : outEdges){
+				size_t pos = position[other];
+				if (pos != SIZE_MAX && !pending[pos]){
+					pending[pos] = true;
+					numPending++;
+				}
+			}
+		}
+		idx = (idx + 1) % order.size();
+	}
+}
+
+Liveness::Liveness(Procedure * proc)
+: BitVectorProblem(proc->getCFG(), proc->numVRegs(),
+	BACKWARD_FLOW, UNION_MEET){
+	const std::vector<Quad>& quads = proc->getQuads();
+	for (const BasicBlock& block : cfg->getBlocks()){
+		BitSet& use = gen[block.getId()];
+		BitSet& def = kill[block.getId()];
+		for (size_t i = block.end(); i-- > block.first(); ){
+			const Quad& quad = quads[i];
+			Opd dst = quad.getDst();
+			if (dst.isVReg()){
+				def.set(dst.index());
+				use.reset(dst.index());
+			}
+			if (quad.getSrc1().isVReg()){ use.set(quad.getSrc1().index()); }
+			if (quad.getSrc2().isVReg()){ use.set(quad.getSrc2().index()); }
+		}
+	}
+	solve(BitSet(universe()));
+}
+
+void Liveness::step(const Quad& quad, BitSet& live){
+	Opd dst = quad.getDst();
+	if (dst.isVReg()){ live.reset(dst.index()); }
+	if (quad.getSrc1().isVReg()){ live.set(quad.getSrc1().index()); }
+	if (quad.getSrc2().isVReg()){ live.set(quad.getSrc2().index()); }
+}
+
+//Count the definitions up front so the problem can be sized
+static size_t countDefs(const Procedure * proc){
+	size_t res = 0;
+	for (const Quad& quad : proc->getQuads()){
+		if (quad.getDst().isVReg()){ res++; }
+	}
+	return res;
+}
+
+ReachingDefs::ReachingDefs(Procedure * proc)
+: BitVectorProblem(proc->getCFG(), countDefs(proc),
+	FORWARD_FLOW, UNION_MEET), myProc(proc){
+	const std::vector<Quad>& quads = proc->getQuads();
+	quadDefs.assign(quads.size(), SIZE_MAX);
+	vregDefs.assign(proc->numVRegs(), BitSet(universe()));
+	for (size_t i = 0; i < quads.size(); i++){
+		Opd dst = quads[i].getDst();
+		if (dst.isVReg()){
+			quadDefs[i] = defQuads.size();
+			vregDefs[dst.index()].set(defQuads.size());
+			defQuads.push_back(i);
+		}
+	}
+
+	for (const BasicBlock& block : cfg->getBlocks()){
+		for (size_t i = block.first(); i < block.end(); i++){
+			step(i, gen[block.getId()]);
+			if (quadDefs[i] != SIZE_MAX){
+				kill[block.getId()].unionWith(
+					vregDefs[quads[i].getDst().index()]);
+			}
+		}
+	}
+	solve(BitSet(universe()));
+}
+
+void ReachingDefs::step(size_t quadIdx, BitSet& reaching) const{
+	size_t def = quadDefs[quadIdx];
+	if (def == SIZE_MAX){ return; }
+	Opd dst = myProc->getQuads()[quadIdx].getDst();
+	reaching.subtract(vregDefs[dst.index()]);
+	reaching.set(def);
+}
+
+//Expressions are identified by opcode and operands
+typedef std::tuple<unsigned char, unsigned char, uint32_t, uint32_t> ExprKey;
+
+static bool isExpr(const Quad& quad){
+	return quad.getOp() == BINOP_QUAD || quad.getOp() == UNARYOP_QUAD;
+}
+
+static ExprKey exprKey(const Quad& quad){
+	unsigned char sub = quad.getOp() == BINOP_QUAD
+		? static_cast<unsigned char>(quad.getBinOp())
+		: static_cast<unsigned char>(quad.getUnaryOp());
+	return ExprKey(quad.getOp(), sub,
+		quad.getSrc1().getBits(), quad.getSrc2().getBits());
+}
+
+static size_t countExprs(const Procedure * proc){
+	std::map<ExprKey, size_t> seen;
+	for (const Quad& quad : proc->getQuads()){
+		if (isExpr(quad)){ seen.insert(std::make_pair(exprKey(quad), 0)); }
+	}
+	return seen.size();
+}
+
+AvailableExprs::AvailableExprs(Procedure * proc)
+: BitVectorProblem(proc->getCFG(), countExprs(proc),
+	FORWARD_FLOW, INTERSECT_MEET), myProc(proc){
+	const std::vector<Quad>& quads = proc->getQuads();
+	std::map<ExprKey, size_t> ids;
+	globalExprs = BitSet(universe());
+	quadExprs.assign(quads.size(), SIZE_MAX);
+	for (size_t i = 0; i < quads.size(); i++){
+		const Quad& quad = quads[i];
+		if (!isExpr(quad)){ continue; }
+		auto found = ids.find(exprKey(quad));
+		if (found != ids.end()){
+			quadExprs[i] = found->second;
+			continue;
+		}
+		size_t expr = exprQuads.size();
+		ids[exprKey(quad)] = expr;
+		quadExprs[i] = expr;
+		exprQuads.push_back(i);
+		Opd srcs[2] = { quad.getSrc1(), quad.getSrc2() };
+		for (Opd src : srcs){
+			if (src.isNone() || src.isConst()){ continue; }
+			std::vector<size_t>& users = opdExprs[src.getBits()];
+			if (users.empty() || users.back() != expr){
+				users.push_back(expr);
+			}
+			if (src.isGlobal()){ globalExprs.set(expr); }
+		}
+	}
+
+	for (const BasicBlock& block : cfg->getBlocks()){
+		BitSet& blockGen = gen[block.getId()];
+		BitSet& blockKill = kill[block.getId()];
+		for (size_t i = block.first(); i < block.end(); i++){
+			step(i, blockGen);
+			const Quad& quad = quads[i];
+			if (quad.getOp() == CALL_QUAD){
+				blockKill.unionWith(globalExprs);
+			}
+			auto found = opdExprs.find(quad.getDst().getBits());
+			if (!quad.getDst().isNone() && found != opdExprs.end()){
+				for (size_t expr : found->second){
+					blockKill.set(expr);
+				}
+			}
+		}
+	}
+
+	//Nothing is available on entry to the procedure
+	solve(BitSet(universe()));
+}
+
+void AvailableExprs::killUses(Opd opd, BitSet& avail) const{
+	auto found = opdExprs.find(opd.getBits());
+	if (found == opdExprs.end()){ return; }
+	for (size_t expr : found->second){
+		avail.reset(expr);
+	}
+}
+
+void AvailableExprs::step(size_t quadIdx, BitSet& avail) const{
+	const Quad& quad = myProc->getQuads()[quadIdx];
+	if (quadExprs[quadIdx] != SIZE_MAX){
+		avail.set(quadExprs[quadIdx]);
+	}
+	if (quad.getOp() == CALL_QUAD){
+		avail.subtract(globalExprs);
+	}
+	Opd dst = quad.getDst();
+	if (!dst.isNone()){
+		killUses(dst, avail);
+	}
+}
+
+}
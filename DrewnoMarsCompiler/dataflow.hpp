@@ -0,0 +1,146 @@
+#ifndef DREWNO_MARS_DATAFLOW_HPP
+#define DREWNO_MARS_DATAFLOW_HPP
+
+#include <stdint.h>
+#include <vector>
+#include "3ac.hpp"
+#include "cfg.hpp"
+
+namespace drewno_mars{
+
+//A fixed-size set of small integers packed 64 to a word
+class BitSet{
+public:
+	BitSet() : mySize(0){ }
+	explicit BitSet(size_t size, bool full=false);
+	size_t size() const { return mySize; }
+	bool test(size_t i) const {
+		return (words[i / 64] >> (i % 64)) & 1;
+	}
+	void set(size_t i){ words[i / 64] |= uint64_t(1) << (i % 64); }
+	void reset(size_t i){ words[i / 64] &= ~(uint64_t(1) << (i % 64)); }
+	void setAll();
+	void clear();
+	bool none() const;
+	size_t count() const;
+
+	//Each of these returns true if this set changed
+	bool unionWith(const BitSet& other);
+	bool intersectWith(const BitSet& other);
+	bool subtract(const BitSet& other);
+
+	bool operator==(const BitSet& other) const {
+		return words == other.words;
+	}
+	bool operator!=(const BitSet& other) const {
+		return words != other.words;
+	}
+
+	//Call f on each member, in increasing order
+	template <typename Fn> void forEach(Fn f) const {
+		for (size_t w = 0; w < words.size(); w++){
+			uint64_t word = words[w];
+			while (word != 0){
+				size_t bit = static_cast<size_t>(__builtin_ctzll(word));
+				f(w * 64 + bit);
+				word &= word - 1;
+			}
+		}
+	}
+private:
+	void trim();
+	size_t mySize;
+	std::vector<uint64_t> words;
+};
+
+enum FlowDirection{ FORWARD_FLOW, BACKWARD_FLOW };
+enum FlowMeet{ UNION_MEET, INTERSECT_MEET };
+
+//A gen/kill bit-vector dataflow problem over a procedure's CFG.
+// Subclasses size the universe, fill in gen and kill for every
+// block and then call solve(). Blocks are visited in reverse
+// postorder (or its reverse, for backward problems) and only
+// revisited when one of their inputs changes.
+class BitVectorProblem{
+public:
+	virtual ~BitVectorProblem(){ }
+	const ControlFlowGraph * getCFG() const { return cfg; }
+	size_t universe() const { return myUniverse; }
+	//The value at the top of the block, in program order
+	const BitSet& in(BlockId block) const { return ins[block]; }
+	//The value at the bottom of the block, in program order
+	const BitSet& out(BlockId block) const { return outs[block]; }
+protected:
+	BitVectorProblem(const ControlFlowGraph * cfg, size_t universe,
+		FlowDirection dir, FlowMeet meet);
+	//boundary is the value flowing into the entry block
+	// (forward) or out of the exit block (backward)
+	void solve(const BitSet& boundary);
+
+	const ControlFlowGraph * cfg;
+	std::vector<BitSet> gen;
+	std::vector<BitSet> kill;
+private:
+	size_t myUniverse;
+	FlowDirection myDir;
+	FlowMeet myMeet;
+	std::vector<BitSet> ins;
+	std::vector<BitSet> outs;
+};
+
+//Live virtual registers, indexed by vreg number
+class Liveness : public BitVectorProblem{
+public:
+	explicit Liveness(Procedure * proc);
+	const BitSet& liveIn(BlockId block) const { return in(block); }
+	const BitSet& liveOut(BlockId block) const { return out(block); }
+	//Turn the set live after quad into the set live before it
+	static void step(const Quad& quad, BitSet& live);
+};
+
+//Definitions of virtual registers reaching each point. A
+// definition is any body quad whose destination is a vreg,
+// numbered in body order.
+class ReachingDefs : public BitVectorProblem{
+public:
+	explicit ReachingDefs(Procedure * proc);
+	size_t numDefs() const { return defQuads.size(); }
+	size_t defQuad(size_t def) const { return defQuads[def]; }
+	//The definition made by a quad, or SIZE_MAX
+	size_t defAt(size_t quadIdx) const { return quadDefs[quadIdx]; }
+	const BitSet& defsOf(Opd vreg) const { return vregDefs[vreg.index()]; }
+	//Update the set reaching quadIdx to the set reaching the next
+	void step(size_t quadIdx, BitSet& reaching) const;
+private:
+	const Procedure * myProc;
+	std::vector<size_t> defQuads;
+	std::vector<size_t> quadDefs;
+	std::vector<BitSet> vregDefs;
+};
+
+//Binop and unary expressions already computed (and whose
+// operands are unchanged) on every path to each point. Writing
+// an operand kills the expressions that read it; calls may write
+// any global, so they kill everything that reads one.
+class AvailableExprs : public BitVectorProblem{
+public:
+	explicit AvailableExprs(Procedure * proc);
+	size_t numExprs() const { return exprQuads.size(); }
+	//The expression computed by a quad, or SIZE_MAX
+	size_t exprAt(size_t quadIdx) const { return quadExprs[quadIdx]; }
+	//The first quad found computing an expression
+	size_t exprQuad(size_t expr) const { return exprQuads[expr]; }
+	void step(size_t quadIdx, BitSet& avail) const;
+private:
+	void killUses(Opd opd, BitSet& avail) const;
+
+	const Procedure * myProc;
+	std::vector<size_t> exprQuads;
+	std::vector<size_t> quadExprs;
+	HashMap<uint32_t, std::vector<size_t>> opdExprs;
+	BitSet globalExprs;
+};
+
+}
+
+#endif
@@ -0,0 +1,49 @@
+#include "opt.hpp"
+#include "cfg.hpp"
+#include "dataflow.hpp"
+
+namespace drewno_mars{
+
+//Whether a quad can be dropped when nothing reads its result
+static bool isRemovable(const Procedure * proc, const Quad& quad){
+	switch (quad.getOp()){
+	case GETARG_QUAD:
+	case GETRET_QUAD:
+		return true;
+	default:
+		return isPureQuad(proc, quad);
+	}
+}
+
+size_t removeDeadCode(Procedure * proc){
+	size_t total = 0;
+	//Deleting a quad can kill the quads feeding it, possibly
+	// in other blocks, so repeat until nothing changes
+	while (true){
+		Liveness live(proc);
+		const ControlFlowGraph * cfg = live.getCFG();
+		const std::vector<Quad>& quads = proc->getQuads();
+		std::vector<bool> dead(quads.size(), false);
+		size_t removed = 0;
+		for (const BasicBlock& block : cfg->getBlocks()){
+			BitSet liveNow = live.liveOut(block.getId());
+			for (size_t i = block.end(); i-- > block.first(); ){
+				const Quad& quad = quads[i];
+				Opd dst = quad.getDst();
+				if (dst.isVReg() && !liveNow.test(dst.index())
+					&& isRemovable(proc, quad)){
+					dead[i] = true;
+					removed++;
+					continue;
+				}
+				Liveness::step(quad, liveNow);
+			}
+		}
+		if (removed == 0){ break; }
+		eraseQuads(proc, dead);
+		total += removed;
+	}
+	return total;
+}
+
+}
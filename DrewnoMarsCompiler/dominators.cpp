@@ -0,0 +1,115 @@
+#include "dominators.hpp"
+
+namespace drewno_mars{
+
+DominatorTree::DominatorTree(const ControlFlowGraph * cfgIn)
+: cfg(cfgIn){
+	size_t numBlocks = cfg->numBlocks();
+	const std::vector<BlockId>& rpo = cfg->rpo();
+	idoms.assign(numBlocks, NO_BLOCK);
+	kids.assign(numBlocks, std::vector<BlockId>());
+	frontiers.assign(numBlocks, std::vector<BlockId>());
+
+	//The entry is temporarily its own idom so that intersect
+	// has somewhere to stop
+	BlockId entry = cfg->entry();
+	idoms[entry] = entry;
+	bool changed = true;
+	while (changed){
+		changed = false;
+		for (size_t i = 1; i < rpo.size(); i++){
+			BlockId block = rpo[i];
+			BlockId newIdom = NO_BLOCK;
+			for (BlockId pred : cfg->getBlock(block).getPreds()){
+				if (idoms[pred] == NO_BLOCK){ continue; }
+				if (newIdom == NO_BLOCK){ newIdom = pred; }
+				else { newIdom = intersect(pred, newIdom); }
+			}
+			if (idoms[block] != newIdom){
+				idoms[block] = newIdom;
+				changed = true;
+			}
+		}
+	}
+	idoms[entry] = NO_BLOCK;
+
+	for (BlockId block : rpo){
+		if (idoms[block] != NO_BLOCK){
+			kids[idoms[block]].push_back(block);
+		}
+	}
+	number();
+
+	//Walk up from each predecessor of a join point until
+	// reaching the join's idom
+	for (BlockId block : rpo){
+		const std::vector<BlockId>& preds = cfg->getBlock(block).getPreds();
+		if (preds.size() < 2){ continue; }
+		for (BlockId pred : preds){
+			if (!cfg->reachable(pred)){ continue; }
+			BlockId runner = pred;
+			while (runner != NO_BLOCK && runner != idoms[block]){
+				std::vector<BlockId>& df = frontiers[runner];
+				if (df.empty() || df.back() != block){
+					df.push_back(block);
+				}
+				runner = idoms[runner];
+			}
+		}
+	}
+}
+
+BlockId DominatorTree::intersect(BlockId a, BlockId b) const{
+	while (a != b){
+		while (cfg->rpoIndex(a) > cfg->rpoIndex(b)){ a = idoms[a]; }
+		while (cfg->rpoIndex(b) > cfg->rpoIndex(a)){ b = idoms[b]; }
+	}
+	return a;
+}
+
+//Number the tree in pre- and postorder so that dominance
+// queries are a pair of comparisons
+void DominatorTree::number(){
+	pre.assign(cfg->numBlocks(), SIZE_MAX);
+	post.assign(cfg->numBlocks(), SIZE_MAX);
+	size_t preCount = 0;
+	size_t postCount = 0;
+	std::vector<std::pair<BlockId, size_t>> stack;
+	stack.push_back(std::make_pair(cfg->entry(), 0));
+	pre[cfg->entry()] = preCount++;
+	while (!stack.empty()){
+		BlockId block = stack.back().first;
+		size_t& next = stack.back().second;
+		if (next < kids[block].size()){
+			BlockId kid = kids[block][next++];
+			pre[kid] = preCount++;
+			stack.push_back(std::make_pair(kid, 0));
+		} else {
+			post[block] = postCount++;
+			stack.pop_back();
+		}
+	}
+}
+
+bool DominatorTree::dominates(BlockId a, BlockId b) const{
+	if (pre[a] == SIZE_MAX || pre[b] == SIZE_MAX){ return false; }
+	return pre[a] <= pre[b] && post[b] <= post[a];
+}
+
+std::string DominatorTree::toString() const{
+	std::string res = "";
+	for (BlockId block = 0; block < cfg->numBlocks(); block++){
+		if (!cfg->reachable(block)){ continue; }
+		res += "B" + std::to_string(block) + " idom ";
+		if (idoms[block] == NO_BLOCK){ res += "-"; }
+		else { res += "B" + std::to_string(idoms[block]); }
+		res += " df";
+		for (BlockId df : frontiers[block]){
+			res += " B" + std::to_string(df);
+		}
+		res += "\n";
+	}
+	return res;
+}
+
+}
@@ -0,0 +1,47 @@
+#ifndef DREWNO_MARS_DOMINATORS_HPP
+#define DREWNO_MARS_DOMINATORS_HPP
+
+#include <vector>
+#include "cfg.hpp"
+
+namespace drewno_mars{
+
+const BlockId NO_BLOCK = SIZE_MAX;
+
+//The dominator tree of a CFG, found with the iterative
+// algorithm of Cooper, Harvey and Kennedy. Unreachable blocks
+// are left out of the tree entirely.
+class DominatorTree{
+public:
+	explicit DominatorTree(const ControlFlowGraph * cfg);
+	const ControlFlowGraph * getCFG() const { return cfg; }
+	//The immediate dominator; NO_BLOCK for the entry
+	// and for unreachable blocks
+	BlockId idom(BlockId block) const { return idoms[block]; }
+	const std::vector<BlockId>& children(BlockId block) const {
+		return kids[block];
+	}
+	//Whether every path from the entry to b passes through a
+	// (a block dominates itself)
+	bool dominates(BlockId a, BlockId b) const;
+	//Where a's dominance ends: the blocks with a predecessor
+	// dominated by a that are not themselves strictly dominated
+	const std::vector<BlockId>& frontier(BlockId block) const {
+		return frontiers[block];
+	}
+	std::string toString() const;
+private:
+	BlockId intersect(BlockId a, BlockId b) const;
+	void number();
+
+	const ControlFlowGraph * cfg;
+	std::vector<BlockId> idoms;
+	std::vector<std::vector<BlockId>> kids;
+	std::vector<std::vector<BlockId>> frontiers;
+	std::vector<size_t> pre;
+	std::vector<size_t> post;
+};
+
+}
+
+#endif
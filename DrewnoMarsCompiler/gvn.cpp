@@ -0,0 +1,114 @@
+#include <map>
+#include <tuple>
+#include "opt.hpp"
+#include "cfg.hpp"
+#include "dominators.hpp"
+
+namespace drewno_mars{
+
+static bool isCommutative(BinOp op){
+	switch (op){
+	case ADD64: case MULT64: case EQ64: case NEQ64: case AND64: case OR64:
+	case ADD8: case MULT8: case EQ8: case NEQ8: case AND8: case OR8:
+		return true;
+	default:
+		return false;
+	}
+}
+
+typedef std::tuple<unsigned char, unsigned char, uint32_t, uint32_t> ValueKey;
+
+//Dominator-based value numbering over a procedure in SSA form.
+// Walking the dominator tree with a scoped table means any
+// match found was computed on every path to the current quad.
+size_t numberValues(Procedure * proc){
+	//Quads are only rewritten in place, which leaves the CFG
+	// built after taking the body for editing intact
+	std::vector<Quad>& quads = proc->editQuads();
+	const ControlFlowGraph * cfg = proc->getCFG();
+	DominatorTree dom(cfg);
+	IRProgram * prog = proc->getProg();
+
+	//Each vreg's value number is the vreg first known to hold
+	// the same value
+	std::vector<Opd> numbers(proc->numVRegs());
+	for (size_t v = 0; v < numbers.size(); v++){
+		numbers[v] = Opd::vreg(static_cast<uint32_t>(v));
+	}
+	auto number = [&](Opd opd){
+		return opd.isVReg() ? numbers[opd.index()] : opd;
+	};
+
+	std::map<ValueKey, Opd> table;
+	std::vector<ValueKey> added;
+	std::vector<std::pair<BlockId, size_t>> walk;
+	std::vector<size_t> marks;
+	size_t replaced = 0;
+	walk.push_back(std::make_pair(cfg->entry(), 0));
+	marks.push_back(0);
+	while (!walk.empty()){
+		BlockId block = walk.back().first;
+		size_t& nextKid = walk.back().second;
+		const BasicBlock& bb = cfg->getBlock(block);
+
+		for (size_t i = bb.first(); nextKid == 0 && i < bb.end(); i++){
+			Quad& quad = quads[i];
+			Opd dst = quad.getDst();
+			if (!dst.isVReg()){ continue; }
+			if (quad.getOp() == ASSIGN_QUAD && quad.getSrc1().isVReg()){
+				numbers[dst.index()] = number(quad.getSrc1());
+				continue;
+			}
+			if (quad.getOp() != BINOP_QUAD && quad.getOp() != UNARYOP_QUAD){
+				continue;
+			}
+			//Globals can change behind our back
+			Opd lhs = number(quad.getSrc1());
+			Opd rhs = number(quad.getSrc2());
+			if (lhs.isGlobal() || rhs.isGlobal()){ continue; }
+
+			unsigned char subOp;
+			if (quad.getOp() == BINOP_QUAD){
+				subOp = static_cast<unsigned char>(quad.getBinOp());
+				if (isCommutative(quad.getBinOp()) && rhs < lhs){
+					std::swap(lhs, rhs);
+				}
+			} else {
+				subOp = static_cast<unsigned char>(quad.getUnaryOp());
+			}
+			ValueKey key(quad.getOp(), subOp, lhs.getBits(), rhs.getBits());
+			auto found = table.find(key);
+			if (found == table.end()){
+				table[key] = dst;
+				added.push_back(key);
+				continue;
+			}
+
+			//Already computed on every path here: copy it instead
+			Quad copy = Quad::assign(dst, found->second);
+			if (quad.hasLabel()){
+				copy.setLabel(prog->getLabel(quad.getLabel()));
+			}
+			copy.setCommentIdx(quad.getCommentIdx());
+			quad = copy;
+			numbers[dst.index()] = found->second;
+			replaced++;
+		}
+
+		const std::vector<BlockId>& kids = dom.children(block);
+		if (nextKid < kids.size()){
+			walk.push_back(std::make_pair(kids[nextKid++], 0));
+			marks.push_back(added.size());
+			continue;
+		}
+		while (added.size() > marks.back()){
+			table.erase(added.back());
+			added.pop_back();
+		}
+		walk.pop_back();
+		marks.pop_back();
+	}
+	return replaced;
+}
+
+}
@@ -0,0 +1,268 @@
+#include <algorithm>
+#include "opt.hpp"
+#include "cfg.hpp"
+#include "dominators.hpp"
+#include "loops.hpp"
+
+namespace drewno_mars{
+
+//The procedure a call quad goes to, if it is one of ours
+static Procedure * calleeOf(IRProgram * prog, const Quad& call,
+	const HashMap<std::string, Procedure *>& byName){
+	const GlobalInfo& info = prog->getGlobalInfo(call.getSrc1());
+	if (info.sym->getKind() != FN){ return nullptr; }
+	auto found = byName.find(info.sym->getName());
+	return found == byName.end() ? nullptr : found->second;
+}
+
+static HashMap<std::string, Procedure *> procsByName(IRProgram * prog){
+	HashMap<std::string, Procedure *> byName;
+	for (Procedure * proc : *prog->getProcs()){
+		byName[proc->getName()] = proc;
+	}
+	return byName;
+}
+
+CallOrder orderCalls(IRProgram * prog){
+	HashMap<std::string, Procedure *> byName = procsByName(prog);
+	std::vector<Procedure *> procs(prog->getProcs()->begin(),
+		prog->getProcs()->end());
+	HashMap<Procedure *, size_t> idxs;
+	for (size_t i = 0; i < procs.size(); i++){ idxs[procs[i]] = i; }
+	std::vector<std::vector<size_t>> callees(procs.size());
+	for (size_t i = 0; i < procs.size(); i++){
+		for (const Quad& quad : procs[i]->getQuads()){
+			if (quad.getOp() != CALL_QUAD){ continue; }
+			Procedure * callee = calleeOf(prog, quad, byName);
+			if (callee != nullptr){ callees[i].push_back(idxs[callee]); }
+		}
+	}
+
+	//Tarjan's algorithm finishes each strongly connected
+	// component after the ones it calls into, which is the
+	// order we want. Any component that calls itself is
+	// recursive.
+	CallOrder order;
+	const size_t UNSEEN = SIZE_MAX;
+	std::vector<size_t> index(procs.size(), UNSEEN);
+	std::vector<size_t> low(procs.size(), 0);
+	std::vector<bool> onStack(procs.size(), false);
+	std::vector<size_t> stack;
+	size_t counter = 0;
+	std::vector<std::pair<size_t, size_t>> work;
+	for (size_t root = 0; root < procs.size(); root++){
+		if (index[root] != UNSEEN){ continue; }
+		work.push_back(std::make_pair(root, 0));
+		while (!work.empty()){
+			size_t v = work.back().first;
+			size_t& next = work.back().second;
+			if (next == 0 && index[v] == UNSEEN){
+				index[v] = low[v] = counter++;
+				stack.push_back(v);
+				onStack[v] = true;
+			}
+			if (next < callees[v].size()){
+				size_t w = callees[v][next++];
+				if (index[w] == UNSEEN){
+					work.push_back(std::make_pair(w, 0));
+				} else if (onStack[w]){
+					low[v] = std::min(low[v], index[w]);
+				}
+				continue;
+			}
+			work.pop_back();
+			if (!work.empty()){
+				size_t parent = work.back().first;
+				low[parent] = std::min(low[parent], low[v]);
+			}
+			if (low[v] != index[v]){ continue; }
+			std::vector<size_t> scc;
+			size_t w;
+			do {
+				w = stack.back();
+				stack.pop_back();
+				onStack[w] = false;
+				scc.push_back(w);
+			} while (w != v);
+			bool recursive = scc.size() > 1
+				|| std::count(callees[v].begin(), callees[v].end(), v) > 0;
+			for (size_t member : scc){
+				order.procs.push_back(procs[member]);
+				if (recursive){ order.recursive.insert(procs[member]); }
+			}
+		}
+	}
+	return order;
+}
+
+//The quads a callee contributes to its caller's size. Getargs
+// turn into copies of the arguments, which mostly go away.
+static size_t bodySize(const Procedure * proc){
+	size_t size = 0;
+	for (const Quad& quad : proc->getQuads()){
+		if (quad.getOp() != NOP_QUAD && quad.getOp() != GETARG_QUAD){
+			size++;
+		}
+	}
+	return size;
+}
+
+//Replace the call at callIdx, along with the setargs from
+// firstArg and the getret after it, by a copy of the callee's
+// body. Formals become copies of the arguments, setret a copy to
+// the call's result, and returns jump past the copied body.
+static void inlineCall(Procedure * caller, size_t firstArg, size_t callIdx,
+	const Procedure * callee){
+	IRProgram * prog = caller->getProg();
+	std::vector<Quad>& quads = caller->editQuads();
+
+	std::vector<Opd> args;
+	for (size_t i = firstArg; i < callIdx; i++){
+		args.push_back(quads[i].getSrc1());
+	}
+	size_t last = callIdx;
+	Opd result = Opd::none();
+	if (callIdx + 1 < quads.size()
+		&& quads[callIdx + 1].getOp() == GETRET_QUAD){
+		last = callIdx + 1;
+		result = quads[last].getDst();
+	}
+
+	std::vector<Opd> vregs(callee->numVRegs(), Opd::none());
+	auto mapOpd = [&](Opd opd){
+		if (!opd.isVReg()){ return opd; }
+		Opd& mapped = vregs[opd.index()];
+		if (mapped.isNone()){
+			mapped = caller->adoptVReg(callee->getVReg(opd));
+		}
+		return mapped;
+	};
+	Label * after = caller->makeLabel();
+	HashMap<LabelId, Label *> labels;
+	labels[callee->getLeave().getLabel()] = after;
+	auto mapLabel = [&](LabelId id){
+		auto found = labels.find(id);
+		if (found != labels.end()){ return found->second; }
+		Label * fresh = caller->makeLabel();
+		labels[id] = fresh;
+		return fresh;
+	};
+
+	std::vector<Quad> inlined;
+	if (quads[firstArg].hasLabel()){
+		Quad holder = Quad::nop();
+		holder.setLabel(prog->getLabel(quads[firstArg].getLabel()));
+		inlined.push_back(holder);
+	}
+	for (const Quad& orig : callee->getQuads()){
+		Quad quad = orig;
+		switch (orig.getOp()){
+		case GETARG_QUAD:
+			if (orig.getIndex() < 1 || orig.getIndex() > args.size()){
+				throw new InternalError("Inlined getarg without an argument");
+			}
+			quad = Quad::assign(mapOpd(orig.getDst()),
+				args[orig.getIndex() - 1]);
+			break;
+		case SETRET_QUAD:
+			quad = result.isNone() ? Quad::nop()
+				: Quad::assign(result, mapOpd(orig.getSrc1()));
+			break;
+		case TAILCALL_QUAD:
+			//Back to an ordinary call, returning to the caller
+			quad = Quad::call(orig.getSrc1());
+			if (orig.hasLabel()){ quad.setLabel(mapLabel(orig.getLabel())); }
+			inlined.push_back(quad);
+			if (!result.isNone()){ inlined.push_back(Quad::getRet(result)); }
+			inlined.push_back(Quad::jump(after));
+			continue;
+		case GOTO_QUAD:
+		case IFZ_QUAD:
+			quad.setTarget(mapLabel(orig.getTarget()));
+			quad.setSrc1(mapOpd(orig.getSrc1()));
+			break;
+		default:
+			quad.setDst(mapOpd(orig.getDst()));
+			quad.setSrc1(mapOpd(orig.getSrc1()));
+			quad.setSrc2(mapOpd(orig.getSrc2()));
+			break;
+		}
+		quad.setCommentIdx(orig.getCommentIdx());
+		quad.clearLabel();
+		if (orig.hasLabel()){ quad.setLabel(mapLabel(orig.getLabel())); }
+		inlined.push_back(quad);
+	}
+	Quad landing = Quad::nop();
+	landing.setLabel(after);
+	inlined.push_back(landing);
+
+	quads.erase(quads.begin() + static_cast<long>(firstArg),
+		quads.begin() + static_cast<long>(last + 1));
+	quads.insert(quads.begin() + static_cast<long>(firstArg),
+		inlined.begin(), inlined.end());
+}
+
+//How many quads a callee may have to be inlined at -O1, -O2
+// and -O3; each loop around the call site doubles it, twice at
+// most
+static size_t inlineLimit(int level, size_t loopDepth){
+	size_t base = level >= 3 ? 40 : level == 2 ? 20 : 6;
+	return base << std::min(loopDepth, static_cast<size_t>(2));
+}
+
+//Callers stop growing once they reach this many quads
+static const size_t MAX_CALLER_SIZE = 2000;
+
+size_t inlineCalls(Procedure * proc, const CallOrder& order, int level){
+	IRProgram * prog = proc->getProg();
+	HashMap<std::string, Procedure *> byName = procsByName(prog);
+	const ControlFlowGraph * cfg = proc->getCFG();
+	DominatorTree dom(cfg);
+	LoopNest loops(cfg, &dom);
+
+	//Walking backwards leaves the indices still to be visited
+	// (and the CFG describing them) intact
+	size_t inlined = 0;
+	size_t size = bodySize(proc);
+	for (size_t i = proc->getQuads().size(); i-- > 0; ){
+		const Quad& call = proc->getQuads()[i];
+		if (call.getOp() != CALL_QUAD){ continue; }
+		Procedure * callee = calleeOf(prog, call, byName);
+		if (callee == nullptr || callee == proc
+			|| order.recursive.count(callee) > 0){
+			continue;
+		}
+		size_t calleeSize = bodySize(callee);
+		size_t depth = loops.loopDepth(cfg->blockOf(i));
+		if (calleeSize > inlineLimit(level, depth)
+			|| size + calleeSize > MAX_CALLER_SIZE){
+			continue;
+		}
+
+		//One setarg per formal runs right up to the call, and
+		// only the first of them may start a block
+		const std::vector<Quad>& quads = proc->getQuads();
+		size_t numArgs = callee->getFormals().size();
+		if (numArgs > i){ continue; }
+		size_t firstArg = i - numArgs;
+		bool matches = true;
+		for (size_t a = firstArg; a < i; a++){
+			if (quads[a].getOp() != SETARG_QUAD
+				|| quads[a].getIndex() != a - firstArg + 1){
+				matches = false;
+			}
+		}
+		for (size_t a = firstArg + 1; a <= i + 1 && a < quads.size(); a++){
+			bool part = a <= i || quads[a].getOp() == GETRET_QUAD;
+			if (part && quads[a].hasLabel()){ matches = false; }
+		}
+		if (!matches){ continue; }
+		inlineCall(proc, firstArg, i, callee);
+		size += calleeSize;
+		inlined++;
+		i = firstArg;
+	}
+	return inlined;
+}
+
+}
@@ -0,0 +1,379 @@
+#include <algorithm>
+#include "opt.hpp"
+#include "cfg.hpp"
+#include "dominators.hpp"
+#include "loops.hpp"
+
+namespace drewno_mars{
+
+//A basic induction variable: a header phi that grows by a
+// loop-invariant step on its way around the back edge
+struct BasicIV{
+	Opd phi;
+	Opd next;
+	Opd init;
+	Opd step;
+	size_t phiIdx;
+	size_t updateIdx;
+};
+
+//The derived induction variable phi * factor, carried in a phi
+// of its own and bumped right after the basic one
+struct ReducedIV{
+	Opd factor;
+	Opd phi;
+	Opd next;
+};
+
+//a + b and a * b, if they fit in 64 bits
+static bool addFits(int64_t a, int64_t b, int64_t& res){
+	return !__builtin_add_overflow(a, b, &res);
+}
+static bool mulFits(int64_t a, int64_t b, int64_t& res){
+	return !__builtin_mul_overflow(a, b, &res);
+}
+
+//Strength-reduce the induction variables of one loop of an SSA
+// procedure, replace the exit tests of those that are only
+// compared, and drop them once nothing reads them
+static void reduceLoop(Procedure * proc, size_t loopIdx, OptStats& stats){
+	std::vector<Quad>& quads = proc->editQuads();
+	const ControlFlowGraph * cfg = proc->getCFG();
+	DominatorTree dom(cfg);
+	LoopNest loops(cfg, &dom);
+	const Loop& loop = loops.getLoop(loopIdx);
+	const BasicBlock& header = cfg->getBlock(loop.header);
+	if (loop.preheader == NO_BLOCK || loop.latches.size() != 1
+		|| header.getPreds().size() != 2){
+		return;
+	}
+	BlockId latch = loop.latches[0];
+	size_t prePos = header.getPreds()[0] == loop.preheader ? 0 : 1;
+	size_t latchPos = 1 - prePos;
+	IRProgram * prog = proc->getProg();
+
+	size_t numVRegs = proc->numVRegs();
+	std::vector<size_t> defAt(numVRegs, SIZE_MAX);
+	std::vector<std::vector<size_t>> usedAt(numVRegs);
+	for (size_t i = 0; i < quads.size(); i++){
+		const Quad& quad = quads[i];
+		auto use = [&](Opd opd){
+			if (opd.isVReg()){ usedAt[opd.index()].push_back(i); }
+		};
+		if (quad.getDst().isVReg()){ defAt[quad.getDst().index()] = i; }
+		if (quad.getOp() == PHI_QUAD){
+			for (Opd arg : proc->getPhiArgs(quad)){ use(arg); }
+		} else {
+			use(quad.getSrc1());
+			use(quad.getSrc2());
+		}
+	}
+	auto inLoop = [&](size_t quadIdx){
+		return loop.contains(cfg->blockOf(quadIdx));
+	};
+	auto invariant = [&](Opd opd){
+		if (opd.isConst()){ return true; }
+		if (!opd.isVReg()){ return false; }
+		size_t def = defAt[opd.index()];
+		return def == SIZE_MAX || !inLoop(def);
+	};
+
+	std::vector<BasicIV> ivs;
+	size_t lastPhi = header.first();
+	for (size_t i = header.first(); i < header.end(); i++){
+		if (quads[i].getOp() != PHI_QUAD){ break; }
+		lastPhi = i;
+		const std::vector<Opd>& args = proc->getPhiArgs(quads[i]);
+		Opd phi = quads[i].getDst();
+		Opd next = args[latchPos];
+		if (!next.isVReg() || invariant(next)){ continue; }
+		size_t updateIdx = defAt[next.index()];
+		const Quad& update = quads[updateIdx];
+		if (update.getOp() != BINOP_QUAD){ continue; }
+		Opd step = Opd::none();
+		int64_t val;
+		if (update.getBinOp() == ADD64){
+			if (update.getSrc1() == phi){ step = update.getSrc2(); }
+			else if (update.getSrc2() == phi){ step = update.getSrc1(); }
+		} else if (update.getBinOp() == SUB64 && update.getSrc1() == phi
+			&& constValue(proc, update.getSrc2(), val)){
+			step = prog->makeInt(foldUnaryOp(NEG64, val));
+		}
+		if (step.isNone() || !invariant(step)){ continue; }
+		ivs.push_back(BasicIV{phi, next, args[prePos], step, i, updateIdx});
+	}
+	if (ivs.empty()){ return; }
+
+	//New quads go in after (or, for the preheader's branch,
+	// before) existing ones once everything has been decided
+	std::vector<std::vector<Quad>> before(quads.size());
+	std::vector<std::vector<Quad>> after(quads.size());
+	std::vector<Opd> renamed(numVRegs, Opd::none());
+	std::vector<bool> dropped(quads.size(), false);
+	std::vector<bool> deadPhis(quads.size(), false);
+	const BasicBlock& pre = cfg->getBlock(loop.preheader);
+	size_t preLast = pre.end() - 1;
+	bool preBranches = quads[preLast].getOp() == GOTO_QUAD
+		|| quads[preLast].getOp() == IFZ_QUAD;
+	std::vector<Quad>& preQuads = preBranches
+		? before[preLast] : after[preLast];
+
+	//a * b, folded when possible and otherwise computed in the
+	// preheader
+	auto product = [&](Opd a, Opd b){
+		int64_t av, bv, res;
+		bool aConst = constValue(proc, a, av);
+		bool bConst = constValue(proc, b, bv);
+		if (aConst && bConst){
+			foldBinOp(MULT64, av, bv, res);
+			return prog->makeInt(res);
+		}
+		if ((aConst && av == 0) || (bConst && bv == 0)){
+			return prog->makeInt(0);
+		}
+		if (aConst && av == 1){ return b; }
+		if (bConst && bv == 1){ return a; }
+		Opd tmp = proc->makeTmp(8);
+		preQuads.push_back(Quad::binOp(tmp, MULT64, a, b));
+		return tmp;
+	};
+
+	for (const BasicIV& iv : ivs){
+		//Multiplications of the IV by an invariant factor become
+		// a new IV bumped by step * factor
+		std::vector<ReducedIV> reduced;
+		for (Opd val : {iv.phi, iv.next}){
+			for (size_t user : usedAt[val.index()]){
+				const Quad& quad = quads[user];
+				if (quad.getOp() != BINOP_QUAD || quad.getBinOp() != MULT64
+					|| !inLoop(user)){
+					continue;
+				}
+				Opd factor = quad.getSrc1() == val
+					? quad.getSrc2() : quad.getSrc1();
+				if (!invariant(factor)){ continue; }
+				ReducedIV * red = nullptr;
+				for (ReducedIV& other : reduced){
+					if (other.factor == factor){ red = &other; }
+				}
+				if (red == nullptr){
+					ReducedIV made{factor, proc->makeTmp(8), proc->makeTmp(8)};
+					Opd start = product(iv.init, factor);
+					Opd inc = product(iv.step, factor);
+					Quad phi = Quad::phi(made.phi, proc->makePhiArgs(2, start));
+					proc->getPhiArgs(phi)[latchPos] = made.next;
+					after[lastPhi].push_back(phi);
+					after[iv.updateIdx].push_back(
+						Quad::binOp(made.next, ADD64, made.phi, inc));
+					reduced.push_back(made);
+					red = &reduced.back();
+				}
+				renamed[quad.getDst().index()] = val == iv.phi
+					? red->phi : red->next;
+				dropped[user] = true;
+				stats.add("ivopt.mults-reduced", 1);
+			}
+		}
+
+		//What else reads the IV, besides its own update
+		std::vector<size_t> others;
+		for (Opd val : {iv.phi, iv.next}){
+			for (size_t user : usedAt[val.index()]){
+				if (user == iv.updateIdx || user == iv.phiIdx || dropped[user]){
+					continue;
+				}
+				others.push_back(user);
+			}
+		}
+
+		//If the rest are all comparisons against constants, they
+		// can test a reduced IV instead. That needs the products
+		// to keep the order of the original values, which holds
+		// when none of them overflow: bound the values the IV takes
+		// by a test that leaves the loop on every iteration.
+		bool rangeKnown = false;
+		int64_t lo = 0;
+		int64_t hi = 0;
+		int64_t init;
+		int64_t step;
+		bool constIV = constValue(proc, iv.init, init)
+			&& constValue(proc, iv.step, step) && step != 0;
+		bool compares = !others.empty();
+		for (size_t user : others){
+			const Quad& quad = quads[user];
+			int64_t bound;
+			if (quad.getOp() != BINOP_QUAD || !isCompare(quad.getBinOp())
+				|| !(constValue(proc, quad.getSrc1(), bound)
+				|| constValue(proc, quad.getSrc2(), bound))){
+				compares = false;
+				break;
+			}
+			if (!constIV || rangeKnown){ continue; }
+			const BasicBlock& block = cfg->getBlock(cfg->blockOf(user));
+			const Quad& last = quads[block.end() - 1];
+			if (last.getOp() != IFZ_QUAD || last.getSrc1() != quad.getDst()
+				|| !dom.dominates(block.getId(), latch)
+				|| block.getSuccs().size() != 2){
+				continue;
+			}
+			bool targetExits = !loop.contains(
+				cfg->blockOfLabel(last.getTarget()));
+			size_t exits = 0;
+			for (BlockId succ : block.getSuccs()){
+				if (!loop.contains(succ)){ exits++; }
+			}
+			if (exits != 1){ continue; }
+			//Normalize to "keep looping while x op bound"
+			BinOp op = quad.getBinOp();
+			if (quad.getSrc1() != iv.phi && quad.getSrc1() != iv.next){
+				op = swapCompare(op);
+			}
+			if (!targetExits){ op = negateCompare(op); }
+			Opd tested = quad.getSrc1() == iv.phi || quad.getSrc2() == iv.phi
+				? iv.phi : iv.next;
+			int64_t first = init;
+			if (tested == iv.next && !addFits(init, step, first)){ continue; }
+			int64_t limit;
+			bool ok = false;
+			if (step > 0 && (op == LT64 || op == LTE64)){
+				ok = addFits(bound, op == LT64 ? step - 1 : step, limit);
+				lo = first;
+				hi = std::max(first, limit);
+			} else if (step < 0 && (op == GT64 || op == GTE64)){
+				ok = addFits(bound, op == GT64 ? step + 1 : step, limit);
+				lo = std::min(first, limit);
+				hi = first;
+			}
+			if (!ok){ continue; }
+			//From the tested value to both the phi and the next one
+			if (tested == iv.next){
+				ok = step != INT64_MIN && addFits(lo, -step, lo)
+					&& addFits(hi, -step, hi);
+			}
+			if (ok && step > 0){ ok = addFits(hi, step, hi); }
+			if (ok && step < 0){ ok = addFits(lo, step, lo); }
+			rangeKnown = ok;
+		}
+
+		const ReducedIV * chosen = nullptr;
+		if (compares){
+			for (const ReducedIV& red : reduced){
+				int64_t factor;
+				if (!constValue(proc, red.factor, factor) || factor <= 0){
+					continue;
+				}
+				int64_t scratch;
+				bool rangeFits = rangeKnown && mulFits(lo, factor, scratch)
+					&& mulFits(hi, factor, scratch);
+				bool fits = true;
+				for (size_t user : others){
+					const Quad& quad = quads[user];
+					int64_t bound;
+					if (!constValue(proc, quad.getSrc1(), bound)){
+						constValue(proc, quad.getSrc2(), bound);
+					}
+					BinOp op = quad.getBinOp();
+					bool injective = (op == EQ64 || op == NEQ64)
+						&& factor % 2 != 0;
+					if (!mulFits(bound, factor, scratch)
+						|| !(injective || rangeFits)){
+						fits = false;
+					}
+				}
+				if (fits){
+					chosen = &red;
+					break;
+				}
+			}
+		}
+		if (chosen != nullptr){
+			int64_t factor;
+			constValue(proc, chosen->factor, factor);
+			for (size_t user : others){
+				Quad& quad = quads[user];
+				auto rewrite = [&](Opd opd){
+					int64_t val;
+					if (opd == iv.phi){ return chosen->phi; }
+					if (opd == iv.next){ return chosen->next; }
+					constValue(proc, opd, val);
+					mulFits(val, factor, val);
+					return prog->makeInt(val);
+				};
+				quad.setSrc1(rewrite(quad.getSrc1()));
+				quad.setSrc2(rewrite(quad.getSrc2()));
+				stats.add("ivopt.tests-replaced", 1);
+			}
+			others.clear();
+		}
+
+		//An IV that only feeds itself is dead
+		if (others.empty()){
+			dropped[iv.updateIdx] = true;
+			deadPhis[iv.phiIdx] = true;
+			stats.add("ivopt.ivs-removed", 1);
+		}
+	}
+
+	std::vector<Quad> body;
+	std::vector<size_t> phisAt;
+	body.reserve(quads.size());
+	for (size_t i = 0; i < quads.size(); i++){
+		Quad quad = quads[i];
+		if (dropped[i]){
+			Quad nop = Quad::nop();
+			if (quad.hasLabel()){
+				nop.setLabel(prog->getLabel(quad.getLabel()));
+			}
+			quad = nop;
+		}
+		auto rename = [&](Opd opd){
+			if (opd.isVReg() && opd.index() < numVRegs
+				&& !renamed[opd.index()].isNone()){
+				return renamed[opd.index()];
+			}
+			return opd;
+		};
+		if (quad.getOp() == PHI_QUAD){
+			for (Opd& arg : proc->getPhiArgs(quad)){ arg = rename(arg); }
+		} else {
+			quad.setSrc1(rename(quad.getSrc1()));
+			quad.setSrc2(rename(quad.getSrc2()));
+		}
+		if (!before[i].empty()){
+			if (quad.hasLabel()){
+				before[i][0].setLabel(prog->getLabel(quad.getLabel()));
+				quad.clearLabel();
+			}
+			body.insert(body.end(), before[i].begin(), before[i].end());
+		}
+		if (deadPhis[i]){ phisAt.push_back(body.size()); }
+		body.push_back(quad);
+		body.insert(body.end(), after[i].begin(), after[i].end());
+	}
+	//Taken for editing again, so the CFG above is dropped
+	proc->editQuads().swap(body);
+
+	//Dead phis go last, since erasing them moves labels
+	if (!phisAt.empty()){
+		std::vector<bool> erase(quads.size(), false);
+		for (size_t at : phisAt){ erase[at] = true; }
+		eraseQuads(proc, erase);
+	}
+}
+
+void reduceInductionVars(Procedure * proc, OptStats& stats){
+	size_t numLoops;
+	{
+		const ControlFlowGraph * cfg = proc->getCFG();
+		DominatorTree dom(cfg);
+		LoopNest loops(cfg, &dom);
+		numLoops = loops.numLoops();
+	}
+	//Only quads within blocks are added or removed, so loop
+	// numbers stay put
+	for (size_t i = numLoops; i-- > 0; ){
+		reduceLoop(proc, i, stats);
+	}
+}
+
+}
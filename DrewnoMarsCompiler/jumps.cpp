@@ -0,0 +1,199 @@
+#include "opt.hpp"
+#include "cfg.hpp"
+
+namespace drewno_mars{
+
+static bool isJump(const Quad& quad){
+	return quad.getOp() == GOTO_QUAD || quad.getOp() == IFZ_QUAD;
+}
+
+//Whether control never falls out of the bottom of quad
+static bool endsFlow(const Quad& quad){
+	switch (quad.getOp()){
+	case GOTO_QUAD:
+	case EXIT_QUAD:
+	case TAILCALL_QUAD:
+		return true;
+	default:
+		return false;
+	}
+}
+
+//Redirect every jump through the label mapping, where it has an
+// entry for the target
+static void retarget(Procedure * proc,
+	const HashMap<LabelId, LabelId>& alias){
+	if (alias.empty()){ return; }
+	IRProgram * prog = proc->getProg();
+	for (Quad& quad : proc->editQuads()){
+		if (!isJump(quad)){ continue; }
+		auto found = alias.find(quad.getTarget());
+		if (found != alias.end()){
+			quad.setTarget(prog->getLabel(found->second));
+		}
+	}
+}
+
+//Delete every nop. The labels of a run of nops all go to the
+// quad after it, and to the leave label at the end of the body.
+static size_t dropNops(Procedure * proc){
+	IRProgram * prog = proc->getProg();
+	const std::vector<Quad>& quads = proc->getQuads();
+	HashMap<LabelId, LabelId> alias;
+	std::vector<LabelId> pending;
+	std::vector<Quad> res;
+	size_t removed = 0;
+	for (const Quad& quad : quads){
+		if (quad.getOp() == NOP_QUAD){
+			if (quad.hasLabel()){ pending.push_back(quad.getLabel()); }
+			removed++;
+			continue;
+		}
+		res.push_back(quad);
+		if (pending.empty()){ continue; }
+		Quad& kept = res.back();
+		if (!kept.hasLabel()){ kept.setLabel(prog->getLabel(pending[0])); }
+		for (LabelId label : pending){
+			if (label != kept.getLabel()){ alias[label] = kept.getLabel(); }
+		}
+		pending.clear();
+	}
+	for (LabelId label : pending){
+		alias[label] = proc->getLeave().getLabel();
+	}
+	if (removed == 0){ return 0; }
+	proc->editQuads().swap(res);
+	retarget(proc, alias);
+	return removed;
+}
+
+//Take labels no jump goes to off their quads, so straight-line
+// code reads as one block
+static void dropUnusedLabels(Procedure * proc){
+	std::set<LabelId> used;
+	for (const Quad& quad : proc->getQuads()){
+		if (isJump(quad)){ used.insert(quad.getTarget()); }
+	}
+	for (Quad& quad : proc->editQuads()){
+		if (quad.hasLabel() && used.count(quad.getLabel()) == 0){
+			quad.clearLabel();
+		}
+	}
+}
+
+//Point jumps that land on a goto at that goto's target instead,
+// and ifz quads landing on another ifz of the same (still false)
+// condition at the second one's target
+static size_t threadJumps(Procedure * proc){
+	const std::vector<Quad>& quads = proc->getQuads();
+	HashMap<LabelId, size_t> at;
+	for (size_t i = 0; i < quads.size(); i++){
+		if (quads[i].hasLabel()){ at[quads[i].getLabel()] = i; }
+	}
+	IRProgram * prog = proc->getProg();
+	std::vector<Quad>& edited = proc->editQuads();
+	size_t threaded = 0;
+	for (Quad& quad : edited){
+		if (!isJump(quad)){ continue; }
+		LabelId target = quad.getTarget();
+		//Bounded, since a cycle of gotos is an infinite loop that
+		// has to stay one
+		for (size_t steps = 0; steps < edited.size(); steps++){
+			auto found = at.find(target);
+			if (found == at.end()){ break; }
+			const Quad& landing = edited[found->second];
+			bool follows = landing.getOp() == GOTO_QUAD
+				|| (quad.getOp() == IFZ_QUAD && landing.getOp() == IFZ_QUAD
+					&& landing.getSrc1() == quad.getSrc1());
+			if (!follows || landing.getTarget() == target){ break; }
+			target = landing.getTarget();
+		}
+		if (target != quad.getTarget()){
+			quad.setTarget(prog->getLabel(target));
+			threaded++;
+		}
+	}
+	return threaded;
+}
+
+//Delete jumps to the quad right after them, or off the end of
+// the body to the leave label
+static size_t dropNextJumps(Procedure * proc){
+	const std::vector<Quad>& quads = proc->getQuads();
+	LabelId leave = proc->getLeave().getLabel();
+	std::vector<bool> dead(quads.size(), false);
+	size_t removed = 0;
+	for (size_t i = 0; i < quads.size(); i++){
+		if (!isJump(quads[i])){ continue; }
+		LabelId next = i + 1 < quads.size() ? quads[i + 1].getLabel() : leave;
+		if (quads[i].getTarget() == next){
+			dead[i] = true;
+			removed++;
+		}
+	}
+	if (removed > 0){ eraseQuads(proc, dead); }
+	return removed;
+}
+
+//Move a block that is only reached by a goto, and does not fall
+// through itself, up in place of that goto. Returns whether one
+// was moved.
+static bool mergeBlock(Procedure * proc){
+	const ControlFlowGraph * cfg = proc->getCFG();
+	const std::vector<Quad>& quads = proc->getQuads();
+	for (const BasicBlock& block : cfg->getBlocks()){
+		if (block.empty() || block.getId() == cfg->entry()
+			|| block.getPreds().size() != 1){
+			continue;
+		}
+		const BasicBlock& pred = cfg->getBlock(block.getPreds()[0]);
+		if (pred.getId() == block.getId() || pred.empty()){ continue; }
+		const Quad& jump = quads[pred.end() - 1];
+		if (jump.getOp() != GOTO_QUAD
+			|| !endsFlow(quads[block.end() - 1])){
+			continue;
+		}
+		std::vector<Quad> moved(quads.begin() + static_cast<long>(block.first()),
+			quads.begin() + static_cast<long>(block.end()));
+		moved[0].clearLabel();
+		if (jump.hasLabel()){
+			moved[0].setLabel(proc->getProg()->getLabel(jump.getLabel()));
+		}
+		size_t jumpIdx = pred.end() - 1;
+		size_t first = block.first();
+		size_t end = block.end();
+		std::vector<Quad>& edited = proc->editQuads();
+		std::vector<Quad> res;
+		res.reserve(edited.size() + moved.size());
+		for (size_t i = 0; i < edited.size(); i++){
+			if (i >= first && i < end){ continue; }
+			if (i == jumpIdx){
+				res.insert(res.end(), moved.begin(), moved.end());
+				continue;
+			}
+			res.push_back(edited[i]);
+		}
+		edited.swap(res);
+		return true;
+	}
+	return false;
+}
+
+void simplifyJumps(Procedure * proc, OptStats& stats){
+	while (true){
+		size_t nops = dropNops(proc);
+		dropUnusedLabels(proc);
+		size_t threaded = threadJumps(proc);
+		size_t removed = dropNextJumps(proc);
+		size_t merged = mergeBlock(proc) ? 1 : 0;
+		size_t unreachable = removeUnreachable(proc);
+		stats.add("jumps.nops-removed", nops);
+		stats.add("jumps.jumps-threaded", threaded);
+		stats.add("jumps.jumps-removed", removed);
+		stats.add("jumps.blocks-merged", merged);
+		stats.add("unreachable.quads-removed", unreachable);
+		if (nops + threaded + removed + merged + unreachable == 0){ break; }
+	}
+}
+
+}
@@ -0,0 +1,164 @@
+#include "opt.hpp"
+#include "cfg.hpp"
+#include "dominators.hpp"
+#include "loops.hpp"
+
+namespace drewno_mars{
+
+//Give one loop without a preheader a fresh block in front of its
+// header that every entry from outside the loop goes through
+static void addPreheader(Procedure * proc, const ControlFlowGraph * cfg,
+	const Loop& loop){
+	std::vector<Quad>& quads = proc->editQuads();
+	IRProgram * prog = proc->getProg();
+	const BasicBlock& header = cfg->getBlock(loop.header);
+	size_t headerIdx = header.first();
+	if (!quads[headerIdx].hasLabel()){
+		quads[headerIdx].setLabel(proc->makeLabel());
+	}
+	LabelId headerLabel = quads[headerIdx].getLabel();
+	Label * pre = proc->makeLabel();
+
+	//Jumps from outside now go to the preheader; a fallthrough
+	// from inside the loop has to jump over it
+	bool jumpOver = false;
+	for (BlockId pred : header.getPreds()){
+		const BasicBlock& pb = cfg->getBlock(pred);
+		Quad& last = quads[pb.end() - 1];
+		bool branches = last.getOp() == GOTO_QUAD || last.getOp() == IFZ_QUAD;
+		if (loop.contains(pred)){
+			if (pb.end() == headerIdx && last.getOp() != GOTO_QUAD){
+				jumpOver = true;
+			}
+		} else if (branches && last.getTarget() == headerLabel){
+			last.setTarget(pre);
+		}
+	}
+
+	Quad nop = Quad::nop();
+	nop.setLabel(pre);
+	std::vector<Quad> inserted;
+	if (jumpOver){
+		inserted.push_back(Quad::jump(prog->getLabel(headerLabel)));
+	}
+	inserted.push_back(nop);
+	quads.insert(quads.begin() + static_cast<long>(headerIdx),
+		inserted.begin(), inserted.end());
+}
+
+size_t ensurePreheaders(Procedure * proc){
+	size_t added = 0;
+	while (true){
+		const ControlFlowGraph * cfg = proc->getCFG();
+		DominatorTree dom(cfg);
+		LoopNest loops(cfg, &dom);
+		size_t missing = NO_LOOP;
+		for (size_t i = 0; i < loops.numLoops(); i++){
+			if (loops.getLoop(i).preheader == NO_BLOCK){
+				missing = i;
+				break;
+			}
+		}
+		if (missing == NO_LOOP){ break; }
+		addPreheader(proc, cfg, loops.getLoop(missing));
+		added++;
+	}
+	return added;
+}
+
+//Hoist the invariant quads of one loop to the end of its
+// preheader; returns how many moved
+static size_t hoistLoop(Procedure * proc, size_t loopIdx){
+	std::vector<Quad>& quads = proc->editQuads();
+	const ControlFlowGraph * cfg = proc->getCFG();
+	DominatorTree dom(cfg);
+	LoopNest loops(cfg, &dom);
+	const Loop& loop = loops.getLoop(loopIdx);
+	if (loop.preheader == NO_BLOCK){ return 0; }
+
+	//Which vregs and globals the loop writes. Calls may write
+	// any global.
+	std::vector<bool> definedInLoop(proc->numVRegs(), false);
+	HashMap<uint32_t, bool> globalsWritten;
+	bool calls = false;
+	for (BlockId block : loop.blocks){
+		const BasicBlock& bb = cfg->getBlock(block);
+		for (size_t i = bb.first(); i < bb.end(); i++){
+			Opd dst = quads[i].getDst();
+			if (dst.isVReg()){ definedInLoop[dst.index()] = true; }
+			if (dst.isGlobal()){ globalsWritten[dst.getBits()] = true; }
+			if (quads[i].getOp() == CALL_QUAD){ calls = true; }
+		}
+	}
+	auto invariant = [&](Opd opd){
+		if (opd.isVReg()){ return !definedInLoop[opd.index()]; }
+		if (opd.isGlobal()){
+			return !calls && globalsWritten.count(opd.getBits()) == 0;
+		}
+		return true;
+	};
+
+	//Visiting in reverse postorder sees each definition before
+	// its uses, so one pass finds chains of invariant quads
+	std::vector<Quad> hoisted;
+	IRProgram * prog = proc->getProg();
+	for (BlockId block : cfg->rpo()){
+		if (!loop.contains(block)){ continue; }
+		const BasicBlock& bb = cfg->getBlock(block);
+		for (size_t i = bb.first(); i < bb.end(); i++){
+			Quad& quad = quads[i];
+			if (!quad.getDst().isVReg() || !isPureQuad(proc, quad)){
+				continue;
+			}
+			if (!invariant(quad.getSrc1()) || !invariant(quad.getSrc2())){
+				continue;
+			}
+			Quad moved = quad;
+			moved.clearLabel();
+			hoisted.push_back(moved);
+			definedInLoop[quad.getDst().index()] = false;
+			Quad nop = Quad::nop();
+			if (quad.hasLabel()){
+				nop.setLabel(prog->getLabel(quad.getLabel()));
+			}
+			quad = nop;
+		}
+	}
+	if (hoisted.empty()){ return 0; }
+
+	//Place the hoisted quads ahead of the preheader's branch, if
+	// it ends in one, and after it otherwise
+	const BasicBlock& pre = cfg->getBlock(loop.preheader);
+	size_t at = pre.end();
+	Quad& last = quads[at - 1];
+	if (last.getOp() == GOTO_QUAD || last.getOp() == IFZ_QUAD){
+		at--;
+		if (last.hasLabel()){
+			hoisted[0].setLabel(prog->getLabel(last.getLabel()));
+			last.clearLabel();
+		}
+	}
+	quads.insert(quads.begin() + static_cast<long>(at),
+		hoisted.begin(), hoisted.end());
+	return hoisted.size();
+}
+
+size_t hoistLoopInvariants(Procedure * proc){
+	size_t numLoops;
+	{
+		const ControlFlowGraph * cfg = proc->getCFG();
+		DominatorTree dom(cfg);
+		LoopNest loops(cfg, &dom);
+		numLoops = loops.numLoops();
+	}
+	//Inner loops first, so that what leaves an inner loop can
+	// then leave the loops around it too. Hoisting never changes
+	// the shape of the CFG, so loop numbers stay put.
+	size_t moved = 0;
+	for (size_t i = numLoops; i-- > 0; ){
+		moved += hoistLoop(proc, i);
+	}
+	return moved;
+}
+
+}
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include "loops.hpp"
+
+namespace drewno_mars{
+
+bool Loop::contains(BlockId block) const{
+	return std::binary_search(blocks.begin(), blocks.end(), block);
+}
+
+LoopNest::LoopNest(const ControlFlowGraph * cfgIn, const DominatorTree * dom)
+: cfg(cfgIn){
+	size_t numBlocks = cfg->numBlocks();
+	innermost.assign(numBlocks, NO_LOOP);
+
+	//Find the back edges, grouped by header. Visiting headers
+	// in reverse postorder puts outer loops first.
+	for (BlockId header : cfg->rpo()){
+		Loop loop;
+		for (BlockId pred : cfg->getBlock(header).getPreds()){
+			if (dom->dominates(header, pred)){
+				loop.latches.push_back(pred);
+			}
+		}
+		if (loop.latches.empty()){ continue; }
+		loop.header = header;
+		loop.preheader = NO_BLOCK;
+		loop.parent = NO_LOOP;
+		loop.depth = 1;
+
+		//The body is everything that reaches a latch without
+		// passing through the header
+		std::vector<bool> inLoop(numBlocks, false);
+		std::vector<BlockId> work(loop.latches);
+		inLoop[header] = true;
+		loop.blocks.push_back(header);
+		while (!work.empty()){
+			BlockId block = work.back();
+			work.pop_back();
+			if (inLoop[block]){ continue; }
+			inLoop[block] = true;
+			loop.blocks.push_back(block);
+			for (BlockId pred : cfg->getBlock(block).getPreds()){
+				if (!inLoop[pred] && cfg->reachable(pred)){
+					work.push_back(pred);
+				}
+			}
+		}
+		std::sort(loop.blocks.begin(), loop.blocks.end());
+
+		BlockId outside = NO_BLOCK;
+		size_t numOutside = 0;
+		for (BlockId pred : cfg->getBlock(header).getPreds()){
+			if (!inLoop[pred] && cfg->reachable(pred)){
+				outside = pred;
+				numOutside++;
+			}
+		}
+		if (numOutside == 1
+			&& cfg->getBlock(outside).getSuccs().size() == 1){
+			loop.preheader = outside;
+		}
+		loops.push_back(loop);
+	}
+
+	//An enclosing loop's header comes earlier in reverse
+	// postorder, so the last earlier loop containing this
+	// header is the innermost enclosing one
+	for (size_t i = 0; i < loops.size(); i++){
+		for (size_t j = i; j-- > 0; ){
+			if (loops[j].contains(loops[i].header)){
+				loops[i].parent = j;
+				loops[i].depth = loops[j].depth + 1;
+				break;
+			}
+		}
+		for (BlockId block : loops[i].blocks){
+			innermost[block] = i;
+		}
+	}
+}
+
+size_t LoopNest::loopDepth(BlockId block) const{
+	size_t loop = innermost[block];
+	return loop == NO_LOOP ? 0 : loops[loop].depth;
+}
+
+BlockId LoopNest::headerOf(BlockId block) const{
+	size_t loop = innermost[block];
+	return loop == NO_LOOP ? NO_BLOCK : loops[loop].header;
+}
+
+BlockId LoopNest::preheaderOf(BlockId block) const{
+	size_t loop = innermost[block];
+	return loop == NO_LOOP ? NO_BLOCK : loops[loop].preheader;
+}
+
+std::string LoopNest::toString() const{
+	std::string res = "";
+	for (const Loop& loop : loops){
+		res += "loop B" + std::to_string(loop.header)
+			+ " depth " + std::to_string(loop.depth) + ":";
+		for (BlockId block : loop.blocks){
+			res += " B" + std::to_string(block);
+		}
+		res += "\n";
+	}
+	return res;
+}
+
+}
@@ -0,0 +1,52 @@
+#ifndef DREWNO_MARS_LOOPS_HPP
+#define DREWNO_MARS_LOOPS_HPP
+
+#include <vector>
+#include "dominators.hpp"
+
+namespace drewno_mars{
+
+const size_t NO_LOOP = SIZE_MAX;
+
+//A natural loop: its header dominates every block in the body,
+// and each latch has a back edge to the header. Loops that
+// share a header are merged into one.
+struct Loop{
+	BlockId header;
+	//The header's unique predecessor outside the loop, if that
+	// predecessor has no other successor; NO_BLOCK otherwise
+	BlockId preheader;
+	std::vector<BlockId> latches;
+	//Every block in the loop, nested loops included, in
+	// increasing order
+	std::vector<BlockId> blocks;
+	size_t parent;
+	size_t depth;
+	bool contains(BlockId block) const;
+};
+
+//The loop nesting forest of a CFG. Loops are numbered so that
+// each comes before the loops nested in it.
+class LoopNest{
+public:
+	LoopNest(const ControlFlowGraph * cfg, const DominatorTree * dom);
+	size_t numLoops() const { return loops.size(); }
+	const Loop& getLoop(size_t idx) const { return loops[idx]; }
+	//The innermost loop containing a block, or NO_LOOP
+	size_t loopOf(BlockId block) const { return innermost[block]; }
+	//How many loops contain a block; 0 outside of any loop
+	size_t loopDepth(BlockId block) const;
+	//The header/preheader of the innermost loop containing a
+	// block, or NO_BLOCK
+	BlockId headerOf(BlockId block) const;
+	BlockId preheaderOf(BlockId block) const;
+	std::string toString() const;
+private:
+	const ControlFlowGraph * cfg;
+	std::vector<Loop> loops;
+	std::vector<size_t> innermost;
+};
+
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include "scanner.hpp"
 #include "name_analysis.hpp"
 #include "type_analysis.hpp"
+#include "opt.hpp"
 
 using namespace std;
 using namespace drewno_mars;
@@ -17,6 +18,10 @@ static void usageAndDie(){
 	<< " [-c]: Do type checking\n"
 	<< " [-a <3ACFile>]: Output program as 3-address code\n"
 	<< " [-o <ASMFile>]: Output x64 assembly to <ASMFile>\n"
+	<< " [-O<level>]: Optimize at level 0-3 (default 0)\n"
+	<< " [-stats]: Report optimizer statistics\n"
+	<< " [-fomit-frame-pointer]: Address the frame from %rsp, "
+	<< "freeing %rbp\n"
 	;
 	std::cout << std::flush;
 	std::cerr << std::flush;
@@ -124,23 +129,40 @@ static void write3AC(drewno_mars::IRProgram * prog, const char * outPath){
 }
 
 
-static IRProgram * do3AC(const char * inputPath){
+static IRProgram * do3AC(const char * inputPath, int optLevel,
+	OptStats& stats){
 	drewno_mars::TypeAnalysis * typeAnalysis = doTypeAnalysis(inputPath);
 	if (typeAnalysis == nullptr){ return nullptr; }
 
 	IRProgram * prog = typeAnalysis->ast->to3AC(typeAnalysis);
+	optimize(prog, optLevel, stats);
 	return prog;
 }
 
-static int writeX64(drewno_mars::IRProgram * prog, const char * outPath){
+static int writeX64(drewno_mars::IRProgram * prog, const char * outPath,
+	int optLevel, bool omitFramePointer, OptStats& stats){
 	if (outPath == nullptr){
 		throw new InternalError("Null codegen file given");
 	}
+	drewno_mars::X64Options opts;
+	//Linear scan is quick; graph coloring is worth its time for
+	// the copies it coalesces
+	opts.regAlloc = drewno_mars::NO_REG_ALLOC;
+	if (optLevel >= 3){
+		opts.regAlloc = drewno_mars::GRAPH_COLOR_ALLOC;
+	} else if (optLevel >= 1){
+		opts.regAlloc = drewno_mars::LINEAR_SCAN_ALLOC;
+	}
+	opts.shareSlots = optLevel >= 1;
+	opts.peephole = optLevel >= 1;
+	opts.omitFramePointer = omitFramePointer;
+	opts.elideLeafFrames = optLevel >= 1;
+	opts.stats = &stats;
 	if (strcmp(outPath, "--") == 0){
-		prog->toX64(std::cout);
+		prog->toX64(std::cout, opts);
 	} else {
 		std::ofstream outStream(outPath);
-		prog->toX64(outStream);
+		prog->toX64(outStream, opts);
 		outStream.close();
 	}
 	return 0;
@@ -165,6 +187,9 @@ main( const int argc, const char **argv )
 	bool checkTypes = false;
 	const char * threeACFile = NULL;
 	const char * asmFile = NULL;
+	int optLevel = 0;
+	bool showStats = false;
+	bool omitFramePointer = false;
 
 	bool useful = false;
 	int i = 1;
@@ -199,6 +224,21 @@ main( const int argc, const char **argv )
 				if (i >= argc){ usageAndDie(); }
 				asmFile = argv[i];
 				useful = true;
+			} else if (argv[i][1] == 'O'){
+				if (argv[i][2] == '\0'){
+					optLevel = 1;
+				} else if (argv[i][2] >= '0' && argv[i][2] <= '3'
+					&& argv[i][3] == '\0'){
+					optLevel = argv[i][2] - '0';
+				} else {
+					std::cerr << "Bad optimization level: ";
+					std::cerr << argv[i] << std::endl;
+					usageAndDie();
+				}
+			} else if (strcmp(argv[i], "-stats") == 0){
+				showStats = true;
+			} else if (strcmp(argv[i], "-fomit-frame-pointer") == 0){
+				omitFramePointer = true;
 			} else {
 				std::cerr << "Unrecognized argument: ";
 				std::cerr << argv[i] << std::endl;
@@ -222,6 +262,7 @@ main( const int argc, const char **argv )
 		usageAndDie();
 	}
 
+	OptStats stats;
 	try {
 		if (tokensFile != nullptr){
 			writeTokenStream(inFile, tokensFile);
@@ -251,15 +292,17 @@ main( const int argc, const char **argv )
 				return 1;
 			}
 		}
-		if (threeACFile != nullptr){
-			auto prog = do3AC(inFile);
-			if (prog == nullptr){ return 1; }
-			write3AC(prog, threeACFile);
-		}
-		if (asmFile != nullptr){
-			auto prog = do3AC(inFile);
+		if (threeACFile != nullptr || asmFile != nullptr){
+			//Lower and optimize once for both outputs, so the
+			// statistics count each pass once
+			auto prog = do3AC(inFile, optLevel, stats);
 			if (prog == nullptr){ return 1; }
-			writeX64(prog, asmFile);
+			if (threeACFile != nullptr){
+				write3AC(prog, threeACFile);
+			}
+			if (asmFile != nullptr){
+				writeX64(prog, asmFile, optLevel, omitFramePointer, stats);
+			}
 		}
 	} catch (drewno_mars::ToDoError * e){
 		std::cerr << "ToDoError: " << e->msg() << std::endl;
@@ -268,5 +311,8 @@ main( const int argc, const char **argv )
 		std::cerr << "InternalError: " << e->msg() << std::endl;
 		return 1;
 	}
+	if (showStats){
+		stats.report(std::cerr);
+	}
 	return 0;
 }
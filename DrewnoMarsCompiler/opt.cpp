@@ -0,0 +1,282 @@
+#include "opt.hpp"
+#include "cfg.hpp"
+#include "ssa.hpp"
+
+namespace drewno_mars{
+
+void OptStats::add(const std::string& name, size_t count){
+	counts[name] += count;
+}
+
+size_t OptStats::get(const std::string& name) const{
+	auto found = counts.find(name);
+	return found == counts.end() ? 0 : found->second;
+}
+
+void OptStats::report(std::ostream& out) const{
+	for (auto entry : counts){
+		out << entry.second << "\t" << entry.first << "\n";
+	}
+}
+
+//Byte ops only keep their low 8 bits, sign extended
+static int64_t truncate(BinOp op, int64_t val){
+	if (op < ADD8){ return val; }
+	return static_cast<int8_t>(val & 0xff);
+}
+
+bool foldBinOp(BinOp op, int64_t lhs, int64_t rhs, int64_t& res){
+	//Wrap the way the hardware does rather than overflowing
+	uint64_t ul = static_cast<uint64_t>(lhs);
+	uint64_t ur = static_cast<uint64_t>(rhs);
+	switch (op){
+	case ADD64: case ADD8:
+		res = static_cast<int64_t>(ul + ur); break;
+	case SUB64: case SUB8:
+		res = static_cast<int64_t>(ul - ur); break;
+	case MULT64: case MULT8:
+		res = static_cast<int64_t>(ul * ur); break;
+	case DIV64: case DIV8:
+		if (rhs == 0 || (lhs == INT64_MIN && rhs == -1)){ return false; }
+		res = lhs / rhs; break;
+	case AND64: case AND8:
+		res = lhs & rhs; break;
+	case OR64: case OR8:
+		res = lhs | rhs; break;
+	case EQ64: case EQ8: res = lhs == rhs; break;
+	case NEQ64: case NEQ8: res = lhs != rhs; break;
+	case LT64: case LT8: res = lhs < rhs; break;
+	case GT64: case GT8: res = lhs > rhs; break;
+	case LTE64: case LTE8: res = lhs <= rhs; break;
+	case GTE64: case GTE8: res = lhs >= rhs; break;
+	}
+	res = truncate(op, res);
+	return true;
+}
+
+int64_t foldUnaryOp(UnaryOp op, int64_t val){
+	switch (op){
+	case NEG64:
+		return static_cast<int64_t>(0 - static_cast<uint64_t>(val));
+	case NEG8:
+		return static_cast<int8_t>((0 - static_cast<uint64_t>(val)) & 0xff);
+	case NOT64:
+	case NOT8:
+		return val == 0;
+	}
+	throw new InternalError("No such unary op");
+}
+
+bool isCompare(BinOp op){
+	switch (op){
+	case EQ64: case NEQ64: case LT64: case GT64: case LTE64: case GTE64:
+	case EQ8: case NEQ8: case LT8: case GT8: case LTE8: case GTE8:
+		return true;
+	default:
+		return false;
+	}
+}
+
+BinOp swapCompare(BinOp op){
+	switch (op){
+	case LT64: return GT64;
+	case GT64: return LT64;
+	case LTE64: return GTE64;
+	case GTE64: return LTE64;
+	case LT8: return GT8;
+	case GT8: return LT8;
+	case LTE8: return GTE8;
+	case GTE8: return LTE8;
+	default: return op;
+	}
+}
+
+BinOp negateCompare(BinOp op){
+	switch (op){
+	case EQ64: return NEQ64;
+	case NEQ64: return EQ64;
+	case LT64: return GTE64;
+	case GT64: return LTE64;
+	case LTE64: return GT64;
+	case GTE64: return LT64;
+	case EQ8: return NEQ8;
+	case NEQ8: return EQ8;
+	case LT8: return GTE8;
+	case GT8: return LTE8;
+	case LTE8: return GT8;
+	case GTE8: return LT8;
+	default: return op;
+	}
+}
+
+bool constValue(const Procedure * proc, Opd opd, int64_t& val){
+	if (!opd.isConst()){ return false; }
+	const ConstInfo& info = proc->getProg()->getConst(opd);
+	if (info.kind != INT_CONST){ return false; }
+	val = info.value;
+	return true;
+}
+
+bool isPureQuad(const Procedure * proc, const Quad& quad){
+	switch (quad.getOp()){
+	case UNARYOP_QUAD:
+	case ASSIGN_QUAD:
+		return true;
+	case BINOP_QUAD: {
+		BinOp op = quad.getBinOp();
+		if (op != DIV64 && op != DIV8){ return true; }
+		int64_t divisor;
+		return constValue(proc, quad.getSrc2(), divisor)
+			&& divisor != 0 && divisor != -1;
+	}
+	default:
+		return false;
+	}
+}
+
+void eraseQuads(Procedure * proc, const std::vector<bool>& dead){
+	std::vector<Quad>& quads = proc->editQuads();
+	IRProgram * prog = proc->getProg();
+	LabelId pending = NO_LABEL;
+	std::vector<Quad> res;
+	res.reserve(quads.size());
+	for (size_t i = 0; i < quads.size(); i++){
+		Quad quad = quads[i];
+		if (dead[i]){
+			if (!quad.hasLabel()){ continue; }
+			if (pending != NO_LABEL){
+				Quad holder = Quad::nop();
+				holder.setLabel(prog->getLabel(pending));
+				res.push_back(holder);
+			}
+			pending = quad.getLabel();
+			continue;
+		}
+		if (pending != NO_LABEL){
+			if (quad.hasLabel()){
+				Quad holder = Quad::nop();
+				holder.setLabel(prog->getLabel(pending));
+				res.push_back(holder);
+			} else {
+				quad.setLabel(prog->getLabel(pending));
+			}
+			pending = NO_LABEL;
+		}
+		res.push_back(quad);
+	}
+	if (pending != NO_LABEL){
+		Quad holder = Quad::nop();
+		holder.setLabel(prog->getLabel(pending));
+		res.push_back(holder);
+	}
+	quads.swap(res);
+}
+
+size_t foldConstantBranches(Procedure * proc){
+	std::vector<Quad>& quads = proc->editQuads();
+	IRProgram * prog = proc->getProg();
+	std::vector<bool> dead(quads.size(), false);
+	size_t removed = 0;
+	for (size_t i = 0; i < quads.size(); i++){
+		int64_t val;
+		Quad& quad = quads[i];
+		if (quad.getOp() != IFZ_QUAD){ continue; }
+		if (!constValue(proc, quad.getSrc1(), val)){ continue; }
+		if (val == 0){
+			Quad jump = Quad::jump(prog->getLabel(quad.getTarget()));
+			if (quad.hasLabel()){
+				jump.setLabel(prog->getLabel(quad.getLabel()));
+			}
+			quad = jump;
+		} else {
+			dead[i] = true;
+			removed++;
+		}
+	}
+	if (removed > 0){ eraseQuads(proc, dead); }
+	return removed;
+}
+
+size_t removeUnreachable(Procedure * proc){
+	const ControlFlowGraph * cfg = proc->getCFG();
+	std::vector<bool> dead(proc->getQuads().size(), false);
+	size_t removed = 0;
+	for (const BasicBlock& block : cfg->getBlocks()){
+		if (cfg->reachable(block.getId())){ continue; }
+		for (size_t i = block.first(); i < block.end(); i++){
+			dead[i] = true;
+			removed++;
+		}
+	}
+	if (removed > 0){ eraseQuads(proc, dead); }
+	return removed;
+}
+
+size_t removeNops(Procedure * proc){
+	const std::vector<Quad>& quads = proc->getQuads();
+	std::vector<bool> dead(quads.size(), false);
+	size_t removed = 0;
+	for (size_t i = 0; i < quads.size(); i++){
+		if (quads[i].getOp() == NOP_QUAD && !quads[i].hasLabel()){
+			dead[i] = true;
+			removed++;
+		}
+	}
+	if (removed > 0){ eraseQuads(proc, dead); }
+	return removed;
+}
+
+static void optimizeProc(Procedure * proc, int level, OptStats& stats){
+	//Code after a return is never reached
+	stats.add("unreachable.quads-removed", removeUnreachable(proc));
+	stats.add("tailcall.self-calls-looped", loopSelfTailCalls(proc));
+	stats.add("rotate.loops-rotated", rotateLoops(proc));
+
+	stats.add("licm.preheaders-added", ensurePreheaders(proc));
+	toSSA(proc);
+	size_t folded = runSCCP(proc);
+	stats.add("gvn.redundant-removed", numberValues(proc));
+	stats.add("licm.quads-hoisted", hoistLoopInvariants(proc));
+	stats.add("copyprop.copies-removed", propagateCopies(proc));
+	reduceInductionVars(proc, stats);
+	fromSSA(proc);
+
+	size_t removed = folded;
+	removed += foldConstantBranches(proc);
+	removed += removeUnreachable(proc);
+	stats.add("sccp.quads-removed", removed);
+
+	stats.add("dce.quads-removed", removeDeadCode(proc));
+	stats.add("coalesce.copies-removed", coalesceCopies(proc));
+	simplifyJumps(proc, stats);
+
+	//Copies of a loop body can fold against each other, so the
+	// cleanup runs again over them
+	if (unrollLoops(proc, level, stats) > 0){
+		toSSA(proc);
+		removed = runSCCP(proc);
+		stats.add("copyprop.copies-removed", propagateCopies(proc));
+		fromSSA(proc);
+		removed += foldConstantBranches(proc);
+		removed += removeUnreachable(proc);
+		stats.add("sccp.quads-removed", removed);
+		stats.add("dce.quads-removed", removeDeadCode(proc));
+		stats.add("coalesce.copies-removed", coalesceCopies(proc));
+		simplifyJumps(proc, stats);
+	}
+	stats.add("tailcall.calls-marked", markTailCalls(proc));
+	stats.add("vregs-dropped", proc->compactVRegs());
+}
+
+void optimize(IRProgram * prog, int level, OptStats& stats){
+	if (level < 1){ return; }
+	//Callees are optimized first, so that what gets inlined has
+	// already been cleaned up
+	CallOrder order = orderCalls(prog);
+	for (Procedure * proc : order.procs){
+		stats.add("inline.calls-inlined", inlineCalls(proc, order, level));
+		optimizeProc(proc, level, stats);
+	}
+}
+
+}
@@ -0,0 +1,131 @@
+#ifndef DREWNO_MARS_OPT_HPP
+#define DREWNO_MARS_OPT_HPP
+
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+#include "3ac.hpp"
+
+namespace drewno_mars{
+
+//Named counters bumped by the optimizer (and later stages),
+// printed by -stats
+class OptStats{
+public:
+	void add(const std::string& name, size_t count);
+	size_t get(const std::string& name) const;
+	void report(std::ostream& out) const;
+private:
+	std::map<std::string, size_t> counts;
+};
+
+//Run the 3AC optimizations enabled at level (0-3) over every
+// procedure in the program
+void optimize(IRProgram * prog, int level, OptStats& stats);
+
+//Evaluate an operator on constants the same way the generated
+// code would. foldBinOp fails on division that would trap.
+bool foldBinOp(BinOp op, int64_t lhs, int64_t rhs, int64_t& res);
+int64_t foldUnaryOp(UnaryOp op, int64_t val);
+//Whether op is one of the 64- or 8-bit comparisons
+bool isCompare(BinOp op);
+//The comparison with its operands swapped, and the one that
+// holds exactly when op does not; any other op comes back
+// unchanged
+BinOp swapCompare(BinOp op);
+BinOp negateCompare(BinOp op);
+//The integer value of an operand, if it is a constant
+bool constValue(const Procedure * proc, Opd opd, int64_t& val);
+//Whether a quad is an op or copy that computes its result from
+// its operands alone, without trapping. Division by anything but
+// a nonzero constant other than -1 may trap.
+bool isPureQuad(const Procedure * proc, const Quad& quad);
+
+//Delete the marked quads from a procedure body. A label on a
+// deleted quad moves down to the next surviving quad, or onto a
+// nop if that one is already labeled.
+void eraseQuads(Procedure * proc, const std::vector<bool>& dead);
+
+//Constant propagation over a procedure in SSA form. Constant
+// definitions become nops and their uses are replaced by the
+// constant; returns how many definitions were folded.
+size_t runSCCP(Procedure * proc);
+
+//Global value numbering over a procedure in SSA form: a binop
+// or unary op already computed in a dominating quad becomes a
+// copy of that result. Returns how many were replaced.
+size_t numberValues(Procedure * proc);
+//Turn while loops, tested at the top and closed by a goto, into
+// a test guarding a loop tested at the bottom. Returns how many
+// were rotated.
+size_t rotateLoops(Procedure * proc);
+//Unroll loops of a single block that count toward a fixed
+// bound: fully where the trip count is known and small, and from
+// -O2 on by 2, 4 or 8 ahead of the original loop, which is kept
+// for the remaining iterations. The size allowed grows with the
+// level. Bumps the unroll.* counters and returns how many loops
+// were unrolled.
+size_t unrollLoops(Procedure * proc, int level, OptStats& stats);
+//Give every loop a preheader: a block outside the loop whose
+// only successor is the header and through which every entry to
+// the loop passes. Returns how many were added.
+size_t ensurePreheaders(Procedure * proc);
+//Move loop-invariant quads of an SSA procedure out to their
+// loop's preheader. Returns how many were moved.
+size_t hoistLoopInvariants(Procedure * proc);
+//Strength-reduce induction variables in the loops of an SSA
+// procedure: products of an IV and an invariant become IVs of
+// their own, bumped by addition. Exit tests on an IV that is only
+// compared move to a reduced one, and IVs nothing reads anymore
+// are dropped. Bumps the ivopt.* counters.
+void reduceInductionVars(Procedure * proc, OptStats& stats);
+//Copy propagation over a procedure in SSA form: uses of a vreg
+// copied from another vreg read the original instead, and the
+// copy becomes a nop. Returns how many copies went away.
+size_t propagateCopies(Procedure * proc);
+//Merge the two sides of vreg-to-vreg copies wherever their live
+// ranges do not overlap, deleting the copies. The procedure must
+// not be in SSA form.
+size_t coalesceCopies(Procedure * proc);
+
+//The procedures of a program with callees ahead of their callers
+// wherever recursion allows, and which of them are recursive
+struct CallOrder{
+	std::vector<Procedure *> procs;
+	std::set<const Procedure *> recursive;
+};
+CallOrder orderCalls(IRProgram * prog);
+//Replace calls to small non-recursive procedures with a copy of
+// their body. The size allowed grows with the level and with the
+// loops around the call. Returns how many calls were inlined.
+size_t inlineCalls(Procedure * proc, const CallOrder& order, int level);
+
+//Turn calls a procedure makes to itself in tail position into
+// jumps back to the top of its body, past the getargs, with the
+// formals reassigned. Returns how many calls became jumps.
+size_t loopSelfTailCalls(Procedure * proc);
+//Turn the remaining calls in tail position into tail calls,
+// which reuse the caller's return address. Returns how many.
+size_t markTailCalls(Procedure * proc);
+
+//Turn ifz quads on constant conditions into gotos (or drop them)
+size_t foldConstantBranches(Procedure * proc);
+//Drop blocks unreachable from the procedure entry
+size_t removeUnreachable(Procedure * proc);
+//Drop unlabeled nops
+size_t removeNops(Procedure * proc);
+//Clean up the branches of a procedure: nops go away with their
+// labels moved onto real quads, jumps to jumps go straight to the
+// final target, jumps to the next quad are dropped, and blocks
+// reached by a single goto move up in its place. Bumps the
+// jumps.* counters.
+void simplifyJumps(Procedure * proc, OptStats& stats);
+//Drop side-effect-free quads whose results are never read. The
+// procedure must not be in SSA form.
+size_t removeDeadCode(Procedure * proc);
+
+}
+
+#endif
@@ -0,0 +1,242 @@
+#include "peephole.hpp"
+
+namespace drewno_mars{
+
+AsmArg AsmArg::makeReg(Register reg, size_t width){
+	AsmArg arg = { REG_ARG, reg, width, Opd::reg(reg, width) };
+	return arg;
+}
+
+AsmArg AsmArg::makeImm(int64_t val){
+	return makeImm(std::to_string(val));
+}
+
+AsmArg AsmArg::makeImm(const std::string& val){
+	AsmArg arg = { IMM_ARG, A, 0, "$" + val };
+	return arg;
+}
+
+AsmArg AsmArg::makeMem(const std::string& loc){
+	AsmArg arg = { MEM_ARG, A, 0, loc };
+	return arg;
+}
+
+AsmArg AsmArg::makeLabel(const std::string& name){
+	AsmArg arg = { LABEL_ARG, A, 0, name };
+	return arg;
+}
+
+bool operator==(const AsmArg& a, const AsmArg& b){
+	return a.kind == b.kind && a.text == b.text;
+}
+
+bool operator!=(const AsmArg& a, const AsmArg& b){
+	return !(a == b);
+}
+
+void AsmList::label(const std::string& name){
+	//Two labels in a row each get a line
+	if (!pendingLabel.empty()){ add(AsmLine()); }
+	pendingLabel = name;
+}
+
+void AsmList::comment(const std::string& text){
+	AsmLine line;
+	line.comment = text;
+	add(line);
+}
+
+void AsmList::instr(const std::string& op, const std::vector<AsmArg>& args){
+	AsmLine line;
+	line.op = op;
+	line.args = args;
+	add(line);
+}
+
+void AsmList::add(AsmLine line){
+	line.label = pendingLabel;
+	pendingLabel.clear();
+	myLines.push_back(line);
+}
+
+std::vector<AsmLine>& AsmList::lines(){
+	if (!pendingLabel.empty()){ add(AsmLine()); }
+	return myLines;
+}
+
+void writeAsm(std::ostream& out, const std::vector<AsmLine>& lines){
+	for (const AsmLine& line : lines){
+		if (!line.label.empty()){ out << line.label << ": "; }
+		out << line.op;
+		for (size_t i = 0; i < line.args.size(); i++){
+			out << (i == 0 ? " " : ", ") << line.args[i].text;
+		}
+		out << line.comment << "\n";
+	}
+}
+
+static bool isInstr(const AsmLine& line, const std::string& op,
+	size_t numArgs){
+	return line.op == op && line.args.size() == numArgs;
+}
+
+//The next instruction after i that control can only reach from
+// i, skipping comments; SIZE_MAX at a label or the end
+static size_t nextInstr(const std::vector<AsmLine>& lines, size_t i){
+	for (size_t j = i + 1; j < lines.size(); j++){
+		if (!lines[j].label.empty()){ return SIZE_MAX; }
+		if (!lines[j].op.empty()){ return j; }
+	}
+	return SIZE_MAX;
+}
+
+//Drop the instruction on a line, keeping any label
+static void dropInstr(AsmLine& line){
+	line.op.clear();
+	line.args.clear();
+}
+
+//movq %r, M followed by movq M, %s: the reload becomes a register
+// move, or goes entirely when s is r
+static bool storeReload(std::vector<AsmLine>& lines, size_t i){
+	const AsmLine& store = lines[i];
+	if (!isInstr(store, "movq", 2) || store.args[0].kind != REG_ARG
+		|| store.args[1].kind != MEM_ARG){
+		return false;
+	}
+	size_t j = nextInstr(lines, i);
+	if (j == SIZE_MAX || !isInstr(lines[j], "movq", 2)
+		|| lines[j].args[0] != store.args[1]
+		|| lines[j].args[1].kind != REG_ARG){
+		return false;
+	}
+	if (lines[j].args[1] == store.args[0]){
+		dropInstr(lines[j]);
+	} else {
+		lines[j].args[0] = store.args[0];
+	}
+	return true;
+}
+
+//movq %r, %r does nothing
+static bool selfMove(std::vector<AsmLine>& lines, size_t i){
+	AsmLine& move = lines[i];
+	if (!isInstr(move, "movq", 2) || move.args[0].kind != REG_ARG
+		|| move.args[0] != move.args[1]){
+		return false;
+	}
+	dropInstr(move);
+	return true;
+}
+
+//A jmp to a label that comes before the next instruction
+static bool jumpToNext(std::vector<AsmLine>& lines, size_t i){
+	if (!isInstr(lines[i], "jmp", 1) || lines[i].args[0].kind != LABEL_ARG){
+		return false;
+	}
+	for (size_t j = i + 1; j < lines.size(); j++){
+		if (lines[j].label == lines[i].args[0].text){
+			dropInstr(lines[i]);
+			return true;
+		}
+		if (!lines[j].op.empty()){ return false; }
+	}
+	return false;
+}
+
+//The condition code a setcc or jcc tests, and its opposite
+static std::string invertCond(const std::string& cc){
+	static const char * pairs[][2] = {
+		{"e", "ne"}, {"l", "ge"}, {"g", "le"}
+	};
+	for (auto pair : pairs){
+		if (cc == pair[0]){ return pair[1]; }
+		if (cc == pair[1]){ return pair[0]; }
+	}
+	return "";
+}
+
+//setCC %al; movzbq %al, %rax, perhaps copied somewhere, then
+// tested against zero for a je or jne: the flags of the setcc
+// still hold, so jump on them directly
+static bool testAfterSetcc(std::vector<AsmLine>& lines, size_t i){
+	const AsmLine& set = lines[i];
+	if (set.op.size() < 4 || set.op.compare(0, 3, "set") != 0
+		|| set.args.size() != 1 || !set.args[0].isReg(A, 1)){
+		return false;
+	}
+	std::string cc = set.op.substr(3);
+	if (invertCond(cc).empty()){ return false; }
+	size_t j = nextInstr(lines, i);
+	if (j == SIZE_MAX || !isInstr(lines[j], "movzbq", 2)
+		|| !lines[j].args[0].isReg(A, 1) || !lines[j].args[1].isReg(A, 8)){
+		return false;
+	}
+	AsmArg rax = AsmArg::makeReg(A, 8);
+	AsmArg copy = rax;
+	size_t k = nextInstr(lines, j);
+	if (k != SIZE_MAX && isInstr(lines[k], "movq", 2)
+		&& lines[k].args[0] == rax){
+		copy = lines[k].args[1];
+		j = k;
+		k = nextInstr(lines, k);
+	}
+	if (k == SIZE_MAX){ return false; }
+	const AsmLine& test = lines[k];
+	bool tests = (isInstr(test, "testq", 2) && test.args[0] == test.args[1]
+		&& (test.args[0] == rax || test.args[0] == copy))
+		|| (isInstr(test, "cmpq", 2) && test.args[0] == AsmArg::makeImm(0)
+		&& (test.args[1] == rax || test.args[1] == copy));
+	size_t b = nextInstr(lines, k);
+	if (!tests || b == SIZE_MAX || lines[b].args.size() != 1
+		|| (lines[b].op != "je" && lines[b].op != "jne")){
+		return false;
+	}
+	//je jumps when the value is zero, so when CC failed
+	lines[b].op = "j" + (lines[b].op == "je" ? invertCond(cc) : cc);
+	dropInstr(lines[k]);
+	return true;
+}
+
+struct PeepholeRule{
+	const char * name;
+	bool (*apply)(std::vector<AsmLine>& lines, size_t i);
+};
+
+static const PeepholeRule rules[] = {
+	{"store-reload", storeReload},
+	{"self-move", selfMove},
+	{"jump-to-next", jumpToNext},
+	{"test-after-setcc", testAfterSetcc},
+};
+
+void peephole(std::vector<AsmLine>& lines, OptStats * stats){
+	std::vector<size_t> hits(sizeof(rules) / sizeof(rules[0]), 0);
+	bool changed = true;
+	while (changed){
+		changed = false;
+		for (size_t i = 0; i < lines.size(); i++){
+			if (lines[i].op.empty()){ continue; }
+			for (size_t r = 0; r < hits.size(); r++){
+				if (rules[r].apply(lines, i)){
+					hits[r]++;
+					changed = true;
+					if (lines[i].op.empty()){ break; }
+				}
+			}
+		}
+	}
+	std::vector<AsmLine> kept;
+	for (const AsmLine& line : lines){
+		if (!line.label.empty() || !line.op.empty() || !line.comment.empty()){
+			kept.push_back(line);
+		}
+	}
+	lines.swap(kept);
+	if (stats == nullptr){ return; }
+	for (size_t r = 0; r < hits.size(); r++){
+		stats->add(std::string("peephole.") + rules[r].name, hits[r]);
+	}
+}
+
+}
@@ -0,0 +1,72 @@
+#ifndef DREWNO_MARS_PEEPHOLE_HPP
+#define DREWNO_MARS_PEEPHOLE_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "opt.hpp"
+
+namespace drewno_mars{
+
+//What an instruction operand names. Codegen says which when it
+// builds the operand, so nothing downstream has to guess it from
+// the text.
+enum AsmArgKind{ REG_ARG, IMM_ARG, MEM_ARG, LABEL_ARG };
+
+struct AsmArg{
+	AsmArgKind kind;
+	//The register and width of a REG_ARG
+	Register reg;
+	size_t width;
+	//How the operand is written out
+	std::string text;
+
+	static AsmArg makeReg(Register reg, size_t width);
+	static AsmArg makeImm(int64_t val);
+	//An immediate given as text, such as the address of a string
+	static AsmArg makeImm(const std::string& val);
+	static AsmArg makeMem(const std::string& loc);
+	static AsmArg makeLabel(const std::string& name);
+	bool isReg(Register r, size_t w) const {
+		return kind == REG_ARG && reg == r && width == w;
+	}
+};
+
+bool operator==(const AsmArg& a, const AsmArg& b);
+bool operator!=(const AsmArg& a, const AsmArg& b);
+
+//One line of x64 assembly: an optional label, then either an
+// instruction with its operands or a comment (or neither)
+struct AsmLine{
+	std::string label;
+	std::string op;
+	std::vector<AsmArg> args;
+	std::string comment;
+};
+
+//The lines codegen emits for one procedure, in order
+class AsmList{
+public:
+	//Put a label on the next line added
+	void label(const std::string& name);
+	void comment(const std::string& text);
+	void instr(const std::string& op, const std::vector<AsmArg>& args = {});
+	std::vector<AsmLine>& lines();
+private:
+	void add(AsmLine line);
+
+	std::vector<AsmLine> myLines;
+	std::string pendingLabel;
+};
+
+//Print lines as assembler source
+void writeAsm(std::ostream& out, const std::vector<AsmLine>& lines);
+
+//Rewrite redundant instruction sequences in lines until none of
+// the rules apply. Bumps a peephole.<rule> counter per rewrite if
+// stats is given.
+void peephole(std::vector<AsmLine>& lines, OptStats * stats);
+
+}
+
+#endif
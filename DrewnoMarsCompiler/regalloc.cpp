@@ -0,0 +1,763 @@
+#include <algorithm>
+#include <set>
+#include "regalloc.hpp"
+#include "opt.hpp"
+#include "cfg.hpp"
+#include "dataflow.hpp"
+#include "dominators.hpp"
+#include "loops.hpp"
+
+namespace drewno_mars{
+
+//The registers handed out, caller-saved ones first since they
+// cost nothing to use where no call intervenes; %rbp too when it
+// is not the frame pointer
+static std::vector<Register> allocatable(const X64Options& opts){
+	std::vector<Register> regs = {
+		C, SI, DI, R8, R9, R10, B, R12, R13, R14, R15
+	};
+	if (opts.omitFramePointer){ regs.push_back(BP); }
+	return regs;
+}
+static const Register callerSaved[] = {
+	A, C, D, SI, DI, R8, R9, R10, R11
+};
+
+//Each quad i spans four positions: its operands are read at
+// 4i + 1, registers it clobbers are lost at 4i + 2 and its
+// result is written at 4i + 3. A value read by a quad and not
+// after can share a register with the quad's result, or with
+// whatever the quad clobbers.
+static size_t usePos(size_t i){ return 4 * i + 1; }
+static size_t clobberPos(size_t i){ return 4 * i + 2; }
+static size_t defPos(size_t i){ return 4 * i + 3; }
+
+//The positions over which a vreg holds a value; holes in the
+// middle are not tracked
+struct LiveInterval{
+	Opd vreg;
+	size_t start;
+	size_t end;
+	size_t cost;
+};
+
+//A stretch over which codegen needs a register for itself
+struct FixedRange{
+	Register reg;
+	size_t start;
+	size_t end;
+};
+
+//How much each read or write of a vreg counts toward keeping it
+// in a register, by loop depth
+static size_t useWeight(size_t depth){
+	size_t weight = 1;
+	for (size_t d = 0; d < std::min(depth, static_cast<size_t>(5)); d++){
+		weight *= 10;
+	}
+	return weight;
+}
+
+bool makesCall(const Quad& quad){
+	switch (quad.getOp()){
+	case CALL_QUAD:
+	case TAILCALL_QUAD:
+	case WRITE_QUAD:
+	case READ_QUAD:
+	case MAGIC_QUAD:
+	case EXIT_QUAD:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static std::vector<LiveInterval> buildIntervals(Procedure * proc){
+	Liveness live(proc);
+	const ControlFlowGraph * cfg = live.getCFG();
+	DominatorTree dom(cfg);
+	LoopNest loops(cfg, &dom);
+	const std::vector<Quad>& quads = proc->getQuads();
+
+	std::vector<LiveInterval> intervals(proc->numVRegs());
+	for (size_t v = 0; v < intervals.size(); v++){
+		intervals[v].vreg = Opd::vreg(static_cast<uint32_t>(v));
+		intervals[v].start = SIZE_MAX;
+		intervals[v].end = 0;
+		intervals[v].cost = 0;
+	}
+	auto cover = [&](size_t v, size_t pos){
+		intervals[v].start = std::min(intervals[v].start, pos);
+		intervals[v].end = std::max(intervals[v].end, pos);
+	};
+	for (const BasicBlock& block : cfg->getBlocks()){
+		if (block.empty()){ continue; }
+		size_t weight = useWeight(loops.loopDepth(block.getId()));
+		live.liveIn(block.getId()).forEach([&](size_t v){
+			cover(v, 4 * block.first());
+		});
+		live.liveOut(block.getId()).forEach([&](size_t v){
+			cover(v, 4 * block.end() - 1);
+		});
+		for (size_t i = block.first(); i < block.end(); i++){
+			const Quad& quad = quads[i];
+			for (Opd src : {quad.getSrc1(), quad.getSrc2()}){
+				if (!src.isVReg()){ continue; }
+				cover(src.index(), usePos(i));
+				intervals[src.index()].cost += weight;
+			}
+			Opd dst = quad.getDst();
+			if (dst.isVReg()){
+				cover(dst.index(), defPos(i));
+				intervals[dst.index()].cost += weight;
+			}
+		}
+	}
+
+	std::vector<LiveInterval> res;
+	for (const LiveInterval& interval : intervals){
+		if (interval.start != SIZE_MAX){ res.push_back(interval); }
+	}
+	std::sort(res.begin(), res.end(),
+		[](const LiveInterval& a, const LiveInterval& b){
+			return a.start < b.start;
+		});
+	return res;
+}
+
+//The registers codegen itself writes: argument registers from
+// each setarg up to the call, those carrying our own arguments
+// until their getarg, and caller-saved ones at every call
+static std::vector<FixedRange> fixedRanges(const Procedure * proc){
+	const std::vector<Quad>& quads = proc->getQuads();
+	std::vector<FixedRange> fixed;
+	for (size_t i = 0; i < quads.size(); i++){
+		const Quad& quad = quads[i];
+		if (makesCall(quad)){
+			for (Register reg : callerSaved){
+				fixed.push_back({reg, clobberPos(i), clobberPos(i)});
+			}
+		}
+		if (quad.getOp() == SETARG_QUAD && quad.getIndex() <= 6){
+			size_t call = i;
+			while (call < quads.size() && quads[call].getOp() != CALL_QUAD
+				&& quads[call].getOp() != TAILCALL_QUAD){
+				call++;
+			}
+			fixed.push_back({RegUtils::argReg(quad.getIndex()),
+				clobberPos(i), clobberPos(call)});
+		}
+		if (quad.getOp() == GETARG_QUAD && quad.getIndex() <= 6){
+			fixed.push_back({RegUtils::argReg(quad.getIndex()), 0, usePos(i)});
+		}
+	}
+	return fixed;
+}
+
+static bool isFree(const std::vector<FixedRange>& fixed, Register reg,
+	const LiveInterval& interval){
+	for (const FixedRange& range : fixed){
+		if (range.reg == reg && range.start <= interval.end
+			&& interval.start <= range.end){
+			return false;
+		}
+	}
+	return true;
+}
+
+void linearScan(Procedure * proc, const X64Options& opts){
+	std::vector<Register> regs = allocatable(opts);
+	std::vector<LiveInterval> intervals = buildIntervals(proc);
+	std::vector<FixedRange> fixed = fixedRanges(proc);
+
+	//The intervals holding a register, by increasing end
+	std::vector<LiveInterval> active;
+	size_t allocated = 0;
+	size_t spilled = 0;
+	for (const LiveInterval& cur : intervals){
+		while (!active.empty() && active.front().end < cur.start){
+			active.erase(active.begin());
+		}
+		auto taken = [&](Register reg){
+			for (const LiveInterval& other : active){
+				if (proc->getVReg(other.vreg).reg == reg){ return true; }
+			}
+			return false;
+		};
+		bool placed = false;
+		for (Register reg : regs){
+			if (taken(reg) || !isFree(fixed, reg, cur)){ continue; }
+			VRegInfo& info = proc->getVReg(cur.vreg);
+			info.inReg = true;
+			info.reg = reg;
+			placed = true;
+			break;
+		}
+		if (!placed){
+			//Take over the register of the cheapest interval that
+			// could give us its register, if it is cheaper than we
+			// are; otherwise stay in memory
+			size_t victim = SIZE_MAX;
+			for (size_t a = 0; a < active.size(); a++){
+				Register reg = proc->getVReg(active[a].vreg).reg;
+				if (!isFree(fixed, reg, cur)){ continue; }
+				if (victim == SIZE_MAX || active[a].cost < active[victim].cost){
+					victim = a;
+				}
+			}
+			if (victim == SIZE_MAX || active[victim].cost >= cur.cost){
+				spilled++;
+				continue;
+			}
+			VRegInfo& lost = proc->getVReg(active[victim].vreg);
+			VRegInfo& info = proc->getVReg(cur.vreg);
+			info.inReg = true;
+			info.reg = lost.reg;
+			lost.inReg = false;
+			active.erase(active.begin() + static_cast<long>(victim));
+			allocated--;
+			spilled++;
+		}
+		allocated++;
+		auto pos = std::upper_bound(active.begin(), active.end(), cur,
+			[](const LiveInterval& a, const LiveInterval& b){
+				return a.end < b.end;
+			});
+		active.insert(pos, cur);
+	}
+	if (opts.stats != nullptr){
+		opts.stats->add("regalloc.vregs-in-regs", allocated);
+		opts.stats->add("regalloc.vregs-spilled", spilled);
+	}
+}
+
+//Iterated register coalescing, after George and Appel. Nodes
+// 0..V-1 are the vregs and V..V+K-1 stand for the K allocatable
+// registers, which are precolored. A vreg left uncolored stays in
+// its frame slot: codegen reaches memory through its own scratch
+// registers, so spilling needs no rewrite and the allocator runs
+// once.
+class GraphColoring{
+public:
+	GraphColoring(Procedure * proc, const std::vector<Register>& regs);
+	void run();
+	size_t numColored() const { return colored; }
+	size_t numSpilled() const { return spilled; }
+	size_t numCoalesced() const { return coalescedMoves; }
+	size_t numFrozen() const { return frozenMoves; }
+private:
+	enum NodeState{
+		PRECOLORED, UNUSED, SIMPLIFY_WL, FREEZE_WL, SPILL_WL,
+		ON_STACK, COALESCED_NODE, COLORED_NODE, SPILLED_NODE
+	};
+	enum MoveState{
+		WORKLIST_MOVE, ACTIVE_MOVE, DONE_MOVE
+	};
+	struct Move{
+		size_t dst;
+		size_t src;
+		MoveState state;
+	};
+
+	size_t precolored(Register reg) const;
+	bool isPrecolored(size_t n) const { return n >= numVRegs; }
+	bool interferes(size_t u, size_t v) const { return adjSet[u * numNodes + v]; }
+	void addEdge(size_t u, size_t v);
+	void addMove(size_t dst, size_t src);
+	void build();
+	void makeWorklists();
+	std::vector<size_t> adjacent(size_t n) const;
+	bool moveRelated(size_t n) const;
+	void moveTo(size_t n, NodeState state);
+	void enableMoves(size_t n);
+	void decrementDegree(size_t m);
+	void simplify();
+	size_t getAlias(size_t n) const;
+	void addWorklist(size_t u);
+	bool georgeOK(size_t t, size_t r) const;
+	bool briggsOK(size_t u, size_t v) const;
+	void combine(size_t u, size_t v);
+	void coalesce();
+	void freezeMoves(size_t u);
+	void freeze();
+	void selectSpill();
+	void assignColors();
+
+	Procedure * myProc;
+	std::vector<Register> regs;
+	//The number of colors
+	size_t K;
+	size_t numVRegs;
+	size_t numNodes;
+	std::vector<bool> adjSet;
+	std::vector<std::vector<size_t>> adjList;
+	std::vector<size_t> degree;
+	std::vector<size_t> cost;
+	std::vector<size_t> alias;
+	std::vector<size_t> color;
+	std::vector<NodeState> state;
+	std::vector<std::vector<size_t>> moveList;
+	std::vector<Move> moves;
+	std::set<size_t> worklists[SPILL_WL + 1];
+	std::set<size_t> worklistMoves;
+	std::vector<size_t> selectStack;
+	size_t colored;
+	size_t spilled;
+	size_t coalescedMoves;
+	size_t frozenMoves;
+};
+
+GraphColoring::GraphColoring(Procedure * proc,
+	const std::vector<Register>& regs)
+: myProc(proc), regs(regs), K(regs.size()), numVRegs(proc->numVRegs()), numNodes(numVRegs + K),
+  adjSet(numNodes * numNodes, false), adjList(numNodes),
+  degree(numNodes, 0), cost(numNodes, 0), alias(numNodes),
+  color(numNodes, 0), state(numNodes, UNUSED), moveList(numNodes),
+  colored(0), spilled(0), coalescedMoves(0), frozenMoves(0){
+	for (size_t n = 0; n < numNodes; n++){ alias[n] = n; }
+	for (size_t r = 0; r < K; r++){
+		state[numVRegs + r] = PRECOLORED;
+		color[numVRegs + r] = r;
+		degree[numVRegs + r] = SIZE_MAX / 2;
+	}
+}
+
+//The node for reg, or SIZE_MAX if reg is never handed out
+size_t GraphColoring::precolored(Register reg) const {
+	for (size_t r = 0; r < K; r++){
+		if (regs[r] == reg){ return numVRegs + r; }
+	}
+	return SIZE_MAX;
+}
+
+void GraphColoring::addEdge(size_t u, size_t v){
+	if (u == v || u == SIZE_MAX || v == SIZE_MAX || interferes(u, v)){
+		return;
+	}
+	adjSet[u * numNodes + v] = true;
+	adjSet[v * numNodes + u] = true;
+	if (!isPrecolored(u)){
+		adjList[u].push_back(v);
+		degree[u]++;
+	}
+	if (!isPrecolored(v)){
+		adjList[v].push_back(u);
+		degree[v]++;
+	}
+}
+
+void GraphColoring::addMove(size_t dst, size_t src){
+	if (dst == SIZE_MAX || src == SIZE_MAX){ return; }
+	size_t m = moves.size();
+	moves.push_back({dst, src, WORKLIST_MOVE});
+	moveList[dst].push_back(m);
+	moveList[src].push_back(m);
+	worklistMoves.insert(m);
+}
+
+//Walk each block backwards from its live-out set. A def interferes
+// with everything live after it, except the source of a copy; a
+// call-like quad with everything live across it and every
+// caller-saved register; and an argument register, while it is
+// loaded ahead of a call or not yet read by its getarg, with
+// everything live or defined meanwhile.
+void GraphColoring::build(){
+	Liveness live(myProc);
+	const ControlFlowGraph * cfg = live.getCFG();
+	DominatorTree dom(cfg);
+	LoopNest loops(cfg, &dom);
+	const std::vector<Quad>& quads = myProc->getQuads();
+
+	std::vector<std::vector<size_t>> pinned(quads.size());
+	for (size_t i = 0; i < quads.size(); i++){
+		const Quad& quad = quads[i];
+		if (quad.getIndex() > 6){ continue; }
+		if (quad.getOp() == SETARG_QUAD){
+			size_t reg = precolored(RegUtils::argReg(quad.getIndex()));
+			for (size_t j = i; j < quads.size() && quads[j].getOp() != CALL_QUAD
+				&& quads[j].getOp() != TAILCALL_QUAD; j++){
+				pinned[j].push_back(reg);
+			}
+		} else if (quad.getOp() == GETARG_QUAD){
+			size_t reg = precolored(RegUtils::argReg(quad.getIndex()));
+			for (size_t j = 0; j < i; j++){ pinned[j].push_back(reg); }
+		}
+	}
+
+	for (const BasicBlock& block : cfg->getBlocks()){
+		size_t weight = useWeight(loops.loopDepth(block.getId()));
+		BitSet after = live.liveOut(block.getId());
+		for (size_t i = block.end(); i-- > block.first(); ){
+			const Quad& quad = quads[i];
+			Opd dst = quad.getDst();
+			Opd src = quad.getSrc1();
+			for (Opd opd : {dst, src, quad.getSrc2()}){
+				if (!opd.isVReg()){ continue; }
+				state[opd.index()] = SIMPLIFY_WL;
+				cost[opd.index()] += weight;
+			}
+			size_t d = dst.isVReg() ? dst.index() : SIZE_MAX;
+			if (quad.getOp() == ASSIGN_QUAD && dst.isVReg() && src.isVReg()
+				&& myProc->widthOf(dst) == myProc->widthOf(src)){
+				after.reset(src.index());
+				addMove(d, src.index());
+			} else if (quad.getOp() == GETARG_QUAD && quad.getIndex() <= 6){
+				addMove(d, precolored(RegUtils::argReg(quad.getIndex())));
+			} else if (quad.getOp() == SETARG_QUAD && quad.getIndex() <= 6
+				&& src.isVReg()){
+				addMove(precolored(RegUtils::argReg(quad.getIndex())),
+					src.index());
+			}
+			if (d != SIZE_MAX){
+				after.forEach([&](size_t l){ addEdge(l, d); });
+			}
+			if (makesCall(quad)){
+				after.forEach([&](size_t l){
+					if (l == d){ return; }
+					for (Register reg : callerSaved){
+						addEdge(l, precolored(reg));
+					}
+				});
+			}
+			for (size_t reg : pinned[i]){
+				after.forEach([&](size_t l){ addEdge(l, reg); });
+				addEdge(d, reg);
+			}
+			Liveness::step(quad, after);
+		}
+	}
+}
+
+void GraphColoring::makeWorklists(){
+	for (size_t n = 0; n < numVRegs; n++){
+		if (state[n] != SIMPLIFY_WL){ continue; }
+		if (degree[n] >= K){
+			moveTo(n, SPILL_WL);
+		} else if (moveRelated(n)){
+			moveTo(n, FREEZE_WL);
+		} else {
+			moveTo(n, SIMPLIFY_WL);
+		}
+	}
+}
+
+//The neighbours of n still in the graph
+std::vector<size_t> GraphColoring::adjacent(size_t n) const {
+	std::vector<size_t> res;
+	for (size_t m : adjList[n]){
+		if (state[m] != ON_STACK && state[m] != COALESCED_NODE){
+			res.push_back(m);
+		}
+	}
+	return res;
+}
+
+//Whether n is in a move that may yet be coalesced
+bool GraphColoring::moveRelated(size_t n) const {
+	for (size_t m : moveList[n]){
+		if (moves[m].state != DONE_MOVE){ return true; }
+	}
+	return false;
+}
+
+void GraphColoring::moveTo(size_t n, NodeState to){
+	if (state[n] <= SPILL_WL){ worklists[state[n]].erase(n); }
+	state[n] = to;
+	if (to <= SPILL_WL){ worklists[to].insert(n); }
+}
+
+void GraphColoring::enableMoves(size_t n){
+	for (size_t m : moveList[n]){
+		if (moves[m].state == ACTIVE_MOVE){
+			moves[m].state = WORKLIST_MOVE;
+			worklistMoves.insert(m);
+		}
+	}
+}
+
+void GraphColoring::decrementDegree(size_t m){
+	if (isPrecolored(m)){ return; }
+	size_t d = degree[m]--;
+	if (d != K){ return; }
+	enableMoves(m);
+	for (size_t n : adjacent(m)){ enableMoves(n); }
+	moveTo(m, moveRelated(m) ? FREEZE_WL : SIMPLIFY_WL);
+}
+
+void GraphColoring::simplify(){
+	size_t n = *worklists[SIMPLIFY_WL].begin();
+	moveTo(n, ON_STACK);
+	selectStack.push_back(n);
+	for (size_t m : adjacent(n)){ decrementDegree(m); }
+}
+
+size_t GraphColoring::getAlias(size_t n) const {
+	while (state[n] == COALESCED_NODE){ n = alias[n]; }
+	return n;
+}
+
+void GraphColoring::addWorklist(size_t u){
+	if (!isPrecolored(u) && !moveRelated(u) && degree[u] < K){
+		moveTo(u, SIMPLIFY_WL);
+	}
+}
+
+//George's test, for merging into precolored r
+bool GraphColoring::georgeOK(size_t t, size_t r) const {
+	return degree[t] < K || isPrecolored(t) || interferes(t, r);
+}
+
+//Briggs's test: fewer than K significant neighbours between them
+bool GraphColoring::briggsOK(size_t u, size_t v) const {
+	std::set<size_t> nodes;
+	for (size_t n : adjacent(u)){ nodes.insert(n); }
+	for (size_t n : adjacent(v)){ nodes.insert(n); }
+	size_t significant = 0;
+	for (size_t n : nodes){
+		if (degree[n] >= K){ significant++; }
+	}
+	return significant < K;
+}
+
+void GraphColoring::combine(size_t u, size_t v){
+	moveTo(v, COALESCED_NODE);
+	alias[v] = u;
+	cost[u] += cost[v];
+	moveList[u].insert(moveList[u].end(), moveList[v].begin(),
+		moveList[v].end());
+	enableMoves(v);
+	for (size_t t : adjacent(v)){
+		addEdge(t, u);
+		decrementDegree(t);
+	}
+	if (degree[u] >= K && state[u] == FREEZE_WL){ moveTo(u, SPILL_WL); }
+}
+
+void GraphColoring::coalesce(){
+	size_t m = *worklistMoves.begin();
+	worklistMoves.erase(m);
+	size_t x = getAlias(moves[m].dst);
+	size_t y = getAlias(moves[m].src);
+	size_t u = isPrecolored(y) ? y : x;
+	size_t v = isPrecolored(y) ? x : y;
+	if (u == v){
+		moves[m].state = DONE_MOVE;
+		coalescedMoves++;
+		addWorklist(u);
+	} else if (isPrecolored(v) || interferes(u, v)){
+		moves[m].state = DONE_MOVE;
+		addWorklist(u);
+		addWorklist(v);
+	} else {
+		bool ok = true;
+		if (isPrecolored(u)){
+			for (size_t t : adjacent(v)){ ok = ok && georgeOK(t, u); }
+		} else {
+			ok = briggsOK(u, v);
+		}
+		if (ok){
+			moves[m].state = DONE_MOVE;
+			coalescedMoves++;
+			combine(u, v);
+			addWorklist(u);
+		} else {
+			moves[m].state = ACTIVE_MOVE;
+		}
+	}
+}
+
+//Give up on coalescing the moves of u
+void GraphColoring::freezeMoves(size_t u){
+	for (size_t m : moveList[u]){
+		if (moves[m].state == DONE_MOVE){ continue; }
+		size_t x = getAlias(moves[m].dst);
+		size_t y = getAlias(moves[m].src);
+		size_t v = y == getAlias(u) ? x : y;
+		worklistMoves.erase(m);
+		moves[m].state = DONE_MOVE;
+		frozenMoves++;
+		if (!isPrecolored(v) && !moveRelated(v) && degree[v] < K){
+			moveTo(v, SIMPLIFY_WL);
+		}
+	}
+}
+
+void GraphColoring::freeze(){
+	size_t u = *worklists[FREEZE_WL].begin();
+	moveTo(u, SIMPLIFY_WL);
+	freezeMoves(u);
+}
+
+//Push the node cheapest per interference to keep in memory, in
+// the hope that it gets a color anyway
+void GraphColoring::selectSpill(){
+	size_t best = SIZE_MAX;
+	for (size_t n : worklists[SPILL_WL]){
+		if (best == SIZE_MAX
+			|| cost[n] * degree[best] < cost[best] * degree[n]){
+			best = n;
+		}
+	}
+	moveTo(best, SIMPLIFY_WL);
+	freezeMoves(best);
+}
+
+//Colors are tried in the order of regs, so caller-saved
+// registers go first
+void GraphColoring::assignColors(){
+	while (!selectStack.empty()){
+		size_t n = selectStack.back();
+		selectStack.pop_back();
+		std::vector<bool> ok(K, true);
+		for (size_t w : adjList[n]){
+			size_t a = getAlias(w);
+			if (state[a] == COLORED_NODE || state[a] == PRECOLORED){
+				ok[color[a]] = false;
+			}
+		}
+		state[n] = SPILLED_NODE;
+		for (size_t c = 0; c < K; c++){
+			if (ok[c]){
+				state[n] = COLORED_NODE;
+				color[n] = c;
+				break;
+			}
+		}
+	}
+	for (size_t n = 0; n < numVRegs; n++){
+		size_t a = getAlias(n);
+		if (state[n] == UNUSED){ continue; }
+		VRegInfo& info = myProc->getVReg(Opd::vreg(static_cast<uint32_t>(n)));
+		if (state[a] == COLORED_NODE || state[a] == PRECOLORED){
+			info.inReg = true;
+			info.reg = regs[color[a]];
+			colored++;
+		} else {
+			spilled++;
+		}
+	}
+}
+
+void GraphColoring::run(){
+	build();
+	makeWorklists();
+	while (true){
+		if (!worklists[SIMPLIFY_WL].empty()){
+			simplify();
+		} else if (!worklistMoves.empty()){
+			coalesce();
+		} else if (!worklists[FREEZE_WL].empty()){
+			freeze();
+		} else if (!worklists[SPILL_WL].empty()){
+			selectSpill();
+		} else {
+			break;
+		}
+	}
+	assignColors();
+}
+
+void colorGraph(Procedure * proc, const X64Options& opts){
+	GraphColoring coloring(proc, allocatable(opts));
+	coloring.run();
+	if (opts.stats != nullptr){
+		opts.stats->add("regalloc.vregs-in-regs", coloring.numColored());
+		opts.stats->add("regalloc.vregs-spilled", coloring.numSpilled());
+		opts.stats->add("regalloc.moves-coalesced", coloring.numCoalesced());
+		opts.stats->add("regalloc.moves-frozen", coloring.numFrozen());
+	}
+}
+
+//Which of the vregs kept in memory hold values at the same time:
+// a def against whatever is live after it (bar the source of a
+// copy), and everything live on entry against each other
+static std::vector<BitSet> slotInterference(Procedure * proc){
+	Liveness live(proc);
+	const ControlFlowGraph * cfg = live.getCFG();
+	const std::vector<Quad>& quads = proc->getQuads();
+	size_t numVRegs = proc->numVRegs();
+	std::vector<bool> inMemory(numVRegs);
+	for (size_t v = 0; v < numVRegs; v++){
+		inMemory[v] = !proc->getVReg(Opd::vreg(static_cast<uint32_t>(v))).inReg;
+	}
+	std::vector<BitSet> edges(numVRegs, BitSet(numVRegs));
+	auto addEdge = [&](size_t u, size_t v){
+		if (u == v || !inMemory[u] || !inMemory[v]){ return; }
+		edges[u].set(v);
+		edges[v].set(u);
+	};
+	live.liveIn(cfg->entry()).forEach([&](size_t u){
+		live.liveIn(cfg->entry()).forEach([&](size_t v){ addEdge(u, v); });
+	});
+	for (const BasicBlock& block : cfg->getBlocks()){
+		BitSet after = live.liveOut(block.getId());
+		for (size_t i = block.end(); i-- > block.first(); ){
+			const Quad& quad = quads[i];
+			Opd dst = quad.getDst();
+			if (dst.isVReg()){
+				Opd src = quad.getSrc1();
+				bool copy = quad.getOp() == ASSIGN_QUAD && src.isVReg();
+				after.forEach([&](size_t l){
+					if (!copy || l != src.index()){ addEdge(l, dst.index()); }
+				});
+			}
+			Liveness::step(quad, after);
+		}
+	}
+	return edges;
+}
+
+size_t packSlots(Procedure * proc, int top, OptStats * stats){
+	std::vector<BitSet> edges = slotInterference(proc);
+
+	//Widest first, so every slot stays aligned to its width
+	std::vector<size_t> order;
+	size_t unshared = 0;
+	for (size_t v = 0; v < proc->numVRegs(); v++){
+		const VRegInfo& info = proc->getVReg(Opd::vreg(static_cast<uint32_t>(v)));
+		if (info.inReg){ continue; }
+		order.push_back(v);
+		unshared += info.width;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b){
+		return proc->getVReg(Opd::vreg(static_cast<uint32_t>(a))).width
+			> proc->getVReg(Opd::vreg(static_cast<uint32_t>(b))).width;
+	});
+
+	//Each slot is shared by vregs of one width that never hold
+	// values at the same time
+	struct Slot{
+		size_t width;
+		int offset;
+		BitSet members;
+	};
+	std::vector<Slot> slots;
+	int offset = top;
+	size_t size = 0;
+	for (size_t v : order){
+		VRegInfo& info = proc->getVReg(Opd::vreg(static_cast<uint32_t>(v)));
+		Slot * home = nullptr;
+		for (Slot& slot : slots){
+			BitSet clash = slot.members;
+			clash.intersectWith(edges[v]);
+			if (slot.width == info.width && clash.none()){
+				home = &slot;
+				break;
+			}
+		}
+		if (home == nullptr){
+			slots.push_back({info.width, offset, BitSet(proc->numVRegs())});
+			home = &slots.back();
+			offset -= int(info.width);
+			size += info.width;
+		}
+		home->members.set(v);
+		info.frameOffset = home->offset;
+	}
+	if (stats != nullptr){
+		stats->add("frame.slot-bytes-saved", unshared - size);
+	}
+	return size;
+}
+
+}
@@ -0,0 +1,37 @@
+#ifndef DREWNO_MARS_REGALLOC_HPP
+#define DREWNO_MARS_REGALLOC_HPP
+
+#include "3ac.hpp"
+
+namespace drewno_mars{
+
+//Whether quad calls out, clobbering the caller-saved registers
+bool makesCall(const Quad& quad);
+
+//Place the vregs of a procedure in machine registers by linear
+// scan over their live intervals. Codegen keeps %rax and %r11 as
+// scratch and division clobbers %rdx, so those are never handed
+// out. Vregs live across a call only get callee-saved registers.
+// Where registers run out, the vregs cheapest to keep in memory
+// (uses weighted by loop depth) stay in their frame slots. Bumps
+// the regalloc.* counters if opts has stats. %rbp is handed out
+// too when opts omits the frame pointer.
+void linearScan(Procedure * proc, const X64Options& opts);
+
+//Place the vregs of a procedure in machine registers by iterated
+// register coalescing over its interference graph, under the same
+// constraints as linearScan. Copies between vregs, and between
+// vregs and argument registers, are coalesced where that cannot
+// cost a color. Slower than linearScan, but gets rid of most of the
+// copies lowering leaves behind.
+void colorGraph(Procedure * proc, const X64Options& opts);
+
+//Give the vregs of a procedure that are not in registers frame
+// slots going down from top (relative to %rbp), with vregs that
+// are never live at the same time sharing a slot. Slots are laid
+// out widest first. Returns the bytes taken.
+size_t packSlots(Procedure * proc, int top, OptStats * stats);
+
+}
+
+#endif
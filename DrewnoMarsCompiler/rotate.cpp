@@ -0,0 +1,95 @@
+#include "opt.hpp"
+#include "cfg.hpp"
+#include "dominators.hpp"
+#include "loops.hpp"
+
+namespace drewno_mars{
+
+//The most quads of a loop test (besides the ifz) that get copied
+// to the bottom of the loop
+static const size_t MAX_TEST_SIZE = 8;
+
+//Rotate one loop whose header computes a condition and leaves on
+// ifz, and whose only latch jumps back to the header. The header
+// stays where it is as the guard; the latch's goto becomes a copy
+// of the test that jumps back to the top of the body unless the
+// condition fails. Returns whether the loop had that shape.
+static bool rotateLoop(Procedure * proc, const ControlFlowGraph * cfg,
+	const Loop& loop){
+	const std::vector<Quad>& quads = proc->getQuads();
+	const BasicBlock& header = cfg->getBlock(loop.header);
+	if (loop.latches.size() != 1 || header.empty()
+		|| header.size() > MAX_TEST_SIZE + 1){
+		return false;
+	}
+	const BasicBlock& latch = cfg->getBlock(loop.latches[0]);
+	if (latch.getId() == header.getId()){ return false; }
+	const Quad& test = quads[header.end() - 1];
+	const Quad& back = quads[latch.end() - 1];
+	if (test.getOp() != IFZ_QUAD || !test.getSrc1().isVReg()
+		|| back.getOp() != GOTO_QUAD){
+		return false;
+	}
+	if (loop.contains(cfg->blockOfLabel(test.getTarget()))
+		|| !loop.contains(header.getId() + 1)){
+		return false;
+	}
+
+	IRProgram * prog = proc->getProg();
+	Opd cond = test.getSrc1();
+	Label * exitLabel = prog->getLabel(test.getTarget());
+	std::vector<Quad> bottom;
+	for (size_t i = header.first(); i + 1 < header.end(); i++){
+		bottom.push_back(quads[i]);
+		bottom.back().clearLabel();
+	}
+	//Branch back on the negated condition, comparing the other way
+	// round where the condition is a comparison
+	Opd again = proc->makeTmp(proc->widthOf(cond));
+	Quad def = bottom.empty() ? Quad::nop() : bottom.back();
+	bool compares = def.getOp() == BINOP_QUAD && def.getDst() == cond
+		&& def.getSrc1() != cond && def.getSrc2() != cond
+		&& negateCompare(def.getBinOp()) != def.getBinOp();
+	if (compares){
+		bottom.push_back(Quad::binOp(again, negateCompare(def.getBinOp()),
+			def.getSrc1(), def.getSrc2()));
+	} else {
+		UnaryOp opr = proc->widthOf(cond) == 1 ? NOT8 : NOT64;
+		bottom.push_back(Quad::unaryOp(again, opr, cond));
+	}
+	size_t latchEnd = latch.end() - 1;
+	LabelId backLabel = back.getLabel();
+
+	std::vector<Quad>& edited = proc->editQuads();
+	Quad& first = edited[header.end()];
+	if (!first.hasLabel()){ first.setLabel(proc->makeLabel()); }
+	bottom.push_back(Quad::ifz(again, prog->getLabel(first.getLabel())));
+	bottom.push_back(Quad::jump(exitLabel));
+	if (backLabel != NO_LABEL){
+		bottom[0].setLabel(prog->getLabel(backLabel));
+	}
+	edited.erase(edited.begin() + static_cast<long>(latchEnd));
+	edited.insert(edited.begin() + static_cast<long>(latchEnd),
+		bottom.begin(), bottom.end());
+	return true;
+}
+
+size_t rotateLoops(Procedure * proc){
+	size_t rotated = 0;
+	//A rotated loop's latch ends in an ifz, so it is not picked
+	// up again
+	while (true){
+		const ControlFlowGraph * cfg = proc->getCFG();
+		DominatorTree dom(cfg);
+		LoopNest loops(cfg, &dom);
+		bool changed = false;
+		for (size_t i = 0; i < loops.numLoops() && !changed; i++){
+			changed = rotateLoop(proc, cfg, loops.getLoop(i));
+		}
+		if (!changed){ break; }
+		rotated++;
+	}
+	return rotated;
+}
+
+}
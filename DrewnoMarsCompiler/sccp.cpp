@@ -0,0 +1,297 @@
+#include "opt.hpp"
+#include "cfg.hpp"
+
+namespace drewno_mars{
+
+//Sparse conditional constant propagation (Wegman and Zadeck).
+// Each SSA vreg starts out undefined and can only move down the
+// lattice to a single constant and then to overdefined. Blocks
+// are only looked at once an edge into them is known to run.
+
+enum LatticeLevel{ UNDEF_VAL, CONST_VAL, OVERDEF_VAL };
+
+struct LatticeVal{
+	LatticeLevel level;
+	int64_t value;
+};
+
+class SCCPSolver{
+public:
+	explicit SCCPSolver(Procedure * proc);
+	void solve();
+	size_t rewrite();
+private:
+	LatticeVal valueOf(Opd opd) const;
+	void lower(Opd dst, LatticeVal val);
+	void markEdge(BlockId from, BlockId to);
+	void propagate();
+	void visit(size_t quadIdx);
+	LatticeVal evaluate(const Quad& quad) const;
+
+	Procedure * proc;
+	const ControlFlowGraph * cfg;
+	const std::vector<Quad>& quads;
+	std::vector<LatticeVal> vals;
+	std::vector<std::vector<size_t>> uses;
+	std::vector<bool> blockLive;
+	std::vector<std::vector<bool>> edgeLive;
+	std::vector<size_t> ssaWork;
+	std::vector<std::pair<BlockId, BlockId>> flowWork;
+};
+
+SCCPSolver::SCCPSolver(Procedure * procIn)
+: proc(procIn), cfg(procIn->getCFG()), quads(procIn->getQuads()){
+	size_t numVRegs = proc->numVRegs();
+	LatticeVal undef = { UNDEF_VAL, 0 };
+	LatticeVal overdef = { OVERDEF_VAL, 0 };
+	uses.resize(numVRegs);
+	std::vector<bool> defined(numVRegs, false);
+	for (size_t i = 0; i < quads.size(); i++){
+		const Quad& quad = quads[i];
+		if (quad.getDst().isVReg()){ defined[quad.getDst().index()] = true; }
+		if (quad.getOp() == PHI_QUAD){
+			for (Opd arg : proc->getPhiArgs(quad)){
+				if (arg.isVReg()){ uses[arg.index()].push_back(i); }
+			}
+			continue;
+		}
+		if (quad.getSrc1().isVReg()){ uses[quad.getSrc1().index()].push_back(i); }
+		if (quad.getSrc2().isVReg()){ uses[quad.getSrc2().index()].push_back(i); }
+	}
+	//A vreg never written in the body holds whatever it held on
+	// entry, which could be anything
+	vals.resize(numVRegs);
+	for (size_t v = 0; v < numVRegs; v++){
+		vals[v] = defined[v] ? undef : overdef;
+	}
+	blockLive.assign(cfg->numBlocks(), false);
+	for (const BasicBlock& block : cfg->getBlocks()){
+		edgeLive.push_back(std::vector<bool>(block.getPreds().size(), false));
+	}
+}
+
+LatticeVal SCCPSolver::valueOf(Opd opd) const{
+	if (opd.isVReg()){ return vals[opd.index()]; }
+	LatticeVal res = { OVERDEF_VAL, 0 };
+	if (constValue(proc, opd, res.value)){ res.level = CONST_VAL; }
+	return res;
+}
+
+void SCCPSolver::lower(Opd dst, LatticeVal val){
+	LatticeVal& old = vals[dst.index()];
+	if (old.level == OVERDEF_VAL){ return; }
+	if (old.level == CONST_VAL && val.level == CONST_VAL
+		&& old.value != val.value){
+		val.level = OVERDEF_VAL;
+	}
+	if (val.level <= old.level){ return; }
+	old = val;
+	for (size_t use : uses[dst.index()]){
+		ssaWork.push_back(use);
+	}
+}
+
+void SCCPSolver::markEdge(BlockId from, BlockId to){
+	const std::vector<BlockId>& preds = cfg->getBlock(to).getPreds();
+	size_t idx = 0;
+	while (preds[idx] != from){ idx++; }
+	if (edgeLive[to][idx]){ return; }
+	edgeLive[to][idx] = true;
+	flowWork.push_back(std::make_pair(from, to));
+}
+
+static LatticeVal meet(LatticeVal a, LatticeVal b){
+	if (a.level == UNDEF_VAL){ return b; }
+	if (b.level == UNDEF_VAL){ return a; }
+	if (a.level == CONST_VAL && b.level == CONST_VAL
+		&& a.value == b.value){
+		return a;
+	}
+	LatticeVal res = { OVERDEF_VAL, 0 };
+	return res;
+}
+
+LatticeVal SCCPSolver::evaluate(const Quad& quad) const{
+	LatticeVal res = { OVERDEF_VAL, 0 };
+	LatticeVal lhs = valueOf(quad.getSrc1());
+	switch (quad.getOp()){
+	case ASSIGN_QUAD:
+		return lhs;
+	case UNARYOP_QUAD:
+		if (lhs.level != CONST_VAL){ return lhs; }
+		res.level = CONST_VAL;
+		res.value = foldUnaryOp(quad.getUnaryOp(), lhs.value);
+		return res;
+	case BINOP_QUAD: {
+		LatticeVal rhs = valueOf(quad.getSrc2());
+		if (lhs.level == OVERDEF_VAL || rhs.level == OVERDEF_VAL){
+			return res;
+		}
+		if (lhs.level == UNDEF_VAL || rhs.level == UNDEF_VAL){
+			res.level = UNDEF_VAL;
+			return res;
+		}
+		if (foldBinOp(quad.getBinOp(), lhs.value, rhs.value, res.value)){
+			res.level = CONST_VAL;
+		}
+		return res;
+	}
+	default:
+		return res;
+	}
+}
+
+void SCCPSolver::visit(size_t quadIdx){
+	BlockId block = cfg->blockOf(quadIdx);
+	if (!blockLive[block]){ return; }
+	const Quad& quad = quads[quadIdx];
+	const BasicBlock& bb = cfg->getBlock(block);
+	bool last = quadIdx + 1 == bb.end();
+
+	switch (quad.getOp()){
+	case PHI_QUAD: {
+		LatticeVal val = { UNDEF_VAL, 0 };
+		const std::vector<Opd>& args = proc->getPhiArgs(quad);
+		for (size_t i = 0; i < args.size(); i++){
+			if (edgeLive[block][i]){ val = meet(val, valueOf(args[i])); }
+		}
+		lower(quad.getDst(), val);
+		return;
+	}
+	case GOTO_QUAD:
+		markEdge(block, cfg->blockOfLabel(quad.getTarget()));
+		return;
+	case IFZ_QUAD: {
+		LatticeVal cond = valueOf(quad.getSrc1());
+		BlockId taken = cfg->blockOfLabel(quad.getTarget());
+		if (cond.level == UNDEF_VAL){ return; }
+		if (cond.level == OVERDEF_VAL || cond.value == 0){
+			markEdge(block, taken);
+		}
+		if (cond.level == OVERDEF_VAL || cond.value != 0){
+			markEdge(block, block + 1);
+		}
+		return;
+	}
+	case EXIT_QUAD:
+		return;
+	default:
+		if (quad.getDst().isVReg()){
+			lower(quad.getDst(), evaluate(quad));
+		}
+	}
+	if (last){ markEdge(block, block + 1); }
+}
+
+void SCCPSolver::solve(){
+	BlockId entry = cfg->entry();
+	blockLive[entry] = true;
+	for (size_t i = cfg->getBlock(entry).first();
+		i < cfg->getBlock(entry).end(); i++){
+		visit(i);
+	}
+	if (cfg->getBlock(entry).empty()){ return; }
+
+	do {
+		propagate();
+		//A branch on a value still undefined at the fixpoint
+		// would leave both its edges dead; the program can take
+		// either, so let both run and propagate again
+		for (BlockId block = 0; block < cfg->exit(); block++){
+			const BasicBlock& bb = cfg->getBlock(block);
+			if (!blockLive[block] || bb.empty()){ continue; }
+			const Quad& last = quads[bb.end() - 1];
+			if (last.getOp() != IFZ_QUAD
+				|| valueOf(last.getSrc1()).level != UNDEF_VAL){
+				continue;
+			}
+			markEdge(block, cfg->blockOfLabel(last.getTarget()));
+			markEdge(block, block + 1);
+		}
+	} while (!flowWork.empty());
+}
+
+//Run both worklists dry
+void SCCPSolver::propagate(){
+	while (!flowWork.empty() || !ssaWork.empty()){
+		while (!flowWork.empty()){
+			BlockId to = flowWork.back().second;
+			flowWork.pop_back();
+			const BasicBlock& bb = cfg->getBlock(to);
+			if (!blockLive[to]){
+				blockLive[to] = true;
+				for (size_t i = bb.first(); i < bb.end(); i++){
+					visit(i);
+				}
+				continue;
+			}
+			//Only the phis can see the new edge
+			for (size_t i = bb.first(); i < bb.end(); i++){
+				if (quads[i].getOp() != PHI_QUAD){ break; }
+				visit(i);
+			}
+		}
+		while (!ssaWork.empty()){
+			size_t quadIdx = ssaWork.back();
+			ssaWork.pop_back();
+			visit(quadIdx);
+		}
+	}
+}
+
+//Replace constant vregs by their values. The quads that computed
+// them become nops, except for phis, which are dropped so that the
+// remaining phis stay together at the top of their blocks.
+size_t SCCPSolver::rewrite(){
+	IRProgram * prog = proc->getProg();
+	std::vector<Quad>& body = proc->editQuads();
+	std::vector<bool> deadPhis(body.size(), false);
+	size_t folded = 0;
+	auto constOf = [&](Opd opd){
+		if (!opd.isVReg()){ return opd; }
+		const LatticeVal& val = vals[opd.index()];
+		if (val.level != CONST_VAL){ return opd; }
+		return prog->makeInt(val.value, proc->widthOf(opd));
+	};
+	for (size_t i = 0; i < body.size(); i++){
+		Quad& quad = body[i];
+		Opd dst = quad.getDst();
+		bool isConst = dst.isVReg() && vals[dst.index()].level == CONST_VAL;
+		switch (quad.getOp()){
+		case PHI_QUAD:
+			if (isConst){
+				deadPhis[i] = true;
+				continue;
+			}
+			for (Opd& arg : proc->getPhiArgs(quad)){ arg = constOf(arg); }
+			continue;
+		case BINOP_QUAD:
+		case UNARYOP_QUAD:
+		case ASSIGN_QUAD:
+			if (isConst){
+				Quad nop = Quad::nop();
+				if (quad.hasLabel()){
+					nop.setLabel(prog->getLabel(quad.getLabel()));
+				}
+				quad = nop;
+				folded++;
+				continue;
+			}
+			break;
+		default:
+			break;
+		}
+		quad.setSrc1(constOf(quad.getSrc1()));
+		quad.setSrc2(constOf(quad.getSrc2()));
+	}
+	eraseQuads(proc, deadPhis);
+	return folded;
+}
+
+size_t runSCCP(Procedure * proc){
+	SCCPSolver solver(proc);
+	solver.solve();
+	return solver.rewrite();
+}
+
+}
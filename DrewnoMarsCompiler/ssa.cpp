@@ -0,0 +1,357 @@
+#include "ssa.hpp"
+#include "cfg.hpp"
+#include "dataflow.hpp"
+#include "dominators.hpp"
+
+namespace drewno_mars{
+
+void toSSA(Procedure * proc){
+	//Phis need an argument for every way into their block, so
+	// the entry block must not be a jump target
+	if (!proc->getCFG()->getBlock(0).getPreds().empty()){
+		std::vector<Quad>& quads = proc->editQuads();
+		quads.insert(quads.begin(), Quad::nop());
+	}
+
+	const ControlFlowGraph * cfg = proc->getCFG();
+	const std::vector<Quad>& quads = proc->getQuads();
+	size_t numBlocks = cfg->numBlocks();
+	size_t numVars = proc->numVRegs();
+
+	std::vector<std::vector<BlockId>> defBlocks(numVars);
+	for (BlockId block : cfg->rpo()){
+		const BasicBlock& bb = cfg->getBlock(block);
+		for (size_t i = bb.first(); i < bb.end(); i++){
+			Opd dst = quads[i].getDst();
+			if (!dst.isVReg()){ continue; }
+			std::vector<BlockId>& blocks = defBlocks[dst.index()];
+			if (blocks.empty() || blocks.back() != block){
+				blocks.push_back(block);
+			}
+		}
+	}
+
+	//Place phis on the iterated dominance frontier of each
+	// vreg's definitions, skipping blocks where it is dead
+	std::vector<std::vector<uint32_t>> blockPhis(numBlocks);
+	//The first definition reached keeps the original vreg, so
+	// vregs defined only once are not renamed at all. A vreg read
+	// before it is written leaves the original to its value on
+	// entry, which must not share a name with any definition.
+	std::vector<bool> taken(numVars, false);
+	{
+		DominatorTree dom(cfg);
+		Liveness live(proc);
+		for (uint32_t var = 0; var < numVars; var++){
+			taken[var] = live.liveIn(cfg->entry()).test(var);
+		}
+		std::vector<size_t> visited(numBlocks, SIZE_MAX);
+		std::vector<size_t> queued(numBlocks, SIZE_MAX);
+		for (uint32_t var = 0; var < numVars; var++){
+			std::vector<BlockId> work(defBlocks[var]);
+			for (BlockId block : work){ queued[block] = var; }
+			while (!work.empty()){
+				BlockId block = work.back();
+				work.pop_back();
+				for (BlockId join : dom.frontier(block)){
+					if (visited[join] == var){ continue; }
+					visited[join] = var;
+					if (!live.liveIn(join).test(var)){ continue; }
+					blockPhis[join].push_back(var);
+					if (queued[join] != var){
+						queued[join] = var;
+						work.push_back(join);
+					}
+				}
+			}
+		}
+	}
+
+	//Rebuild the body with the phis at the top of their blocks.
+	// The block's label moves onto its first phi, which keeps
+	// the shape of the CFG unchanged.
+	std::vector<Quad> body;
+	std::vector<uint32_t> phiVars;
+	for (BlockId block = 0; block < cfg->exit(); block++){
+		const BasicBlock& bb = cfg->getBlock(block);
+		LabelId label = quads[bb.first()].getLabel();
+		for (uint32_t var : blockPhis[block]){
+			//Arguments from unreachable predecessors are never
+			// renamed; they keep the original vreg
+			size_t argsIdx = proc->makePhiArgs(bb.getPreds().size(),
+				Opd::vreg(var));
+			Quad phi = Quad::phi(Opd::vreg(var), argsIdx);
+			phiVars.resize(argsIdx + 1);
+			phiVars[argsIdx] = var;
+			body.push_back(phi);
+		}
+		size_t firstQuad = body.size();
+		for (size_t i = bb.first(); i < bb.end(); i++){
+			body.push_back(quads[i]);
+		}
+		if (!blockPhis[block].empty() && label != NO_LABEL){
+			size_t firstPhi = firstQuad - blockPhis[block].size();
+			body[firstPhi].setLabel(proc->getProg()->getLabel(label));
+			body[firstQuad].clearLabel();
+		}
+	}
+
+	//Rename along the dominator tree. Operands are rewritten in
+	// place, so the CFG built over the new body stays valid.
+	std::vector<Quad>& ssaBody = proc->editQuads();
+	ssaBody = body;
+	cfg = proc->getCFG();
+	DominatorTree dom(cfg);
+
+	std::vector<std::vector<Opd>> stacks(numVars);
+	std::vector<uint32_t> pushed;
+	auto current = [&](Opd opd){
+		if (!opd.isVReg() || stacks[opd.index()].empty()){ return opd; }
+		return stacks[opd.index()].back();
+	};
+	auto define = [&](Opd var){
+		Opd version = var;
+		if (taken[var.index()]){ version = proc->cloneVReg(var); }
+		taken[var.index()] = true;
+		stacks[var.index()].push_back(version);
+		pushed.push_back(var.index());
+		return version;
+	};
+
+	std::vector<std::pair<BlockId, size_t>> walk;
+	std::vector<size_t> marks;
+	walk.push_back(std::make_pair(cfg->entry(), 0));
+	marks.push_back(0);
+	while (!walk.empty()){
+		BlockId block = walk.back().first;
+		size_t& nextKid = walk.back().second;
+		const BasicBlock& bb = cfg->getBlock(block);
+
+		if (nextKid == 0){
+			for (size_t i = bb.first(); i < bb.end(); i++){
+				Quad& quad = ssaBody[i];
+				if (quad.getOp() == PHI_QUAD){
+					Opd var = Opd::vreg(phiVars[quad.getIndex()]);
+					quad.setDst(define(var));
+					continue;
+				}
+				quad.setSrc1(current(quad.getSrc1()));
+				quad.setSrc2(current(quad.getSrc2()));
+				if (quad.getDst().isVReg()){
+					quad.setDst(define(quad.getDst()));
+				}
+			}
+			for (BlockId succ : bb.getSuccs()){
+				const BasicBlock& sb = cfg->getBlock(succ);
+				const std::vector<BlockId>& preds = sb.getPreds();
+				size_t predIdx = 0;
+				while (preds[predIdx] != block){ predIdx++; }
+				for (size_t i = sb.first(); i < sb.end(); i++){
+					const Quad& phi = ssaBody[i];
+					if (phi.getOp() != PHI_QUAD){ break; }
+					Opd var = Opd::vreg(phiVars[phi.getIndex()]);
+					proc->getPhiArgs(phi)[predIdx] = current(var);
+				}
+			}
+		}
+
+		const std::vector<BlockId>& kids = dom.children(block);
+		if (nextKid < kids.size()){
+			BlockId kid = kids[nextKid++];
+			walk.push_back(std::make_pair(kid, 0));
+			marks.push_back(pushed.size());
+			continue;
+		}
+		while (pushed.size() > marks.back()){
+			stacks[pushed.back()].pop_back();
+			pushed.pop_back();
+		}
+		walk.pop_back();
+		marks.pop_back();
+	}
+}
+
+std::vector<Quad> sequentializeCopies(Procedure * proc,
+	const std::vector<std::pair<Opd, Opd>>& copies, Opd& tmp){
+	std::vector<Quad> res;
+	std::vector<std::pair<Opd, Opd>> pending;
+	//How many pending copies still read each location, and the
+	// pending copy (if any) writing each location
+	HashMap<uint32_t, size_t> readers;
+	HashMap<uint32_t, size_t> writer;
+	for (auto copy : copies){
+		if (copy.first == copy.second){ continue; }
+		writer[copy.first.getBits()] = pending.size();
+		readers[copy.second.getBits()]++;
+		pending.push_back(copy);
+	}
+
+	//A copy is ready once nothing pending still needs the old
+	// value of its destination
+	std::vector<bool> done(pending.size(), false);
+	std::vector<size_t> ready;
+	for (size_t i = 0; i < pending.size(); i++){
+		if (readers[pending[i].first.getBits()] == 0){ ready.push_back(i); }
+	}
+	Opd saved = Opd::none();
+	size_t numDone = 0;
+	size_t next = 0;
+	while (numDone < pending.size()){
+		while (!ready.empty()){
+			size_t idx = ready.back();
+			ready.pop_back();
+			Opd dst = pending[idx].first;
+			Opd src = pending[idx].second;
+			res.push_back(Quad::assign(dst, src == saved ? tmp : src));
+			done[idx] = true;
+			numDone++;
+			if (--readers[src.getBits()] == 0){
+				auto found = writer.find(src.getBits());
+				if (found != writer.end() && !done[found->second]){
+					ready.push_back(found->second);
+				}
+			}
+		}
+		//Whatever is left forms cycles; park one value in tmp
+		while (next < pending.size() && done[next]){ next++; }
+		if (next == pending.size()){ break; }
+		Opd dst = pending[next].first;
+		if (tmp.isNone()){
+			tmp = proc->makeTmp(proc->widthOf(dst));
+		}
+		res.push_back(Quad::assign(tmp, dst));
+		saved = dst;
+		readers[dst.getBits()] = 0;
+		ready.push_back(next);
+	}
+	return res;
+}
+
+void fromSSA(Procedure * proc){
+	const ControlFlowGraph * cfg = proc->getCFG();
+	const std::vector<Quad>& quads = proc->getQuads();
+	IRProgram * prog = proc->getProg();
+	size_t numBlocks = cfg->numBlocks();
+	typedef std::vector<std::pair<Opd, Opd>> Copies;
+
+	//Copies to make at the bottom of a block, and copies for
+	// the fallthrough edge of a block ending in an ifz
+	std::vector<Copies> endCopies(numBlocks);
+	std::vector<Copies> fallCopies(numBlocks);
+	//New targets for ifzs whose taken edge had to be split
+	std::vector<Label *> retargets(numBlocks, nullptr);
+	struct Split{
+		Label * label;
+		LabelId target;
+		Copies copies;
+	};
+	std::vector<Split> splits;
+	bool found = false;
+
+	for (const BasicBlock& bb : cfg->getBlocks()){
+		const std::vector<BlockId>& preds = bb.getPreds();
+		for (size_t j = 0; j < preds.size(); j++){
+			Copies copies;
+			for (size_t i = bb.first(); i < bb.end(); i++){
+				const Quad& phi = quads[i];
+				if (phi.getOp() != PHI_QUAD){ break; }
+				copies.push_back(std::make_pair(phi.getDst(),
+					proc->getPhiArgs(phi)[j]));
+			}
+			if (copies.empty()){ break; }
+			found = true;
+
+			BlockId pred = preds[j];
+			const BasicBlock& pb = cfg->getBlock(pred);
+			const Quad& last = quads[pb.end() - 1];
+			if (pb.getSuccs().size() == 1){
+				Copies& dst = endCopies[pred];
+				dst.insert(dst.end(), copies.begin(), copies.end());
+			} else if (cfg->blockOfLabel(last.getTarget()) != bb.getId()){
+				Copies& dst = fallCopies[pred];
+				dst.insert(dst.end(), copies.begin(), copies.end());
+			} else {
+				Split split;
+				split.label = proc->makeLabel();
+				split.target = last.getTarget();
+				split.copies = copies;
+				retargets[pred] = split.label;
+				splits.push_back(split);
+			}
+		}
+	}
+	if (!found){
+		proc->clearPhis();
+		return;
+	}
+
+	std::vector<Quad> body;
+	Opd tmp = Opd::none();
+	LabelId pending = NO_LABEL;
+	auto emit = [&](Quad quad){
+		if (pending != NO_LABEL){
+			quad.setLabel(prog->getLabel(pending));
+			pending = NO_LABEL;
+		}
+		body.push_back(quad);
+	};
+	auto emitCopies = [&](const Copies& copies){
+		for (const Quad& copy : sequentializeCopies(proc, copies, tmp)){
+			emit(copy);
+		}
+	};
+
+	for (BlockId block = 0; block < cfg->exit(); block++){
+		const BasicBlock& bb = cfg->getBlock(block);
+		for (size_t i = bb.first(); i < bb.end(); i++){
+			Quad quad = quads[i];
+			if (quad.hasLabel()){
+				pending = quad.getLabel();
+				quad.clearLabel();
+			}
+			if (quad.getOp() == PHI_QUAD){ continue; }
+			if (i + 1 < bb.end()){
+				emit(quad);
+				continue;
+			}
+
+			//The last quad of the block
+			if (quad.getOp() == GOTO_QUAD){
+				emitCopies(endCopies[block]);
+				emit(quad);
+				continue;
+			}
+			if (quad.getOp() == IFZ_QUAD && bb.getSuccs().size() == 1){
+				//Both edges lead to the same place
+				quad = Quad::nop();
+			}
+			if (retargets[block] != nullptr){
+				quad.setTarget(retargets[block]);
+			}
+			emit(quad);
+			emitCopies(endCopies[block]);
+			emitCopies(fallCopies[block]);
+		}
+		//A block made only of phis still needs its label
+		if (pending != NO_LABEL){
+			emit(Quad::nop());
+		}
+	}
+
+	if (!splits.empty()){
+		if (body.empty() || (body.back().getOp() != GOTO_QUAD
+			&& body.back().getOp() != EXIT_QUAD)){
+			body.push_back(Quad::jump(proc->getLeaveLabel()));
+		}
+		for (const Split& split : splits){
+			pending = split.label->getId();
+			emitCopies(split.copies);
+			emit(Quad::jump(prog->getLabel(split.target)));
+		}
+	}
+
+	proc->editQuads() = body;
+	proc->clearPhis();
+}
+
+}
@@ -0,0 +1,28 @@
+#ifndef DREWNO_MARS_SSA_HPP
+#define DREWNO_MARS_SSA_HPP
+
+#include <utility>
+#include <vector>
+#include "3ac.hpp"
+
+namespace drewno_mars{
+
+//Put a procedure into (pruned) SSA form: phis are placed on the
+// iterated dominance frontier of each vreg's definitions, where
+// the vreg is live, and every definition of a local, formal or
+// temporary gets a fresh vreg. Globals are left alone.
+void toSSA(Procedure * proc);
+
+//Replace the phis of an SSA procedure with copies on the incoming
+// edges, splitting critical edges. Must run before codegen.
+void fromSSA(Procedure * proc);
+
+//Order a parallel copy (all sources read before any destination
+// is written) into a sequence of assign quads, breaking cycles
+// through tmp, which is only created if needed.
+std::vector<Quad> sequentializeCopies(Procedure * proc,
+	const std::vector<std::pair<Opd, Opd>>& copies, Opd& tmp);
+
+}
+
+#endif
@@ -0,0 +1,145 @@
+#include "opt.hpp"
+
+namespace drewno_mars{
+
+//The end of a call in tail position: past the call at callIdx,
+// an optional getret/setret of the same temp and then either a
+// jump to the leave label or the end of the body. Returns the
+// index of that jump (or the body size), or SIZE_MAX if the call
+// is not in tail position.
+static size_t tailEnd(const Procedure * proc, size_t callIdx){
+	const std::vector<Quad>& quads = proc->getQuads();
+	size_t at = callIdx + 1;
+	if (at + 1 < quads.size() && quads[at].getOp() == GETRET_QUAD){
+		const Quad& getRet = quads[at];
+		const Quad& setRet = quads[at + 1];
+		if (setRet.getOp() != SETRET_QUAD
+			|| setRet.getSrc1() != getRet.getDst()
+			|| getRet.hasLabel() || setRet.hasLabel()){
+			return SIZE_MAX;
+		}
+		at += 2;
+	}
+	if (at == quads.size()){ return at; }
+	const Quad& jump = quads[at];
+	if (jump.getOp() == GOTO_QUAD
+		&& jump.getTarget() == proc->getLeave().getLabel()){
+		return at;
+	}
+	return SIZE_MAX;
+}
+
+//The first of the setargs feeding the call at callIdx, provided
+// they are all there and none of them but the first starts a
+// block; SIZE_MAX otherwise
+static size_t firstSetArg(const Procedure * proc, size_t callIdx,
+	size_t numArgs){
+	const std::vector<Quad>& quads = proc->getQuads();
+	if (numArgs > callIdx || quads[callIdx].hasLabel()){ return SIZE_MAX; }
+	size_t first = callIdx - numArgs;
+	for (size_t i = first; i < callIdx; i++){
+		if (quads[i].getOp() != SETARG_QUAD
+			|| quads[i].getIndex() != i - first + 1
+			|| (i > first && quads[i].hasLabel())){
+			return SIZE_MAX;
+		}
+	}
+	return first;
+}
+
+static bool callsSelf(const Procedure * proc, const Quad& call){
+	const GlobalInfo& info = proc->getProg()->getGlobalInfo(call.getSrc1());
+	return info.sym->getKind() == FN && info.sym->getName() == proc->getName();
+}
+
+size_t loopSelfTailCalls(Procedure * proc){
+	//The formals are read once at the top of the body; the loop
+	// starts right after
+	const std::vector<Opd>& formals = proc->getFormals();
+	size_t numFormals = formals.size();
+	const std::vector<Quad>& body = proc->getQuads();
+	if (body.size() <= numFormals){ return 0; }
+	for (size_t i = 0; i < numFormals; i++){
+		if (formals[i].isNone() || body[i].getOp() != GETARG_QUAD
+			|| body[i].getIndex() != i + 1 || body[i].getDst() != formals[i]){
+			return 0;
+		}
+	}
+
+	IRProgram * prog = proc->getProg();
+	Label * top = nullptr;
+	size_t looped = 0;
+	//Backwards, so each rewrite leaves the calls before it in place
+	for (size_t i = proc->getQuads().size(); i-- > numFormals; ){
+		const std::vector<Quad>& quads = proc->getQuads();
+		if (quads[i].getOp() != CALL_QUAD || !callsSelf(proc, quads[i])){
+			continue;
+		}
+		size_t end = tailEnd(proc, i);
+		size_t first = firstSetArg(proc, i, numFormals);
+		if (end == SIZE_MAX || first == SIZE_MAX || first < numFormals){
+			continue;
+		}
+		//Keep a labeled return; other paths still go through it
+		if (end < quads.size() && !quads[end].hasLabel()){ end++; }
+
+		//All arguments are read before any formal is written
+		std::vector<Quad> loop;
+		std::vector<Opd> tmps;
+		for (size_t a = 0; a < numFormals; a++){
+			Opd tmp = proc->makeTmp(proc->widthOf(formals[a]));
+			loop.push_back(Quad::assign(tmp, quads[first + a].getSrc1()));
+			tmps.push_back(tmp);
+		}
+		for (size_t a = 0; a < numFormals; a++){
+			loop.push_back(Quad::assign(formals[a], tmps[a]));
+		}
+		std::vector<Quad>& edited = proc->editQuads();
+		if (top == nullptr){
+			Quad& start = edited[numFormals];
+			if (!start.hasLabel()){ start.setLabel(proc->makeLabel()); }
+			top = prog->getLabel(start.getLabel());
+		}
+		loop.push_back(Quad::jump(top));
+		if (edited[first].hasLabel()){
+			loop[0].setLabel(prog->getLabel(edited[first].getLabel()));
+		}
+		edited.erase(edited.begin() + static_cast<long>(first),
+			edited.begin() + static_cast<long>(end));
+		edited.insert(edited.begin() + static_cast<long>(first),
+			loop.begin(), loop.end());
+		looped++;
+		i = first;
+	}
+	return looped;
+}
+
+size_t markTailCalls(Procedure * proc){
+	IRProgram * prog = proc->getProg();
+	size_t marked = 0;
+	for (size_t i = proc->getQuads().size(); i-- > 0; ){
+		const std::vector<Quad>& quads = proc->getQuads();
+		if (quads[i].getOp() != CALL_QUAD){ continue; }
+		//Arguments on the stack would have to go where our own
+		// return address is
+		const GlobalInfo& callee = prog->getGlobalInfo(quads[i].getSrc1());
+		size_t numArgs = callee.sym->getDataType()->asFn()
+			->getFormalTypes()->count();
+		size_t end = tailEnd(proc, i);
+		if (numArgs > 6 || end == SIZE_MAX){ continue; }
+		if (end < quads.size() && !quads[end].hasLabel()){ end++; }
+
+		std::vector<Quad>& edited = proc->editQuads();
+		Quad tail = Quad::tailCall(edited[i].getSrc1());
+		if (edited[i].hasLabel()){
+			tail.setLabel(prog->getLabel(edited[i].getLabel()));
+		}
+		edited[i] = tail;
+		edited.erase(edited.begin() + static_cast<long>(i + 1),
+			edited.begin() + static_cast<long>(end));
+		marked++;
+	}
+	return marked;
+}
+
+}
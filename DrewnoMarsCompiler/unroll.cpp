@@ -0,0 +1,279 @@
+#include "opt.hpp"
+#include "cfg.hpp"
+
+namespace drewno_mars{
+
+//A loop of one block, [first, last], closed by an ifz on a
+// comparison of a counter against a bound that the body does not
+// change. The counter is bumped by a constant step ahead of the
+// comparison, and the loop goes around again as long as
+// "iv cont bound" holds.
+struct CountedLoop{
+	size_t first;
+	size_t last;
+	Opd iv;
+	int64_t step;
+	Opd bound;
+	BinOp cont;
+	Opd cond;
+};
+
+//The quads an unrolled loop may take up at -O1, -O2 and -O3
+static size_t unrollBudget(int level){
+	return level >= 3 ? 128 : level == 2 ? 64 : 16;
+}
+
+//The trip count above which a loop is never fully unrolled
+static const size_t MAX_FULL_TRIPS = 64;
+
+static bool matchLoop(const Procedure * proc, const BasicBlock& block,
+	CountedLoop& loop){
+	const std::vector<Quad>& quads = proc->getQuads();
+	if (block.size() < 3){ return false; }
+	loop.first = block.first();
+	loop.last = block.end() - 1;
+	const Quad& test = quads[loop.last];
+	if (test.getOp() != IFZ_QUAD || !quads[loop.first].hasLabel()
+		|| test.getTarget() != quads[loop.first].getLabel()){
+		return false;
+	}
+	loop.cond = test.getSrc1();
+
+	//The comparison feeding the ifz, and what each vreg's only
+	// definition in the body is
+	size_t testIdx = SIZE_MAX;
+	HashMap<uint32_t, size_t> defs;
+	HashMap<uint32_t, size_t> numDefs;
+	for (size_t i = loop.first; i < loop.last; i++){
+		Opd dst = quads[i].getDst();
+		if (!dst.isVReg()){ continue; }
+		defs[dst.index()] = i;
+		numDefs[dst.index()]++;
+		if (dst == loop.cond){ testIdx = i; }
+	}
+	if (testIdx == SIZE_MAX){ return false; }
+	const Quad& cmp = quads[testIdx];
+	if (cmp.getOp() != BINOP_QUAD || !loop.cond.isVReg()){ return false; }
+	BinOp op = cmp.getBinOp();
+	if (op != EQ64 && op != NEQ64 && op != LT64 && op != GT64
+		&& op != LTE64 && op != GTE64){
+		return false;
+	}
+	loop.cont = negateCompare(op);
+
+	for (int side = 0; side < 2; side++){
+		Opd iv = side == 0 ? cmp.getSrc1() : cmp.getSrc2();
+		Opd bound = side == 0 ? cmp.getSrc2() : cmp.getSrc1();
+		if (!iv.isVReg() || proc->widthOf(iv) != 8
+			|| numDefs[iv.index()] != 1 || defs[iv.index()] > testIdx){
+			continue;
+		}
+		if (!bound.isConst() && !bound.isVReg()){ continue; }
+		if (bound.isVReg() && numDefs[bound.index()] != 0){ continue; }
+		const Quad& update = quads[defs[iv.index()]];
+		int64_t step;
+		if (update.getOp() != BINOP_QUAD || update.getSrc1() != iv
+			|| !constValue(proc, update.getSrc2(), step)){
+			continue;
+		}
+		if (update.getBinOp() == SUB64 && step != INT64_MIN){
+			step = -step;
+		} else if (update.getBinOp() != ADD64){
+			continue;
+		}
+		if (step == 0){ continue; }
+		loop.iv = iv;
+		loop.bound = bound;
+		loop.step = step;
+		if (side == 1){ loop.cont = swapCompare(loop.cont); }
+		return true;
+	}
+	return false;
+}
+
+//The number of times a loop entered with the counter at init
+// goes around, if the bound is a constant and that is at most
+// MAX_FULL_TRIPS
+static size_t tripCount(const Procedure * proc, const CountedLoop& loop,
+	int64_t init){
+	int64_t bound;
+	if (!constValue(proc, loop.bound, bound)){ return SIZE_MAX; }
+	int64_t val = init;
+	for (size_t trips = 1; trips <= MAX_FULL_TRIPS; trips++){
+		int64_t again;
+		foldBinOp(ADD64, val, loop.step, val);
+		foldBinOp(loop.cont, val, bound, again);
+		if (!again){ return trips; }
+	}
+	return SIZE_MAX;
+}
+
+//The constant the counter holds on entry, set in the block that
+// falls into the loop
+static bool initValue(const Procedure * proc, const BasicBlock& pred,
+	const CountedLoop& loop, int64_t& init){
+	const std::vector<Quad>& quads = proc->getQuads();
+	for (size_t i = pred.end(); i-- > pred.first(); ){
+		if (quads[i].getDst() != loop.iv){ continue; }
+		return quads[i].getOp() == ASSIGN_QUAD
+			&& constValue(proc, quads[i].getSrc1(), init);
+	}
+	return false;
+}
+
+//The body of the loop without its closing ifz, unlabeled
+static std::vector<Quad> loopBody(const Procedure * proc,
+	const CountedLoop& loop){
+	const std::vector<Quad>& quads = proc->getQuads();
+	std::vector<Quad> body(quads.begin() + static_cast<long>(loop.first),
+		quads.begin() + static_cast<long>(loop.last));
+	body[0].clearLabel();
+	return body;
+}
+
+static void fullyUnroll(Procedure * proc, const CountedLoop& loop,
+	size_t trips){
+	std::vector<Quad> body = loopBody(proc, loop);
+	std::vector<Quad> unrolled;
+	for (size_t t = 0; t < trips; t++){
+		unrolled.insert(unrolled.end(), body.begin(), body.end());
+	}
+	std::vector<Quad>& quads = proc->editQuads();
+	quads.erase(quads.begin() + static_cast<long>(loop.first),
+		quads.begin() + static_cast<long>(loop.last + 1));
+	quads.insert(quads.begin() + static_cast<long>(loop.first),
+		unrolled.begin(), unrolled.end());
+}
+
+//Put a loop with factor copies of the body ahead of the original,
+// which is left to run the remaining iterations. The copies run
+// only while factor more iterations are sure to follow; for a
+// counter that moves toward its bound, that is while
+// "iv cont bound - (factor - 1) * step" holds. Returns false,
+// changing nothing, where that bound might overflow.
+static bool partiallyUnroll(Procedure * proc, const CountedLoop& loop,
+	size_t factor, std::set<LabelId>& done){
+	IRProgram * prog = proc->getProg();
+	int64_t ahead;
+	if (__builtin_mul_overflow(static_cast<int64_t>(factor - 1), loop.step,
+		&ahead)){
+		return false;
+	}
+	size_t condWidth = proc->widthOf(loop.cond);
+	std::vector<Quad> pre;
+	Label * top = prog->getLabel(proc->getQuads()[loop.first].getLabel());
+	Opd limit = Opd::none();
+	int64_t bound;
+	if (constValue(proc, loop.bound, bound)){
+		int64_t lim;
+		if (__builtin_sub_overflow(bound, ahead, &lim)){ return false; }
+		limit = prog->makeInt(lim);
+	} else {
+		//Skip straight to the original loop where the bound is too
+		// close to the end of the range
+		Opd ok = proc->makeTmp(condWidth);
+		if (loop.step > 0){
+			pre.push_back(Quad::binOp(ok, GTE64, loop.bound,
+				prog->makeInt(INT64_MIN + ahead)));
+		} else {
+			pre.push_back(Quad::binOp(ok, LTE64, loop.bound,
+				prog->makeInt(INT64_MAX + ahead)));
+		}
+		pre.push_back(Quad::ifz(ok, top));
+		limit = proc->makeTmp(8);
+		pre.push_back(Quad::binOp(limit, SUB64, loop.bound,
+			prog->makeInt(ahead)));
+	}
+	Opd enough = proc->makeTmp(condWidth);
+	pre.push_back(Quad::binOp(enough, loop.cont, loop.iv, limit));
+	pre.push_back(Quad::ifz(enough, top));
+
+	std::vector<Quad> body = loopBody(proc, loop);
+	Label * unrolledTop = proc->makeLabel();
+	size_t bodyStart = pre.size();
+	for (size_t f = 0; f < factor; f++){
+		pre.insert(pre.end(), body.begin(), body.end());
+	}
+	pre[bodyStart].setLabel(unrolledTop);
+	Opd fewer = proc->makeTmp(condWidth);
+	pre.push_back(Quad::binOp(fewer, negateCompare(loop.cont), loop.iv,
+		limit));
+	pre.push_back(Quad::ifz(fewer, unrolledTop));
+	Opd stop = proc->makeTmp(condWidth);
+	pre.push_back(Quad::binOp(stop, negateCompare(loop.cont), loop.iv,
+		loop.bound));
+	pre.push_back(Quad::ifz(stop, top));
+
+	std::vector<Quad>& quads = proc->editQuads();
+	Label * after;
+	if (loop.last + 1 < quads.size()){
+		Quad& next = quads[loop.last + 1];
+		if (!next.hasLabel()){ next.setLabel(proc->makeLabel()); }
+		after = prog->getLabel(next.getLabel());
+	} else {
+		after = proc->getLeaveLabel();
+	}
+	pre.push_back(Quad::jump(after));
+	done.insert(unrolledTop->getId());
+	quads.insert(quads.begin() + static_cast<long>(loop.first),
+		pre.begin(), pre.end());
+	return true;
+}
+
+size_t unrollLoops(Procedure * proc, int level, OptStats& stats){
+	size_t budget = unrollBudget(level);
+	std::set<LabelId> done;
+	size_t unrolled = 0;
+	while (true){
+		const ControlFlowGraph * cfg = proc->getCFG();
+		const std::vector<Quad>& quads = proc->getQuads();
+		bool changed = false;
+		for (const BasicBlock& block : cfg->getBlocks()){
+			CountedLoop loop;
+			if (block.getId() == cfg->entry() || !matchLoop(proc, block, loop)
+				|| done.count(quads[loop.first].getLabel()) > 0){
+				continue;
+			}
+			//Entered only by falling in from the block before
+			const BasicBlock& pred = cfg->getBlock(block.getId() - 1);
+			const Quad& into = quads[pred.end() - 1];
+			if (block.getPreds().size() != 2 || into.getOp() == GOTO_QUAD
+				|| into.getOp() == EXIT_QUAD || into.getOp() == TAILCALL_QUAD
+				|| (into.getOp() == IFZ_QUAD
+					&& into.getTarget() == quads[loop.first].getLabel())){
+				continue;
+			}
+			done.insert(quads[loop.first].getLabel());
+			size_t bodySize = loop.last - loop.first;
+			int64_t init;
+			size_t trips = initValue(proc, pred, loop, init)
+				? tripCount(proc, loop, init) : SIZE_MAX;
+			if (trips != SIZE_MAX && trips * bodySize <= budget){
+				fullyUnroll(proc, loop, trips);
+				stats.add("unroll.loops-unrolled-fully", 1);
+				changed = true;
+				break;
+			}
+			//Partial unrolling only pays for itself from -O2 on
+			if (level < 2 || (loop.step > 0) != (loop.cont == LT64
+				|| loop.cont == LTE64)
+				|| (loop.cont != LT64 && loop.cont != LTE64
+				&& loop.cont != GT64 && loop.cont != GTE64)){
+				continue;
+			}
+			size_t factor = 8;
+			while (factor > 1 && factor * bodySize > budget){ factor /= 2; }
+			if (factor < 2 || !partiallyUnroll(proc, loop, factor, done)){
+				continue;
+			}
+			stats.add("unroll.loops-unrolled-partially", 1);
+			changed = true;
+			break;
+		}
+		if (!changed){ break; }
+		unrolled++;
+	}
+	return unrolled;
+}
+
+}
@@ -1,615 +1,892 @@
+#include <algorithm>
 #include <ostream>
 #include "3ac.hpp"
+#include "regalloc.hpp"
+#include "opt.hpp"
+#include "peephole.hpp"
 
 namespace drewno_mars
 {
 
-	void IRProgram::allocGlobals()
-	{
-		// Choose a label for each global
-		for (auto itr : globals)
-		{
-			SemSymbol *semSymbol = itr.first;
-			SymOpd *symOpd = itr.second;
-			std::string lbl = "gbl_" + semSymbol->getName();
-			symOpd->setMemoryLoc(lbl);
-		}
-	}
-
 	void IRProgram::datagenX64(std::ostream &out)
 	{
 		out << ".data\n";
-		for (auto itr : globals) {
-			if (itr.first->getName() == "console") { continue; }
-			SymOpd* symOpd = itr.second;
-			out << symOpd->getMemoryLoc() << ": .quad 0\n";
+		for (size_t i = 0; i < globals.size(); i++) {
+			if (globals[i].sym->getName() == "console") { continue; }
+			Opd global = Opd::global(static_cast<uint32_t>(i));
+			out << globalLoc(global) << ": .quad 0\n";
 		}
 
-		for (auto itr : strings) {
-			LitOpd* strLbl = itr.first;
-			std::string myContent = itr.second;
-			out << strLbl->valString() + ": .asciz "
-				<< myContent << "\n";
-	}
+		for (size_t i = 0; i < strings.size(); i++) {
+			out << "str_" << i << ": .asciz "
+				<< strings[i] << "\n";
+		}
 		// Put this directive after you write out strings
 		//  so that everything is aligned to a quadword value
 		//  again
 		out << ".align 8\n";
 	}
 
-	void IRProgram::toX64(std::ostream &out)
+	void IRProgram::toX64(std::ostream &out, const X64Options &opts)
 	{
-		allocGlobals();
 		datagenX64(out);
 		// Iterate over each procedure and codegen it
 		out << ".globl main\n";
 		out << ".text\n";
 		for (auto procedure : *procs)
 		{
-			procedure->toX64(out);
+			procedure->toX64(out, opts);
 		}
 	}
 
-	void Procedure::allocLocals()
+	void Procedure::allocLocals(const X64Options &opts)
 	{
-		// Allocate space for locals
-		// Iterate over each procedure and codegen it
-		int offset = -24;
-		for (auto localEntry : locals)
+		// Below the saved %rbp and return address come the
+		// callee-saved registers we use, then the slots of the
+		// virtual registers left out of the machine registers
+		savedRegs.clear();
+		for (const VRegInfo &info : vregs)
 		{
-			SymOpd *localOperand = localEntry.second;
-			std::string memoryLocation = std::to_string(offset) + "(%rbp)";
-			localOperand->setMemoryLoc(memoryLocation);
-			offset -= int(localOperand->getWidth());
+			if (info.inReg && RegUtils::calleeSaved(info.reg)
+				&& std::find(savedRegs.begin(), savedRegs.end(), info.reg)
+					== savedRegs.end())
+			{
+				savedRegs.push_back(info.reg);
+			}
 		}
-		for (auto temporary : temps)
+		std::sort(savedRegs.begin(), savedRegs.end());
+		int offset = -24 - 8 * int(savedRegs.size());
+		size_t size = 8 * savedRegs.size();
+		if (opts.shareSlots)
 		{
-			AuxOpd *auxiliaryOperand = temporary;
-			std::string memoryLocation = std::to_string(offset) + "(%rbp)";
-			auxiliaryOperand->setMemoryLoc(memoryLocation);
-			offset -= int(auxiliaryOperand->getWidth());
+			size += packSlots(this, offset, opts.stats);
 		}
-		for (auto formalParam : formals)
+		else
 		{
-			SymOpd *formalOperand = formalParam;
-			std::string memoryLocation = std::to_string(offset) + "(%rbp)";
-			formalOperand->setMemoryLoc(memoryLocation);
-			offset -= int(formalOperand->getWidth());
+			for (VRegInfo &info : vregs)
+			{
+				if (info.inReg) { continue; }
+				info.frameOffset = offset;
+				offset -= int(info.width);
+				size += info.width;
+			}
 		}
-	}
-
-	void Procedure::toX64(std::ostream &out)
-	{
-		// Allocate all locals
-		allocLocals();
+		frameSize = size + (16 - (size % 16)) % 16;
 
-		enter->codegenLabels(out);
-		enter->codegenX64(out);
-		out << "# Fn body " << myName << "\n";
-		for (auto quad : *bodyQuads)
+		// A procedure that calls nothing needs no aligned stack,
+		// so with nothing to keep in memory it needs no frame
+		bool leaf = std::none_of(bodyQuads.begin(), bodyQuads.end(),
+			makesCall);
+		if (opts.elideLeafFrames && leaf && frameSize == 0)
+		{
+			frameKind = NO_FRAME;
+		}
+		else if (opts.omitFramePointer)
 		{
-			quad->codegenLabels(out);
-			out << " # " << quad->toString() << "\n";
-			quad->codegenX64(out);
+			frameKind = RSP_FRAME;
 		}
-		out << "# Fn epilogue " << myName << "\n";
-		leave->codegenLabels(out);
-		leave->codegenX64(out);
+		else
+		{
+			frameKind = RBP_FRAME;
+		}
+		if (opts.stats != nullptr)
+		{
+			opts.stats->add("frame.leaf-frames-elided",
+				frameKind == NO_FRAME ? 1 : 0);
+		}
+		stackDepth = 0;
 	}
 
-	void Quad::codegenLabels(std::ostream &out)
+	void Quad::codegenLabels(AsmList &out, const Procedure *proc) const
 	{
-		if (labels.empty())
+		if (!hasLabel())
 		{
 			return;
 		}
+		out.label(proc->labelName(myLabel));
+	}
 
-		size_t numLabels = labels.size();
-		size_t labelIdx = 0;
-		for (Label *label : labels)
+	static bool isByteOp(BinOp op)
+	{
+		return op >= ADD8;
+	}
+
+	// The setcc instruction materializing a comparison
+	static std::string setccOp(BinOp op)
+	{
+		switch (op)
 		{
-			out << label->getName() << ": ";
-			if (labelIdx != numLabels - 1)
-			{
-				out << "\n";
-			}
-			labelIdx++;
+		case EQ64: case EQ8: return "sete";
+		case NEQ64: case NEQ8: return "setne";
+		case LT64: case LT8: return "setl";
+		case GT64: case GT8: return "setg";
+		case LTE64: case LTE8: return "setle";
+		case GTE64: case GTE8: return "setge";
+		default: break;
 		}
+		throw new InternalError("Not a comparison");
 	}
-
-	void BinOpQuad::codegenX64(std::ostream &out)
+
+	// The two-operand instruction for arithmetic and logic ops
+	static std::string arithOp(BinOp op)
 	{
-		BinOp op = this->getOp();
-		if (op == ADD64)
+		switch (op)
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "addq "
-				<< "%rbx, "
-				<< "%rax\n";
-			dst->genStoreVal(out, A);
+		case ADD64: return "addq";
+		case SUB64: return "subq";
+		case MULT64: return "imulq";
+		case AND64: return "andq";
+		case OR64: return "orq";
+		case ADD8: return "addb";
+		case SUB8: return "subb";
+		case AND8: return "andb";
+		case OR8: return "orb";
+		default: break;
 		}
+		throw new InternalError("Not an arithmetic op");
+	}
+
+	// Whether opd is an integer constant that fits the 32-bit
+	// immediate field of an instruction
+	static bool isImm(const Procedure *proc, Opd opd)
+	{
+		if (!opd.isConst()) { return false; }
+		const ConstInfo &info = proc->getProg()->getConst(opd);
+		return info.kind == INT_CONST && info.value >= INT32_MIN
+			&& info.value <= INT32_MAX;
+	}
+
+	static bool isReg(const Procedure *proc, Opd opd)
+	{
+		return opd.isVReg() && proc->getVReg(opd).inReg;
+	}
+
+	static bool isMem(const Procedure *proc, Opd opd)
+	{
+		return opd.isGlobal() || (opd.isVReg() && !proc->getVReg(opd).inReg);
+	}
+
+	// Whether an instruction can name opd as it is, rather than
+	// through a scratch register
+	static bool isDirect(const Procedure *proc, Opd opd)
+	{
+		return isImm(proc, opd) || isReg(proc, opd) || isMem(proc, opd);
+	}
 
-		else if (op == SUB64)
+	// How an instruction names a direct operand
+	static AsmArg operand(const Procedure *proc, Opd opd)
+	{
+		if (isImm(proc, opd))
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "subq "
-				<< "%rbx, "
-				<< "%rax\n";
-			dst->genStoreVal(out, A);
+			return AsmArg::makeImm(proc->getProg()->constString(opd));
 		}
-		else if (op == DIV64)
+		if (isReg(proc, opd))
 		{
-			out << "cqto\n";
-			out << "idivq " << RegUtils::reg64(B) << "\n";
-			dst->genStoreVal(out, A);
+			return AsmArg::makeReg(proc->getVReg(opd).reg, 8);
 		}
-		else if (op == MULT64)
+		return AsmArg::makeMem(proc->memLoc(opd));
+	}
+
+	// Whether a and b are held in the same register or slot
+	static bool sameLoc(const Procedure *proc, Opd a, Opd b)
+	{
+		return !isImm(proc, a) && !isImm(proc, b) && isDirect(proc, a)
+			&& isDirect(proc, b) && operand(proc, a) == operand(proc, b);
+	}
+
+	// The source operand of a two-operand instruction whose other
+	// operand is in memory or not, loading it into %r11 where it
+	// cannot be named as it is
+	static AsmArg sourceOperand(AsmList &out, Procedure *proc,
+		Opd opd, bool otherInMem)
+	{
+		if (isImm(proc, opd) || isReg(proc, opd)
+			|| (isMem(proc, opd) && !otherInMem))
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "imulq " << RegUtils::reg64(B) << "\n";
-			dst->genStoreVal(out, A);
+			return operand(proc, opd);
 		}
-		else if (op == EQ64)
+		proc->genLoadVal(out, opd, R11);
+		return AsmArg::makeReg(R11, 8);
+	}
+
+	// Compare the sources of a 64-bit comparison, as
+	// "cmpq $imm, reg" and with memory operands where the
+	// instruction takes them. Returns the comparison the flags
+	// answer, which is swapped along with the operands.
+	static BinOp genCompare(AsmList &out, Procedure *proc, const Quad &quad)
+	{
+		BinOp op = quad.getBinOp();
+		Opd lhs = quad.getSrc1();
+		Opd rhs = quad.getSrc2();
+		if (!isReg(proc, lhs) && !isMem(proc, lhs) && isDirect(proc, rhs)
+			&& !isImm(proc, rhs))
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "cmpq "
-				<< "%rbx, "
-				<< "%rax\n";
-			out << "sete "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+			std::swap(lhs, rhs);
+			op = swapCompare(op);
 		}
-		else if (op == NEQ64)
+		AsmArg left = AsmArg::makeReg(A, 8);
+		if (isReg(proc, lhs) || isMem(proc, lhs)) { left = operand(proc, lhs); }
+		else { proc->genLoadVal(out, lhs, A); }
+		AsmArg right = sourceOperand(out, proc, rhs, isMem(proc, lhs));
+		out.instr("cmpq", {right, left});
+		return op;
+	}
+
+	// The byte-wide ops, through %al and %r11b
+	static void genByteBinOp(AsmList &out, Procedure *proc,
+		const Quad &quad)
+	{
+		BinOp op = quad.getBinOp();
+		AsmArg al = AsmArg::makeReg(A, 1);
+		AsmArg r11b = AsmArg::makeReg(R11, 1);
+		proc->genLoadVal(out, quad.getSrc1(), A);
+		proc->genLoadVal(out, quad.getSrc2(), R11);
+		if (isCompare(op))
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "cmpq "
-				<< "%rbx, "
-				<< "%rax\n";
-			out << "setne "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+			out.instr("cmpb", {r11b, al});
+			out.instr(setccOp(op), {al});
 		}
-		else if (op == LT64)
+		else if (op == DIV8)
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "cmpq "
-				<< "%rbx, "
-				<< "%rax\n";
-			out << "setl "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+			AsmArg ax = { REG_ARG, A, 2, "%ax" };
+			out.instr("movsbw", {al, ax});
+			out.instr("idivb", {r11b});
 		}
-		else if (op == GT64)
+		else if (op == MULT8)
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "cmpq "
-				<< "%rbx, "
-				<< "%rax\n";
-			out << "setg "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+			out.instr("imulb", {r11b});
 		}
-		else if (op == LTE64)
+		else
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "cmpq "
-				<< "%rbx, "
-				<< "%rax\n";
-			out << "setle "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+			out.instr(arithOp(op), {r11b, al});
 		}
+		proc->genStoreVal(out, quad.getDst(), A);
+	}
 
-		else if (op == GTE64)
+	// dst := dst op src, straight on dst's register or slot
+	static bool genInPlace(AsmList &out, Procedure *proc, BinOp op,
+		Opd dst, Opd src)
+	{
+		AsmArg loc = operand(proc, dst);
+		int64_t val = 0;
+		if (isImm(proc, src))
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "cmpq "
-				<< "%rbx, "
-				<< "%rax\n";
-			out << "setge "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+			val = proc->getProg()->getConst(src).value;
 		}
-
-		else if (op == AND64)
+		if ((op == ADD64 || op == SUB64) && isImm(proc, src)
+			&& (val == 1 || val == -1))
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "andq "
-				<< "%rbx, "
-				<< "%rax\n";
-			dst->genStoreVal(out, A);
+			out.instr((op == ADD64) == (val == 1) ? "incq" : "decq", {loc});
+			return true;
 		}
-
-		else if (op == OR64)
-		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "orq "
-				<< "%rax, "
-				<< "%rax\n";
-			dst->genStoreVal(out, A);
+		if (op == MULT64)
+		{
+			// imul only writes a register
+			if (!isReg(proc, dst)) { return false; }
+			if (isImm(proc, src))
+			{
+				out.instr("imulq", {operand(proc, src), loc, loc});
+				return true;
+			}
 		}
-
-		else if (op == ADD8)
-		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "addb "
-				<< "%bl, "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
-		}
-
-		else if (op == SUB8)
-		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "subb "
-				<< "%bl, "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+		AsmArg from = sourceOperand(out, proc, src, isMem(proc, dst));
+		out.instr(arithOp(op), {from, loc});
+		return true;
+	}
+
+	// dst := src1 op src2 with dst in a register: leaq for sums,
+	// three-operand imulq by an immediate, or a move into dst and
+	// the op on it where that leaves src2 alone
+	static bool genIntoReg(AsmList &out, Procedure *proc, BinOp op,
+		Opd dst, Opd src1, Opd src2)
+	{
+		AsmArg reg = operand(proc, dst);
+		if (op == ADD64 && isReg(proc, src1) && isReg(proc, src2))
+		{
+			AsmArg sum = AsmArg::makeMem("(" + operand(proc, src1).text
+				+ ", " + operand(proc, src2).text + ")");
+			out.instr("leaq", {sum, reg});
+			return true;
 		}
-		else if (op == DIV8)
+		if ((op == ADD64 || op == SUB64) && isReg(proc, src1)
+			&& isImm(proc, src2))
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "idivb "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+			int64_t val = proc->getProg()->getConst(src2).value;
+			if (op == SUB64) { val = -val; }
+			if (val >= INT32_MIN && val <= INT32_MAX)
+			{
+				AsmArg sum = AsmArg::makeMem(std::to_string(val) + "("
+					+ operand(proc, src1).text + ")");
+				out.instr("leaq", {sum, reg});
+				return true;
+			}
 		}
-		else if (op == MULT8)
+		if (op == MULT64 && isImm(proc, src2)
+			&& (isReg(proc, src1) || isMem(proc, src1)))
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "imulb "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+			out.instr("imulq", {operand(proc, src2), operand(proc, src1), reg});
+			return true;
 		}
-		else if (op == EQ8)
+		if (sameLoc(proc, dst, src2)) { return false; }
+		proc->genLoadVal(out, src1, proc->getVReg(dst).reg);
+		return genInPlace(out, proc, op, dst, src2);
+	}
+
+	static void genBinOp(AsmList &out, Procedure *proc, const Quad &quad)
+	{
+		BinOp op = quad.getBinOp();
+		if (isByteOp(op))
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "cmpq "
-				<< "%bl, "
-				<< "%al\n";
-			out << "sete "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+			genByteBinOp(out, proc, quad);
+			return;
 		}
-		else if (op == NEQ8)
+		Opd dst = quad.getDst();
+		if (isCompare(op))
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "cmpq "
-				<< "%bl, "
-				<< "%al\n";
-			out << "setne "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+			out.instr(setccOp(genCompare(out, proc, quad)),
+				{AsmArg::makeReg(A, 1)});
+			out.instr("movzbq", {AsmArg::makeReg(A, 1), AsmArg::makeReg(A, 8)});
+			proc->genStoreVal(out, dst, A);
+			return;
 		}
-		else if (op == LT8)
+		Opd src1 = quad.getSrc1();
+		Opd src2 = quad.getSrc2();
+		if (op == DIV64)
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "cmpq "
-				<< "%bl, "
-				<< "%al\n";
-			out << "setl "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+			proc->genLoadVal(out, src1, A);
+			out.instr("cqto");
+			if (isReg(proc, src2) || isMem(proc, src2))
+			{
+				out.instr("idivq", {operand(proc, src2)});
+			}
+			else
+			{
+				proc->genLoadVal(out, src2, R11);
+				out.instr("idivq", {AsmArg::makeReg(R11, 8)});
+			}
+			proc->genStoreVal(out, dst, A);
+			return;
 		}
-		else if (op == GT8)
+		// Keep immediates on the right, and dst's own location on
+		// the left, of the ops that allow it
+		if (op != SUB64 && ((isImm(proc, src1) && !isImm(proc, src2))
+			|| (sameLoc(proc, dst, src2) && !sameLoc(proc, dst, src1))))
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "cmpq "
-				<< "%bl, "
-				<< "%al\n";
-			out << "setg "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+			std::swap(src1, src2);
 		}
-		else if (op == LTE8)
+		if (sameLoc(proc, dst, src1) && genInPlace(out, proc, op, dst, src2))
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "cmpq "
-				<< "%bl, "
-				<< "%al\n";
-			out << "setle "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+			return;
 		}
-
-		else if (op == GTE8)
+		if (isReg(proc, dst) && genIntoReg(out, proc, op, dst, src1, src2))
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "cmpq "
-				<< "%bl, "
-				<< "%al\n";
-			out << "setge "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+			return;
 		}
-
-		else if (op == AND8)
+		proc->genLoadVal(out, src1, A);
+		AsmArg rax = AsmArg::makeReg(A, 8);
+		if (op == MULT64 && isImm(proc, src2))
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "andb "
-				<< "%bl, "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+			out.instr("imulq", {operand(proc, src2), rax, rax});
 		}
-
-		else if (op == OR8)
+		else
 		{
-			src1->genLoadVal(out, A);
-			src2->genLoadVal(out, B);
-			out << "orb "
-				<< "%bl, "
-				<< "%al\n";
-			dst->genStoreVal(out, A);
+			AsmArg from = sourceOperand(out, proc, src2, false);
+			out.instr(arithOp(op), {from, rax});
 		}
+		proc->genStoreVal(out, dst, A);
 	}
 
-	void UnaryOpQuad::codegenX64(std::ostream &out)
+	// Set the flags by comparing a 64-bit value against zero
+	static void genTestZero(AsmList &out, Procedure *proc, Opd opd)
 	{
-		src->genLoadVal(out, A);
-		if (op == NOT64)
-		{
-			out << "cmpq $0, %rax\n"
-				<< "setz %al\n";
-		}
-		else if (op == NEG64)
+		if (isReg(proc, opd))
 		{
-			out << "negq %rax\n";
+			AsmArg reg = operand(proc, opd);
+			out.instr("testq", {reg, reg});
 		}
-		else if (op == NOT8)
+		else if (isMem(proc, opd))
 		{
-			out << "cmpq $0, %al\n"
-				<< "setz %al\n";
+			out.instr("cmpq", {AsmArg::makeImm(0), operand(proc, opd)});
 		}
-		else if (op == NEG8)
+		else
 		{
-			out << "negb %al\n";
+			proc->genLoadVal(out, opd, A);
+			out.instr("cmpq", {AsmArg::makeImm(0), AsmArg::makeReg(A, 8)});
 		}
-		dst->genStoreVal(out, A);
 	}
 
-	void AssignQuad::codegenX64(std::ostream &out)
+	// The conditional jump taken when a comparison fails
+	static std::string jccFalseOp(BinOp op)
 	{
-		src->genLoadVal(out, A);
-		dst->genStoreVal(out, A);
+		switch (op)
+		{
+		case EQ64: case EQ8: return "jne";
+		case NEQ64: case NEQ8: return "je";
+		case LT64: case LT8: return "jge";
+		case GT64: case GT8: return "jle";
+		case LTE64: case LTE8: return "jg";
+		case GTE64: case GTE8: return "jl";
+		default: break;
+		}
+		throw new InternalError("Not a comparison");
 	}
 
-	void ReadQuad::codegenX64(std::ostream &out)
+	// Whether quad computes a comparison or negation read only by
+	// the IFZ right after it, so the two can become one jump
+	static bool isBranchOnly(const Quad &quad, const Quad &next,
+		const std::vector<size_t> &reads)
 	{
-		if (myDst->locString() != "console")
+		Opd dst = quad.getDst();
+		if (next.getOp() != IFZ_QUAD || next.hasLabel() || !dst.isVReg()
+			|| next.getSrc1() != dst || reads[dst.index()] != 1)
 		{
-			myDst->genLoadVal(out, DI);
+			return false;
 		}
-		else
+		if (quad.getOp() == BINOP_QUAD)
 		{
-			out << "movq $1, %rdi\n";
+			return isCompare(quad.getBinOp());
 		}
-		if (myDstType->isInt())
+		return quad.getOp() == UNARYOP_QUAD
+			&& (quad.getUnaryOp() == NOT64 || quad.getUnaryOp() == NOT8);
+	}
+
+	// Jump to target when the comparison or negation computed by
+	// quad is false, without materializing its result
+	static void genBranchOn(AsmList &out, Procedure *proc,
+		const Quad &quad, LabelId target)
+	{
+		AsmArg label = AsmArg::makeLabel(proc->labelName(target));
+		if (quad.getOp() == BINOP_QUAD)
 		{
-			out << "callq getInt\n";
+			BinOp op = quad.getBinOp();
+			if (isByteOp(op))
+			{
+				proc->genLoadVal(out, quad.getSrc1(), A);
+				proc->genLoadVal(out, quad.getSrc2(), R11);
+				out.instr("cmpb", {AsmArg::makeReg(R11, 1), AsmArg::makeReg(A, 1)});
+			}
+			else
+			{
+				op = genCompare(out, proc, quad);
+			}
+			out.instr(jccFalseOp(op), {label});
+			return;
 		}
-		else if (myDstType->isBool())
+		if (quad.getUnaryOp() == NOT8)
 		{
-			out << "callq getBool\n";
+			proc->genLoadVal(out, quad.getSrc1(), A);
+			out.instr("cmpb", {AsmArg::makeImm(0), AsmArg::makeReg(A, 1)});
 		}
-		myDst->genStoreVal(out, A);
-	}
-
-	void MagicQuad::codegenX64(std::ostream &out)
-	{
-		out << "callq magic\n";
+		else
+		{
+			genTestZero(out, proc, quad.getSrc1());
+		}
+		out.instr("jne", {label});
 	}
 
-	void ExitQuad::codegenX64(std::ostream &out)
+	void Procedure::toX64(std::ostream &os, const X64Options &opts)
 	{
-		out << "call exit\n";
-	}
+		if (opts.regAlloc == LINEAR_SCAN_ALLOC)
+		{
+			linearScan(this, opts);
+		}
+		else if (opts.regAlloc == GRAPH_COLOR_ALLOC)
+		{
+			colorGraph(this, opts);
+		}
+		// Allocate all locals
+		allocLocals(opts);
 
-	void WriteQuad::codegenX64(std::ostream &out)
-	{
-		mySrc->genLoadVal(out, DI);
-		if (mySrcType->isInt()) {
-			out << "callq printInt\n";
-		} 
-		else if (mySrcType->isString()) {
-			out << "callq printString\n";
-		} 
-		else if (mySrcType->isBool()) {
-		out << "callq printBool\n";
+		// How often each vreg is read, to tell when a comparison
+		// feeds nothing but the branch after it
+		std::vector<size_t> reads(vregs.size(), 0);
+		for (const Quad &quad : bodyQuads)
+		{
+			if (quad.getSrc1().isVReg()) { reads[quad.getSrc1().index()]++; }
+			if (quad.getSrc2().isVReg()) { reads[quad.getSrc2().index()]++; }
 		}
-}
 
-	void GotoQuad::codegenX64(std::ostream &out)
-	{
-		out << "jmp " << tgt->getName() << "\n";
+		// Gather the instructions to clean them up before they go out
+		AsmList out;
+		enter.codegenLabels(out, this);
+		enter.codegenX64(out, this);
+		out.comment("# Fn body " + myName);
+		for (size_t i = 0; i < bodyQuads.size(); i++)
+		{
+			const Quad &quad = bodyQuads[i];
+			quad.codegenLabels(out, this);
+			out.comment(" # " + quad.toString(this));
+			if (i + 1 < bodyQuads.size() && isBranchOnly(quad,
+				bodyQuads[i + 1], reads))
+			{
+				const Quad &branch = bodyQuads[++i];
+				out.comment(" # " + branch.toString(this));
+				genBranchOn(out, this, quad, branch.getTarget());
+				continue;
+			}
+			quad.codegenX64(out, this);
+		}
+		out.comment("# Fn epilogue " + myName);
+		leave.codegenLabels(out, this);
+		leave.codegenX64(out, this);
+		std::vector<AsmLine> &lines = out.lines();
+		if (opts.peephole)
+		{
+			peephole(lines, opts.stats);
+		}
+		writeAsm(os, lines);
 	}
 
-	void IfzQuad::codegenX64(std::ostream &out)
+	static void genUnaryOp(AsmList &out, Procedure *proc, const Quad &quad)
 	{
-		cnd->genLoadVal(out, DI);
-		out << "cmpq $0, %rdi\n";
-		out << "je " << tgt->toString();
+		if (quad.getUnaryOp() == NEG64
+			&& sameLoc(proc, quad.getDst(), quad.getSrc1()))
+		{
+			out.instr("negq", {operand(proc, quad.getDst())});
+			return;
+		}
+		AsmArg rax = AsmArg::makeReg(A, 8);
+		AsmArg al = AsmArg::makeReg(A, 1);
+		proc->genLoadVal(out, quad.getSrc1(), A);
+		switch (quad.getUnaryOp())
+		{
+		case NOT64:
+			out.instr("cmpq", {AsmArg::makeImm(0), rax});
+			out.instr("sete", {al});
+			out.instr("movzbq", {al, rax});
+			break;
+		case NEG64:
+			out.instr("negq", {rax});
+			break;
+		case NOT8:
+			out.instr("cmpb", {AsmArg::makeImm(0), al});
+			out.instr("sete", {al});
+			break;
+		case NEG8:
+			out.instr("negb", {al});
+			break;
+		}
+		proc->genStoreVal(out, quad.getDst(), A);
 	}
 
-	void NopQuad::codegenX64(std::ostream &out)
+	static std::string calleeLabel(const GlobalInfo &callee)
 	{
-		out << "nop"
-			<< "\n";
+		std::string name = callee.sym->getName();
+		if (name == "main")
+		{
+			return name;
+		}
+		return "fun_" + name;
 	}
 
-	void CallQuad::codegenX64(std::ostream& out)
+	static size_t numFormals(const GlobalInfo &callee)
 	{
-		int numArgs = sym->getDataType()->asFn()->getFormalTypes()->getSize();
-		if (numArgs >= 7 && numArgs % 2 != 0) {
-			out << "pushq $0 \n";
-	}
-		out << "callq fun_" << sym->getName() << "\n";
+		return callee.sym->getDataType()->asFn()->getFormalTypes()->count();
 	}
 
-	void EnterQuad::codegenX64(std::ostream &out)
+	// Arguments past the sixth are pushed
+	static size_t stackArgs(size_t numArgs)
 	{
-		out << "pushq %rbp\n";
-		out << "movq %rsp, %rbp\n";
-		out << "addq $16, %rbp\n";
-		out << "subq $" << myProc->arSize() << ", %rsp\n";
+		return numArgs <= 6 ? 0 : numArgs - 6;
 	}
 
-	void LeaveQuad::codegenX64(std::ostream &out)
+	// When an odd number of args is pushed, a padding word goes
+	// below them so that the stack stays 16-byte aligned at the call
+	static size_t stackPadding(size_t numArgs)
 	{
-		out << "addq $" << myProc->arSize() << ", %rsp\n";
-		out << "popq %rbp\n";
-		out << "retq\n";
+		return stackArgs(numArgs) % 2;
 	}
 
-	void SetArgQuad::codegenX64(std::ostream& out) {
-    // Switch based on the index value
-    switch (index) { 
-        case 1:
-            // Load value into DI register
-            opd->genLoadVal(out, DI);
-            break;
-        case 2:
-            // Load value into SI register
-            opd->genLoadVal(out, SI);
-            break;
-        case 3:
-            // Load value into B register
-            opd->genLoadVal(out, B);    
-            break;
-        case 4:
-            // Load value into C register
-            opd->genLoadVal(out, C);
-            break;
-        case 5:
-            // Load value into D register
-            opd->genLoadVal(out, D);
-            break;    
-        default:
-            // For other indices, load value and push onto stack
-            opd->genLoadVal(out, A);
-            out << "pushq %rax\n";
-    }
-}
-
-	void GetArgQuad::codegenX64(std::ostream& out){
-	std::string memLoc = opd->getMemoryLoc();
-	
-	switch (index) { 
-		case 1:
-			out << "movq " << "%rdi, " << memLoc << "\n";
-			break;
-		case 2:
-			out << "movq " << "%rsi, " << memLoc << "\n";
-			break;
-		case 3:
-			out << "movq " << "%rdx, " << memLoc << "\n";
-			break;
-		case 4:
-			out << "movq " << "%rcx, " << memLoc << "\n";
-			break;
-		case 5:
-			out << "movq " << "%r8, " << memLoc << "\n";
-			break;
-		case 6:
-			out << "movq " << "%r9, " << memLoc << "\n";
-			break;
-		default:
-			size_t numArgs = myProc->getFormals().size();
-			if (numArgs % 2 != 0) numArgs = numArgs + 1;
-			size_t stackIndex = 8 * (numArgs - index);
-			out << "movq " << stackIndex << "(%rbp), %rbx\n";
-			out << "movq %rbx, " << memLoc << "\n";
-			break;
-	}
-}
-
-	void SetRetQuad::codegenX64(std::ostream &out)
+	// Where the prologue saves the idx'th callee-saved register
+	static int savedRegOffset(size_t idx)
 	{
-		opd->genLoadVal(out, A);
+		return -24 - 8 * int(idx);
 	}
 
-	void GetRetQuad::codegenX64(std::ostream &out)
+	// Undo the prologue, leaving %rsp at the return address
+	static void genFrameTeardown(AsmList &out, const Procedure *proc)
 	{
-		opd->genStoreVal(out, A);
+		const std::vector<Register> &saved = proc->getSavedRegs();
+		for (size_t i = 0; i < saved.size(); i++)
+		{
+			out.instr("movq", {AsmArg::makeMem(proc->frameLoc(savedRegOffset(i))),
+				AsmArg::makeReg(saved[i], 8)});
+		}
+		if (proc->getFrameKind() == NO_FRAME) { return; }
+		if (proc->arSize() > 0)
+		{
+			out.instr("addq", {AsmArg::makeImm(int64_t(proc->arSize())),
+				AsmArg::makeReg(SP, 8)});
+		}
+		if (proc->getFrameKind() == RBP_FRAME)
+		{
+			out.instr("popq", {AsmArg::makeReg(BP, 8)});
+		}
 	}
 
-	void LocQuad::codegenX64(std::ostream &out)
+	static void genCall(AsmList &out, Procedure *proc, const Quad &quad)
 	{
-		TODO(Implement me)
+		const GlobalInfo &callee = proc->getProg()->getGlobalInfo(quad.getSrc1());
+		size_t numArgs = numFormals(callee);
+		size_t words = stackArgs(numArgs) + stackPadding(numArgs);
+		if (stackPadding(numArgs) > 0)
+		{
+			out.instr("pushq", {AsmArg::makeImm(0)});
+		}
+		out.instr("callq", {AsmArg::makeLabel(calleeLabel(callee))});
+		if (words > 0)
+		{
+			out.instr("addq", {AsmArg::makeImm(int64_t(8 * words)),
+				AsmArg::makeReg(SP, 8)});
+		}
+		// The args were counted as they were pushed
+		proc->adjustStackDepth(8 * int(stackPadding(numArgs))
+			- 8 * int(words));
 	}
 
-	void SymOpd::genLoadVal(std::ostream &out, Register reg)
+	// A tail call leaves the arguments in their registers, pops
+	// our frame and jumps, so the callee returns to our caller
+	static void genTailCall(AsmList &out, Procedure *proc, const Quad &quad)
 	{
-		out << getMovOp() << " " << getMemoryLoc() << ", " << getReg(reg) << "\n";
+		const GlobalInfo &callee = proc->getProg()->getGlobalInfo(quad.getSrc1());
+		if (stackArgs(numFormals(callee)) > 0)
+		{
+			throw new InternalError("Tail call with stack arguments");
+		}
+		genFrameTeardown(out, proc);
+		out.instr("jmp", {AsmArg::makeLabel(calleeLabel(callee))});
 	}
 
-	void SymOpd::genStoreVal(std::ostream &out, Register reg)
+	static void genGetArg(AsmList &out, Procedure *proc, const Quad &quad)
 	{
-		out << getMovOp() << " " << getReg(reg) << ", " << getMemoryLoc() << "\n";
+		Opd dst = quad.getDst();
+		size_t index = quad.getIndex();
+		if (index <= 6)
+		{
+			proc->genStoreVal(out, dst, RegUtils::argReg(index));
+			return;
+		}
+		// The caller pushed args in order, so the last one (or
+		// the alignment pad) sits right above our return address
+		size_t numArgs = proc->getFormals().size();
+		size_t stackIndex = 8 * (numArgs - index + stackPadding(numArgs));
+		out.instr("movq", {AsmArg::makeMem(proc->frameLoc(int(stackIndex))),
+			AsmArg::makeReg(A, 8)});
+		proc->genStoreVal(out, dst, A);
 	}
 
-	void SymOpd::genLoadAddr(std::ostream &out, Register reg)
+	static void genSetArg(AsmList &out, Procedure *proc, const Quad &quad)
 	{
-		TODO(Implement me if necessary)
+		Opd src = quad.getSrc1();
+		size_t index = quad.getIndex();
+		if (index <= 6)
+		{
+			proc->genLoadVal(out, src, RegUtils::argReg(index));
+			return;
+		}
+		proc->genLoadVal(out, src, A);
+		out.instr("pushq", {AsmArg::makeReg(A, 8)});
+		proc->adjustStackDepth(8);
 	}
 
-	void AuxOpd::genLoadVal(std::ostream &out, Register reg)
+	static void genWrite(AsmList &out, Procedure *proc, const Quad &quad)
 	{
-		out << getMovOp() << " " << getMemoryLoc() << ", " << getReg(reg) << "\n";
+		proc->genLoadVal(out, quad.getSrc1(), DI);
+		switch (quad.getIOType())
+		{
+		case INT:
+			out.instr("callq", {AsmArg::makeLabel("printInt")});
+			break;
+		case STRING:
+			out.instr("callq", {AsmArg::makeLabel("printString")});
+			break;
+		case BOOL:
+			out.instr("callq", {AsmArg::makeLabel("printBool")});
+			break;
+		case VOID:
+			throw new InternalError("Write of void");
+		}
 	}
 
-	void AuxOpd::genStoreVal(std::ostream &out, Register reg)
-	{
-		out << getMovOp() << " " << getReg(reg) << ", " << getMemoryLoc() << "\n";
-	}
-	void AuxOpd::genLoadAddr(std::ostream &out, Register reg)
+	static void genRead(AsmList &out, Procedure *proc, const Quad &quad)
 	{
-		TODO(Implement me)
+		switch (quad.getIOType())
+		{
+		case INT:
+			out.instr("callq", {AsmArg::makeLabel("getInt")});
+			break;
+		case BOOL:
+			out.instr("callq", {AsmArg::makeLabel("getBool")});
+			break;
+		default:
+			throw new InternalError("Read of non-scalar");
+		}
+		proc->genStoreVal(out, quad.getDst(), A);
 	}
 
-	void AddrOpd::genStoreVal(std::ostream &out, Register reg)
+	void Quad::codegenX64(AsmList &out, Procedure *proc) const
 	{
-		TODO(Implement me)
+		switch (getOp())
+		{
+		case BINOP_QUAD:
+			genBinOp(out, proc, *this);
+			return;
+		case UNARYOP_QUAD:
+			genUnaryOp(out, proc, *this);
+			return;
+		case ASSIGN_QUAD:
+			// Straight into or out of a register where there is one
+			if (myDst.isVReg() && proc->getVReg(myDst).inReg)
+			{
+				proc->genLoadVal(out, mySrc1, proc->getVReg(myDst).reg);
+			}
+			else if (mySrc1.isVReg() && proc->getVReg(mySrc1).inReg)
+			{
+				proc->genStoreVal(out, myDst, proc->getVReg(mySrc1).reg);
+			}
+			else if (isImm(proc, mySrc1) && proc->widthOf(myDst) == 8)
+			{
+				out.instr("movq", {operand(proc, mySrc1), operand(proc, myDst)});
+			}
+			else
+			{
+				proc->genLoadVal(out, mySrc1, A);
+				proc->genStoreVal(out, myDst, A);
+			}
+			return;
+		case GOTO_QUAD:
+			out.instr("jmp", {AsmArg::makeLabel(proc->labelName(getTarget()))});
+			return;
+		case IFZ_QUAD:
+			genTestZero(out, proc, mySrc1);
+			out.instr("je", {AsmArg::makeLabel(proc->labelName(getTarget()))});
+			return;
+		case NOP_QUAD:
+			// Only there to hold a label, which can sit on
+			// whatever comes next
+			return;
+		case WRITE_QUAD:
+			genWrite(out, proc, *this);
+			return;
+		case READ_QUAD:
+			genRead(out, proc, *this);
+			return;
+		case EXIT_QUAD:
+			out.instr("call", {AsmArg::makeLabel("exit")});
+			return;
+		case MAGIC_QUAD:
+			out.instr("callq", {AsmArg::makeLabel("magic")});
+			proc->genStoreVal(out, myDst, A);
+			return;
+		case CALL_QUAD:
+			genCall(out, proc, *this);
+			return;
+		case ENTER_QUAD:
+			if (proc->getFrameKind() == RBP_FRAME)
+			{
+				AsmArg rbp = AsmArg::makeReg(BP, 8);
+				out.instr("pushq", {rbp});
+				out.instr("movq", {AsmArg::makeReg(SP, 8), rbp});
+				out.instr("addq", {AsmArg::makeImm(16), rbp});
+			}
+			// A frame whose values all live in registers reserves nothing
+			if (proc->getFrameKind() != NO_FRAME && proc->arSize() > 0)
+			{
+				out.instr("subq", {AsmArg::makeImm(int64_t(proc->arSize())),
+					AsmArg::makeReg(SP, 8)});
+			}
+			for (size_t i = 0; i < proc->getSavedRegs().size(); i++)
+			{
+				out.instr("movq", {AsmArg::makeReg(proc->getSavedRegs()[i], 8),
+					AsmArg::makeMem(proc->frameLoc(savedRegOffset(i)))});
+			}
+			return;
+		case TAILCALL_QUAD:
+			genTailCall(out, proc, *this);
+			return;
+		case LEAVE_QUAD:
+			genFrameTeardown(out, proc);
+			out.instr("retq");
+			return;
+		case SETARG_QUAD:
+			genSetArg(out, proc, *this);
+			return;
+		case GETARG_QUAD:
+			genGetArg(out, proc, *this);
+			return;
+		case SETRET_QUAD:
+			proc->genLoadVal(out, mySrc1, A);
+			return;
+		case GETRET_QUAD:
+			proc->genStoreVal(out, myDst, A);
+			return;
+		case PHI_QUAD:
+			throw new InternalError("Phi left in the procedure at codegen");
+		}
+		throw new InternalError("No such quad");
 	}
 
-	void AddrOpd::genLoadVal(std::ostream &out, Register reg)
+	std::string Procedure::memLoc(Opd opd) const
 	{
-		TODO(Implement me)
+		if (opd.isGlobal())
+		{
+			return myProg->globalLoc(opd);
+		}
+		if (opd.isVReg())
+		{
+			return frameLoc(getVReg(opd).frameOffset);
+		}
+		throw new InternalError("Operand has no memory location");
 	}
 
-	void AddrOpd::genStoreAddr(std::ostream &out, Register reg)
+	std::string Procedure::frameLoc(int offset) const
 	{
-		TODO(Implement me)
+		if (frameKind == RBP_FRAME)
+		{
+			return std::to_string(offset) + "(%rbp)";
+		}
+		// %rbp would point just above the return address, which
+		// the prologue and any pushes since have moved %rsp below
+		int fromRsp = offset + 8 + int(arSize()) + stackDepth;
+		return std::to_string(fromRsp) + "(%rsp)";
 	}
 
-	void AddrOpd::genLoadAddr(std::ostream &out, Register reg)
+	void Procedure::genLoadVal(AsmList &out, Opd opd, Register reg) const
 	{
-		TODO(Implement me)
+		size_t width = widthOf(opd);
+		AsmArg to = AsmArg::makeReg(reg, width);
+		if (opd.isConst())
+		{
+			out.instr(Opd::movOp(width),
+				{AsmArg::makeImm(myProg->constString(opd)), to});
+			return;
+		}
+		if (opd.isVReg() && getVReg(opd).inReg)
+		{
+			Register home = getVReg(opd).reg;
+			if (home != reg)
+			{
+				out.instr(Opd::movOp(width), {AsmArg::makeReg(home, width), to});
+			}
+			return;
+		}
+		out.instr(Opd::movOp(width), {AsmArg::makeMem(memLoc(opd)), to});
 	}
 
-	void LitOpd::genLoadVal(std::ostream &out, Register reg)
+	void Procedure::genStoreVal(AsmList &out, Opd opd, Register reg) const
 	{
-		out << getMovOp() << " $" << val << ", " << getReg(reg) << "\n";
+		size_t width = widthOf(opd);
+		AsmArg from = AsmArg::makeReg(reg, width);
+		if (opd.isVReg() && getVReg(opd).inReg)
+		{
+			Register home = getVReg(opd).reg;
+			if (home != reg)
+			{
+				out.instr(Opd::movOp(width), {from, AsmArg::makeReg(home, width)});
+			}
+			return;
+		}
+		out.instr(Opd::movOp(width), {from, AsmArg::makeMem(memLoc(opd))});
 	}
 
 }